@@ -0,0 +1,322 @@
+/* Streaming statistics of results.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The mean and variance are kept with Welford's method, and arrays (or other accumulators) are added
+ * by combining their moments (Chan et al.'s formula), which is as accurate, and vectorizes.
+ *
+ * Quantiles are estimated with a KLL-style sketch: level h holds up to DIE_ACC_LEVEL_SIZE values, each
+ * standing for 2^h values added. When a level fills up it's sorted, and every other value (alternating
+ * between the odd and even ones each time) moves up a level, so memory grows with the log of the count.
+ * Merging sketches adds the values of each level to the same level.
+ *
+ * Since the values moved up are sorted, a level above 0 is usually two sorted halves when it fills up
+ * (not after a merge added to it), and then only needs the last pass of the merge sort. */
+
+#include "libdie.h"
+#include "alloc.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// A value carrying its weight, for die_stats_acc_quantile.
+struct weighted_value {
+	double value;
+	uint64_t weight;
+};
+
+void combine_moments(struct die_stats_acc *acc, uint64_t count, double mean, double m2, double min, double max);
+bool reserve_acc_levels(struct die_stats_acc *acc, unsigned level_count);
+bool sketch_insert(struct die_stats_acc *acc, unsigned level, double value);
+bool compact_level(struct die_stats_acc *acc, unsigned level);
+bool are_halves_sorted(const double *values);
+void sort_level(double *values, unsigned run_length);
+int comp_doubles(const void *d1, const void *d2);
+int comp_weighted_values(const void *v1, const void *v2);
+
+
+void die_stats_acc_init(struct die_stats_acc *acc)
+{
+	*acc = (struct die_stats_acc) {
+		.count = 0,
+		.nan_count = 0,
+		.mean = 0,
+		.m2 = 0,
+		.min = INFINITY,
+		.max = -INFINITY,
+		.levels = NULL,
+		.level_count = 0,
+		.compaction_parity = 0,
+	};
+}
+
+void clear_die_stats_acc(struct die_stats_acc *acc)
+{
+	die_free(acc->levels);
+	acc->levels = NULL;
+	acc->level_count = 0;
+}
+
+
+/* -- Moments -- */
+
+/* Add count values of the given mean, m2 (sum of squared differences from their mean), min and max. */
+void combine_moments(struct die_stats_acc *acc, uint64_t count, double mean, double m2, double min, double max)
+{
+	const uint64_t total = acc->count + count;
+	const double delta = mean - acc->mean;
+
+	if(count == 0)
+		return;
+
+	acc->mean += delta * ((double) count / total);
+	acc->m2 += m2 + delta * delta * ((double) acc->count * count / total);
+	acc->count = total;
+	if(min < acc->min)
+		acc->min = min;
+	if(max > acc->max)
+		acc->max = max;
+}
+
+double die_stats_acc_variance(const struct die_stats_acc *acc)
+{
+	return (acc->count > 0) ? acc->m2 / acc->count : NAN;
+}
+
+
+/* -- Sketch -- */
+
+/* Make sure acc has at least level_count levels (new ones are empty). Return true on memory failure. */
+bool reserve_acc_levels(struct die_stats_acc *acc, unsigned level_count)
+{
+	double *new_levels;
+
+	if(level_count <= acc->level_count)
+		return false;
+	if(level_count > DIE_ACC_MAX_LEVELS)
+		level_count = DIE_ACC_MAX_LEVELS;
+
+	if(!(new_levels = die_realloc(acc->levels, (size_t) level_count * DIE_ACC_LEVEL_SIZE * sizeof(*new_levels))))
+		return true;
+	for(unsigned level = acc->level_count; level < level_count; level++)
+		acc->level_lengths[level] = 0;
+
+	acc->levels = new_levels;
+	acc->level_count = level_count;
+	return false;
+}
+
+int comp_doubles(const void *d1, const void *d2)
+{
+	const double val1 = *(const double*) d1;
+	const double val2 = *(const double*) d2;
+
+	return (val1 > val2) - (val1 < val2);
+}
+
+/* Return true if each half of the DIE_ACC_LEVEL_SIZE values is sorted. */
+bool are_halves_sorted(const double *values)
+{
+	for(unsigned i = 1; i < DIE_ACC_LEVEL_SIZE; i++)
+		if(i != DIE_ACC_LEVEL_SIZE / 2 && values[i - 1] > values[i])
+			return false;
+	return true;
+}
+
+// Put the smaller of values[i] and values[j] at i, and the bigger at j.
+// (Two separate conditions, so they compile to min and max instructions instead of a branch).
+#define COMPARE_EXCHANGE(values, i, j) do {					\
+	const double first = (values)[i];					\
+	const double second = (values)[j];					\
+										\
+	(values)[i] = (first < second) ? first : second;			\
+	(values)[j] = (first > second) ? first : second;			\
+} while(0)
+
+/* Sort the DIE_ACC_LEVEL_SIZE values, which are sorted runs of run_length (a power of 2).
+ *
+ * A bitonic sorting network (in the form where every comparison is ascending): which elements it compares
+ * doesn't depend on the values, so nothing is mispredicted (the values are random), and the comparisons
+ * of a stage are independent of each other. */
+void sort_level(double *values, unsigned run_length)
+{
+	unsigned start, i;
+
+	// (Each stage is a single loop over the DIE_ACC_LEVEL_SIZE / 2 pairs it compares, since the loops
+	// over the elements of a run would be too short).
+	for(unsigned size = 2 * run_length; size <= DIE_ACC_LEVEL_SIZE; size *= 2) {
+		// Merge each pair of sorted runs of size / 2: first compare the first run with the second reversed,
+		for(unsigned pair = 0; pair < DIE_ACC_LEVEL_SIZE / 2; pair++) {
+			start = (pair & ~(size / 2 - 1)) * 2;
+			i = pair & (size / 2 - 1);
+			COMPARE_EXCHANGE(values, start + i, start + size - 1 - i);
+		}
+
+		// then each half is bitonic, sorted by comparing elements distance apart.
+		for(unsigned distance = size / 4; distance > 0; distance /= 2) {
+			for(unsigned pair = 0; pair < DIE_ACC_LEVEL_SIZE / 2; pair++) {
+				i = (pair & ~(distance - 1)) * 2 + (pair & (distance - 1));
+				COMPARE_EXCHANGE(values, i, i + distance);
+			}
+		}
+	}
+}
+
+/* Move every other value of the (full) level up a level. Return true on memory failure. */
+bool compact_level(struct die_stats_acc *acc, unsigned level)
+{
+	double kept[DIE_ACC_LEVEL_SIZE / 2];
+	double *const values = acc->levels + (size_t) level * DIE_ACC_LEVEL_SIZE;
+	const unsigned parity = (acc->compaction_parity >> level) & 1;
+
+	sort_level(values, (are_halves_sorted(values)) ? DIE_ACC_LEVEL_SIZE / 2 : 1);
+	// (Copied, since inserting may move the levels).
+	for(unsigned i = 0; i < DIE_ACC_LEVEL_SIZE / 2; i++)
+		kept[i] = values[2 * i + parity];
+
+	acc->compaction_parity ^= (uint64_t) 1 << level;
+	acc->level_lengths[level] = 0;
+
+	// (Level DIE_ACC_MAX_LEVELS - 1 holds values of weight 2^63, so it can't fill up).
+	for(unsigned i = 0; i < DIE_ACC_LEVEL_SIZE / 2; i++)
+		if(sketch_insert(acc, level + 1, kept[i]))
+			return true;
+	return false;
+}
+
+/* Add value (standing for 2^level values) to the sketch. Return true on memory failure. */
+bool sketch_insert(struct die_stats_acc *acc, unsigned level, double value)
+{
+	if(level >= acc->level_count && reserve_acc_levels(acc, level + 1))
+		return true;
+
+	acc->levels[(size_t) level * DIE_ACC_LEVEL_SIZE + acc->level_lengths[level]++] = value;
+	if(acc->level_lengths[level] == DIE_ACC_LEVEL_SIZE)
+		return compact_level(acc, level);
+	return false;
+}
+
+int comp_weighted_values(const void *v1, const void *v2)
+{
+	return comp_doubles(&((const struct weighted_value*) v1)->value, &((const struct weighted_value*) v2)->value);
+}
+
+double die_stats_acc_quantile(const struct die_stats_acc *acc, double q)
+{
+	struct weighted_value *values;
+	size_t value_count = 0;
+	uint64_t weight = 0;
+	double target;
+	double ret;
+
+	if(acc->count == 0 || !(q >= 0 && q <= 1))
+		return NAN;
+	if(q == 0)
+		return acc->min;
+	if(q == 1)
+		return acc->max;
+
+	if(!(values = die_malloc((size_t) acc->level_count * DIE_ACC_LEVEL_SIZE * sizeof(*values))))
+		return NAN;
+	for(unsigned level = 0; level < acc->level_count; level++)
+		for(unsigned i = 0; i < acc->level_lengths[level]; i++)
+			values[value_count++] = (struct weighted_value) {
+				.value = acc->levels[(size_t) level * DIE_ACC_LEVEL_SIZE + i],
+				.weight = (uint64_t) 1 << level,
+			};
+	if(value_count == 0) {	// (Cleared, or a failed sketch_insert: there's nothing to go by).
+		die_free(values);
+		return NAN;
+	}
+	qsort(values, value_count, sizeof(*values), comp_weighted_values);
+
+	// The smallest value with at least q of the (weighted) values at or below it.
+	target = q * acc->count;
+	ret = values[value_count - 1].value;
+	for(size_t i = 0; i < value_count; i++) {
+		weight += values[i].weight;
+		if(weight >= target) {
+			ret = values[i].value;
+			break;
+		}
+	}
+
+	die_free(values);
+	return ret;
+}
+
+
+/* -- Adding -- */
+
+bool die_stats_acc_add(struct die_stats_acc *acc, double value)
+{
+	if(isnan(value)) {
+		acc->nan_count++;
+		return false;
+	}
+
+	combine_moments(acc, 1, value, 0, value, value);
+	return sketch_insert(acc, 0, value);
+}
+
+bool die_stats_acc_add_array(struct die_stats_acc *acc, const double *values, size_t count)
+{
+	uint64_t block_count = 0;
+	double sum = 0;
+	double mean;
+	double m2 = 0;
+	double min = INFINITY;
+	double max = -INFINITY;
+
+	// (Two passes: the mean, then the squared differences from it).
+	for(size_t i = 0; i < count; i++) {
+		if(isnan(values[i]))
+			continue;
+		block_count++;
+		sum += values[i];
+		if(values[i] < min)
+			min = values[i];
+		if(values[i] > max)
+			max = values[i];
+	}
+	acc->nan_count += count - block_count;
+	if(block_count == 0)
+		return false;
+
+	mean = sum / block_count;
+	for(size_t i = 0; i < count; i++)
+		if(!isnan(values[i]))
+			m2 += (values[i] - mean) * (values[i] - mean);
+
+	combine_moments(acc, block_count, mean, m2, min, max);
+
+	for(size_t i = 0; i < count; i++)
+		if(!isnan(values[i]) && sketch_insert(acc, 0, values[i]))
+			return true;
+	return false;
+}
+
+bool die_stats_acc_merge(struct die_stats_acc *acc, const struct die_stats_acc *other)
+{
+	combine_moments(acc, other->count, other->mean, other->m2, other->min, other->max);
+	acc->nan_count += other->nan_count;
+
+	for(unsigned level = 0; level < other->level_count; level++)
+		for(unsigned i = 0; i < other->level_lengths[level]; i++)
+			if(sketch_insert(acc, level, other->levels[(size_t) level * DIE_ACC_LEVEL_SIZE + i]))
+				return true;
+	return false;
+}
@@ -0,0 +1,103 @@
+/* Allocation through the library's allocator.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "alloc.h"
+#include "stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The default allocator, using the standard library. */
+
+static void* std_malloc(size_t size, void *context)
+{
+	(void) context;
+	return malloc(size);
+}
+
+static void* std_realloc(void *ptr, size_t size, void *context)
+{
+	(void) context;
+	return realloc(ptr, size);
+}
+
+static void std_free(void *ptr, void *context)
+{
+	(void) context;
+	free(ptr);
+}
+
+static const struct die_allocator std_allocator = {
+	.malloc = std_malloc,
+	.realloc = std_realloc,
+	.free = std_free,
+	.context = NULL
+};
+
+static struct die_allocator global_allocator = std_allocator;
+
+// Overrides global_allocator in the thread if thread_allocator_set.
+static _Thread_local struct die_allocator thread_allocator;
+static _Thread_local bool thread_allocator_set = false;
+
+#define CURRENT_ALLOCATOR() (thread_allocator_set ? &thread_allocator : &global_allocator)
+
+
+void die_set_allocator(const struct die_allocator *allocator)
+{
+	global_allocator = (allocator) ? *allocator : std_allocator;
+}
+
+void die_set_thread_allocator(const struct die_allocator *allocator)
+{
+	if((thread_allocator_set = (allocator != NULL)))
+		thread_allocator = *allocator;
+}
+
+void* die_malloc(size_t size)
+{
+	const struct die_allocator *const allocator = CURRENT_ALLOCATOR();
+
+	STAT_ADD(allocations, 1);
+	return allocator->malloc(size, allocator->context);
+}
+
+void* die_calloc(size_t nmemb, size_t size)
+{
+	void *ret;
+
+	if(size != 0 && nmemb > SIZE_MAX / size)
+		return NULL;
+
+	if((ret = die_malloc(nmemb * size)))
+		memset(ret, 0, nmemb * size);
+	return ret;
+}
+
+void* die_realloc(void *ptr, size_t size)
+{
+	const struct die_allocator *const allocator = CURRENT_ALLOCATOR();
+
+	STAT_ADD(allocations, 1);
+	return allocator->realloc(ptr, size, allocator->context);
+}
+
+void die_free(void *ptr)
+{
+	const struct die_allocator *const allocator = CURRENT_ALLOCATOR();
+
+	allocator->free(ptr, allocator->context);
+}
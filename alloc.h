@@ -0,0 +1,36 @@
+/* Allocation through the library's allocator - internal header.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* All allocations made by the library should go through these (die_free is in libdie.h),
+ * so they reach the allocator set by die_set_allocator/die_set_thread_allocator.
+ *
+ * Lists generated from list.h call malloc/realloc/free directly, so before generating their
+ * functions, define:
+ * 	#define malloc(size) die_malloc(size)
+ * 	#define calloc(nmemb, size) die_calloc(nmemb, size)
+ * 	#define realloc(ptr, size) die_realloc(ptr, size)
+ * 	#define free(ptr) die_free(ptr)
+ * (and undefine them after). */
+#pragma once
+
+#include "libdie.h"
+
+#include <stddef.h>
+
+void* die_malloc(size_t size);
+void* die_calloc(size_t nmemb, size_t size);
+void* die_realloc(void *ptr, size_t size);
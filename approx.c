@@ -0,0 +1,364 @@
+/* Normal approximation of sums of dice.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The cumulants of independent values add up (and scale by c^n when a value is multiplied by c), so
+ * those of a linear operation (dice and numbers added, subtracted, or multiplied and divided by
+ * numbers) are found from those of a single die, once per section.
+ *
+ * The CDF is the normal one corrected by the Edgeworth series (to the skewness and kurtosis), and the
+ * quantiles by the matching Cornish-Fisher expansion. When the results are on a lattice (like sums of
+ * dice, on consecutive integers), the CDF is taken halfway between lattice points (continuity correction)
+ * and quantiles are lattice points. */
+
+#include "libdie.h"
+#include "rng.h"
+#include "stats.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+// Berry-Esseen constant for sums of values that aren't identically distributed (Shevtsova, 2010).
+#define BERRY_ESSEEN_CONSTANT 0.5600
+#define SQRT_2PI 2.50662827463100050242
+// Most lattice points die_approx_quantile moves from the Cornish-Fisher estimate.
+#define MAX_QUANTILE_STEPS 64
+
+// The distribution of a linear operation (or part of one).
+struct linear_value {
+	double cumulants[4];	// Mean, variance, and the third and fourth cumulants.
+	double abs_moment;	// Sum of E|X - mean|^3 of the independent values summed.
+	double base;		// The result when every die rolls 1.
+	double lattice;		// The results are base + k * lattice (0 if constant, NaN if not known).
+	double support;		// Number of results an exact distribution would have (about).
+	double work;		// Steps to calculate the exact distribution (about).
+};
+
+double sum_odd_cubes(double n);
+bool get_die_linear_value(struct Die die, struct linear_value *value);
+bool get_section_linear_value(struct NumSection section, struct linear_value *value);
+bool get_linear_value(const struct Operation *operation, struct linear_value *value);
+bool combine_linear_values(struct linear_value *value, char operator, const struct linear_value *other);
+void scale_linear_value(struct linear_value *value, double factor);
+double lattice_gcd(double a, double b);
+double normal_cdf(double z);
+double normal_quantile(double p);
+double edgeworth_cdf(const struct die_normal_approx *approx, double x);
+double cornish_fisher(const struct die_normal_approx *approx, double z);
+double uniform_01();
+
+
+/* -- Cumulants -- */
+
+/* Return 1^3 + 3^3 + 5^3 + ... + (2n - 1)^3. */
+double sum_odd_cubes(double n)
+{
+	return n * n * (2 * n * n - 1);
+}
+
+bool get_die_linear_value(struct Die die, struct linear_value *value)
+{
+	const double sides = die.sides;
+	const double square = sides * sides;
+	const double dice = die.repetitions;
+	double abs_moment;
+
+	// E|X - mean|^3 of a die: the distances from the mean are 1, 2, ..., (sides - 1) / 2 on each side
+	// if sides is odd, otherwise 1/2, 3/2, ..., (sides - 1) / 2.
+	if(die.sides % 2 == 1)
+		abs_moment = 2 * pow((sides - 1) / 2 * ((sides - 1) / 2 + 1) / 2, 2) / sides;
+	else
+		abs_moment = 2 * sum_odd_cubes(sides / 2) / 8 / sides;
+
+	*value = (struct linear_value) {
+		.cumulants = {
+			dice * (sides + 1) / 2,
+			dice * (square - 1) / 12,
+			0,
+			-dice * (square * square - 1) / 120,
+		},
+		.abs_moment = dice * abs_moment,
+		.base = dice,
+		.lattice = (die.sides > 1 && die.repetitions > 0) ? 1 : 0,
+		.support = dice * (sides - 1) + 1,
+		.work = dice * (dice * (sides - 1) + 1),
+	};
+	return false;
+}
+
+bool get_section_linear_value(struct NumSection section, struct linear_value *value)
+{
+	switch (section.type) {
+	case(type_num):
+		*value = (struct linear_value) {
+			.cumulants = { section.data.num, 0, 0, 0 },
+			.abs_moment = 0,
+			.base = section.data.num,
+			.lattice = 0,
+			.support = 1,
+			.work = 0,
+		};
+		return false;
+	case(type_die):
+		return get_die_linear_value(section.data.die, value);
+	case(type_op):
+		return get_linear_value(section.data.operation, value);
+
+	default:	// (type_slot).
+		return true;
+	}
+}
+
+/* Return the biggest lattice both a and b are on (0 stands for a constant, NaN for no lattice). */
+double lattice_gcd(double a, double b)
+{
+	double remainder;
+
+	if(a == 0 || b == 0)
+		return a + b;
+	if(a != floor(a) || b != floor(b))	// (Also NaN).
+		return (a == b) ? a : NAN;
+
+	while(b != 0) {
+		remainder = fmod(a, b);
+		a = b;
+		b = remainder;
+	}
+	return a;
+}
+
+void scale_linear_value(struct linear_value *value, double factor)
+{
+	double power = factor;
+
+	for(int i = 0; i < 4; i++, power *= factor)
+		value->cumulants[i] *= power;
+	value->abs_moment *= fabs(factor * factor * factor);
+	value->base *= factor;
+	value->lattice *= fabs(factor);
+}
+
+/* Set value to that of `value operator other`. Return true if it isn't linear. */
+bool combine_linear_values(struct linear_value *value, char operator, const struct linear_value *other)
+{
+	const bool constant = value->cumulants[1] == 0 && value->lattice == 0;
+	const bool other_constant = other->cumulants[1] == 0 && other->lattice == 0;
+	double constant_value;
+
+	switch (operator) {
+	case('+'):
+	case('-'):
+		// (Subtracting is adding the negated value: odd cumulants change sign).
+		for(int i = 0; i < 4; i++)
+			value->cumulants[i] += (operator == '-' && i % 2 == 0) ? -other->cumulants[i] : other->cumulants[i];
+		value->abs_moment += other->abs_moment;
+		value->base += (operator == '-') ? -other->base : other->base;
+		value->lattice = lattice_gcd(value->lattice, other->lattice);
+		value->work += value->support * other->support;
+		value->support += other->support - 1;
+		return false;
+
+	case('*'):
+		if(other_constant) {
+			scale_linear_value(value, other->cumulants[0]);
+		} else if(constant) {
+			constant_value = value->cumulants[0];
+			*value = *other;
+			scale_linear_value(value, constant_value);
+		} else {
+			return true;
+		}
+		return false;
+	case('/'):
+		if(!other_constant || other->cumulants[0] == 0)
+			return true;
+		scale_linear_value(value, 1 / other->cumulants[0]);
+		return false;
+
+	default:
+		return true;
+	}
+}
+
+/* Set value to that of operation. Return true if it isn't linear. */
+bool get_linear_value(const struct Operation *operation, struct linear_value *value)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	char_iterator operator_ite = get_char_list_iterator(&operation->operators);
+	struct linear_value other;
+	struct NumSection section;
+	char operator;
+
+	NumSection_list_get(&section_ite, &operation->numbers, &section);
+	if(get_section_linear_value(section, value))
+		return true;
+	if(operation->prefix == '-')
+		scale_linear_value(value, -1);
+
+	while(!char_list_get(&operator_ite, &operation->operators, &operator)) {
+		NumSection_list_get(&section_ite, &operation->numbers, &section);
+		if(get_section_linear_value(section, &other) || combine_linear_values(value, operator, &other))
+			return true;
+	}
+
+	return false;
+}
+
+bool op_normal_approx(const struct Operation *operation, struct die_normal_approx *approx)
+{
+	struct linear_value value;
+	double sd;
+
+	if(get_linear_value(operation, &value) || !(value.cumulants[1] > 0) || !isfinite(value.cumulants[1]))
+		return true;
+
+	sd = sqrt(value.cumulants[1]);
+	*approx = (struct die_normal_approx) {
+		.mean = value.cumulants[0],
+		.variance = value.cumulants[1],
+		.skewness = value.cumulants[2] / (sd * sd * sd),
+		.excess_kurtosis = value.cumulants[3] / (value.cumulants[1] * value.cumulants[1]),
+		.lattice = (value.lattice > 0) ? value.lattice : 0,
+		.lattice_base = value.base,
+		.error_bound = fmin(1, BERRY_ESSEEN_CONSTANT * value.abs_moment / (sd * sd * sd)),
+	};
+	approx->preferred = approx->error_bound <= DIE_APPROX_MAX_ERROR
+		&& (value.work > DIE_APPROX_MIN_WORK || value.support > DIE_DIST_MAX_SUPPORT);
+	return false;
+}
+
+
+/* -- The normal distribution -- */
+
+double normal_cdf(double z)
+{
+	return 0.5 * erfc(-z / sqrt(2));
+}
+
+/* Return the z for which normal_cdf(z) == p (0 < p < 1).
+ *
+ * Acklam's rational approximation (relative error below 1.2e-9), refined by a step of Halley's method. */
+double normal_quantile(double p)
+{
+	static const double a[] = { -3.969683028665376e+01, 2.209460984245205e+02, -2.759285104469687e+02,
+		1.383577518672690e+02, -3.066479806614716e+01, 2.506628277459239e+00 };
+	static const double b[] = { -5.447609879822406e+01, 1.615858368580409e+02, -1.556989798598866e+02,
+		6.680131188771972e+01, -1.328068155288572e+01 };
+	static const double c[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+		-2.549732539343734e+00, 4.374664141464968e+00, 2.938163982698783e+00 };
+	static const double d[] = { 7.784695709041462e-03, 3.224671290700398e-01, 2.445134137142996e+00,
+		3.754408661907416e+00 };
+	const double low = 0.02425;
+	double q, r, z, error;
+
+	if(p < low) {
+		q = sqrt(-2 * log(p));
+		z = (((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5])
+			/ ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+	} else if(p <= 1 - low) {
+		q = p - 0.5;
+		r = q * q;
+		z = (((((a[0]*r + a[1])*r + a[2])*r + a[3])*r + a[4])*r + a[5])*q
+			/ (((((b[0]*r + b[1])*r + b[2])*r + b[3])*r + b[4])*r + 1);
+	} else {
+		q = sqrt(-2 * log(1 - p));
+		z = -(((((c[0]*q + c[1])*q + c[2])*q + c[3])*q + c[4])*q + c[5])
+			/ ((((d[0]*q + d[1])*q + d[2])*q + d[3])*q + 1);
+	}
+
+	error = (normal_cdf(z) - p) * SQRT_2PI * exp(z * z / 2);
+	return z - error / (1 + z * error / 2);
+}
+
+/* Return the Edgeworth approximation of P(result <= x), for x halfway between lattice points. */
+double edgeworth_cdf(const struct die_normal_approx *approx, double x)
+{
+	const double z = (x - approx->mean) / sqrt(approx->variance);
+	const double z2 = z * z;
+	const double skew = approx->skewness;
+	const double density = exp(-z2 / 2) / SQRT_2PI;
+	double ret;
+
+	ret = normal_cdf(z) - density * (skew / 6 * (z2 - 1)
+			+ approx->excess_kurtosis / 24 * z * (z2 - 3)
+			+ skew * skew / 72 * z * (z2 * z2 - 10 * z2 + 15));
+	return fmin(1, fmax(0, ret));
+}
+
+/* Return the Cornish-Fisher approximation of the quantile of the normal quantile z. */
+double cornish_fisher(const struct die_normal_approx *approx, double z)
+{
+	const double skew = approx->skewness;
+	const double z2 = z * z;
+
+	return approx->mean + sqrt(approx->variance) * (z + skew / 6 * (z2 - 1)
+			+ approx->excess_kurtosis / 24 * z * (z2 - 3)
+			- skew * skew / 36 * z * (2 * z2 - 5));
+}
+
+
+/* -- Queries -- */
+
+double die_approx_cdf(const struct die_normal_approx *approx, double x)
+{
+	double point;
+
+	if(approx->lattice == 0)
+		return edgeworth_cdf(approx, x);
+
+	// (The last lattice point at or below x, with some room for rounding).
+	point = floor((x - approx->lattice_base) / approx->lattice + 1e-9);
+	return edgeworth_cdf(approx, approx->lattice_base + (point + 0.5) * approx->lattice);
+}
+
+double die_approx_quantile(const struct die_normal_approx *approx, double q)
+{
+	double x;
+
+	if(!(q > 0 && q < 1))
+		return NAN;
+
+	x = cornish_fisher(approx, normal_quantile(q));
+	if(approx->lattice == 0)
+		return x;
+
+	// The smallest lattice point whose CDF is at least q (near the estimate).
+	x = approx->lattice_base + round((x - approx->lattice_base) / approx->lattice) * approx->lattice;
+	for(int i = 0; i < MAX_QUANTILE_STEPS && die_approx_cdf(approx, x - approx->lattice) >= q; i++)
+		x -= approx->lattice;
+	for(int i = 0; i < MAX_QUANTILE_STEPS && die_approx_cdf(approx, x) < q; i++)
+		x += approx->lattice;
+	return x;
+}
+
+/* Return a uniform value in (0, 1), from active_rng if set, otherwise rand(). */
+double uniform_01()
+{
+	struct die_rng *const rng = active_rng;
+	uint64_t bits;
+
+	STAT_ADD(rng_draws, (rng) ? 2 : 1);
+	if(!rng)
+		return (rand() + 0.5) / ((double) RAND_MAX + 1);
+
+	bits = ((uint64_t) rng_next(rng) << 21) ^ (rng_next(rng) >> 11);	// (53 bits).
+	return (bits + 0.5) * 0x1p-53;
+}
+
+double die_approx_sample(const struct die_normal_approx *approx)
+{
+	return die_approx_quantile(approx, uniform_01());
+}
@@ -0,0 +1,433 @@
+/* Asynchronous calculation of operations by a thread pool.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Submitted jobs go through a bounded lock-free MPMC ring (Dmitry Vyukov's design: each cell has a
+ * sequence number telling whether it's ready to be written or read at a position), and a semaphore
+ * counting them wakes the workers.
+ * Completions without a callback go through a second ring to die_reap, and are signaled on an eventfd
+ * (a pipe where there's none). Room for them is reserved on submission, so workers never wait. */
+#define _GNU_SOURCE
+
+#include "libdie.h"
+#include "alloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#define RING_CAPACITY DIE_ASYNC_CAPACITY
+#define INLINE_DICE_LIMIT 256	// Operations rolling fewer dice are calculated by die_submit itself.
+
+#define CACHE_LINE 64
+
+struct job {
+	const struct Operation *operation;
+	char *calc_string;
+	short flags;
+	die_callback callback;
+	void *userdata;
+	double result;
+};
+
+struct ring_cell {
+	atomic_size_t sequence;
+	struct job job;
+};
+
+struct ring {
+	struct ring_cell *cells;
+	// (Separate cache lines, since producers and consumers write them from different threads.)
+	_Alignas(CACHE_LINE) atomic_size_t enqueue_position;
+	_Alignas(CACHE_LINE) atomic_size_t dequeue_position;
+};
+
+static struct {
+	pthread_mutex_t lock;		// Held while starting/stopping.
+	atomic_bool started;
+
+	struct ring submissions;
+	struct ring completions;
+	atomic_size_t reserved_completions;	// Submitted without callback and not reaped yet.
+	sem_t available;		// Number of submissions (plus wake-ups to stop).
+	atomic_bool stopping;
+
+	pthread_t *threads;
+	unsigned thread_count;
+
+	int completion_fd;		// eventfd (or the read end of completion_pipe).
+	int completion_pipe[2];
+} pool = { .lock = PTHREAD_MUTEX_INITIALIZER, .completion_fd = -1, .completion_pipe = {-1, -1} };
+
+bool ring_init(struct ring *ring);
+void ring_close(struct ring *ring);
+bool ring_push(struct ring *ring, const struct job *job);
+bool ring_pop(struct ring *ring, struct job *job);
+bool open_completion_fd();
+void close_completion_fd();
+void signal_completion();
+void drain_completion_fd();
+void deliver(struct job *job);
+void* run_worker(void *unused);
+double get_dice_count(const struct Operation *operation);
+
+
+bool ring_init(struct ring *ring)
+{
+	if(!(ring->cells = die_malloc(RING_CAPACITY * sizeof(*ring->cells))))
+		return true;
+
+	for(size_t i = 0; i < RING_CAPACITY; i++)
+		atomic_init(&ring->cells[i].sequence, i);
+	atomic_init(&ring->enqueue_position, 0);
+	atomic_init(&ring->dequeue_position, 0);
+	return false;
+}
+
+void ring_close(struct ring *ring)
+{
+	die_free(ring->cells);
+	ring->cells = NULL;
+}
+
+/* Add job to ring. Returns true if it's full. */
+bool ring_push(struct ring *ring, const struct job *job)
+{
+	size_t position = atomic_load_explicit(&ring->enqueue_position, memory_order_relaxed);
+	struct ring_cell *cell;
+	intptr_t difference;
+
+	for(;;) {
+		cell = &ring->cells[position & (RING_CAPACITY - 1)];
+		difference = (intptr_t) atomic_load_explicit(&cell->sequence, memory_order_acquire)
+			- (intptr_t) position;
+
+		if(difference == 0) {
+			if(atomic_compare_exchange_weak_explicit(&ring->enqueue_position, &position, position + 1,
+						memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if(difference < 0) {
+			return true;	// (The cell wasn't read since the last round).
+		} else {
+			position = atomic_load_explicit(&ring->enqueue_position, memory_order_relaxed);
+		}
+	}
+
+	cell->job = *job;
+	atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+	return false;
+}
+
+/* Remove the oldest job in ring into *job. Returns true if it's empty. */
+bool ring_pop(struct ring *ring, struct job *job)
+{
+	size_t position = atomic_load_explicit(&ring->dequeue_position, memory_order_relaxed);
+	struct ring_cell *cell;
+	intptr_t difference;
+
+	for(;;) {
+		cell = &ring->cells[position & (RING_CAPACITY - 1)];
+		difference = (intptr_t) atomic_load_explicit(&cell->sequence, memory_order_acquire)
+			- (intptr_t) (position + 1);
+
+		if(difference == 0) {
+			if(atomic_compare_exchange_weak_explicit(&ring->dequeue_position, &position, position + 1,
+						memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if(difference < 0) {
+			return true;	// (The cell wasn't written yet).
+		} else {
+			position = atomic_load_explicit(&ring->dequeue_position, memory_order_relaxed);
+		}
+	}
+
+	*job = cell->job;
+	atomic_store_explicit(&cell->sequence, position + RING_CAPACITY, memory_order_release);
+	return false;
+}
+
+#ifdef __linux__
+
+bool open_completion_fd()
+{
+	return (pool.completion_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0;
+}
+
+void close_completion_fd()
+{
+	close(pool.completion_fd);
+	pool.completion_fd = -1;
+}
+
+void signal_completion()
+{
+	const uint64_t one = 1;
+	ssize_t ignored = write(pool.completion_fd, &one, sizeof(one));	// (Only fails if it's already readable).
+
+	(void) ignored;
+}
+
+void drain_completion_fd()
+{
+	uint64_t count;
+	ssize_t ignored = read(pool.completion_fd, &count, sizeof(count));
+
+	(void) ignored;
+}
+
+#else
+
+bool open_completion_fd()
+{
+	if(pipe(pool.completion_pipe) < 0)
+		return true;
+
+	for(int i = 0; i < 2; i++) {
+		fcntl(pool.completion_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(pool.completion_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	pool.completion_fd = pool.completion_pipe[0];
+	return false;
+}
+
+void close_completion_fd()
+{
+	close(pool.completion_pipe[0]);
+	close(pool.completion_pipe[1]);
+	pool.completion_pipe[0] = pool.completion_pipe[1] = pool.completion_fd = -1;
+}
+
+void signal_completion()
+{
+	ssize_t ignored = write(pool.completion_pipe[1], "", 1);	// (Only fails if the pipe is full).
+
+	(void) ignored;
+}
+
+void drain_completion_fd()
+{
+	char buffer[256];
+
+	while(read(pool.completion_fd, buffer, sizeof(buffer)) > 0)
+		;
+}
+
+#endif
+
+/* Calculate job and pass the result to its callback or die_reap. */
+void deliver(struct job *job)
+{
+	job->result = operate(job->operation, job->calc_string, job->flags);
+
+	if(job->callback) {
+		job->callback(job->result, job->userdata);
+	} else {
+		ring_push(&pool.completions, job);	// (Room was reserved by die_submit).
+		signal_completion();
+	}
+}
+
+void* run_worker(void *unused)
+{
+	struct job job;
+
+	(void) unused;
+
+	for(;;) {
+		while(sem_wait(&pool.available) != 0 && errno == EINTR)
+			;
+
+		// Each post is for a pushed job, though the oldest cell may still be written by another
+		// submitter, so keep trying (unless it's a post to stop, after all the submissions).
+		while(ring_pop(&pool.submissions, &job)) {
+			if(atomic_load(&pool.stopping))
+				return NULL;
+			sched_yield();
+		}
+		deliver(&job);
+	}
+
+	return NULL;
+}
+
+/* Return the number of dice operation rolls (as a double since it may be huge). */
+double get_dice_count(const struct Operation *operation)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	struct NumSection section;
+	double count = 0;
+
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section)) {
+		if(section.type == type_die)
+			count += section.data.die.repetitions;
+		else if(section.type == type_op)
+			count += get_dice_count(section.data.operation);
+	}
+
+	return count;
+}
+
+bool die_async_start(unsigned threads)
+{
+	bool failed = true;
+
+	pthread_mutex_lock(&pool.lock);
+	if(atomic_load(&pool.started)) {
+		pthread_mutex_unlock(&pool.lock);
+		return false;
+	}
+
+	if(threads == 0) {
+		long processors = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (processors > 0) ? processors : 1;
+	}
+
+	if(ring_init(&pool.submissions))
+		goto unlock;
+	if(ring_init(&pool.completions))
+		goto close_submissions;
+	if(!(pool.threads = die_malloc(threads * sizeof(*pool.threads))))
+		goto close_completions;
+	if(open_completion_fd())
+		goto free_threads;
+	if(sem_init(&pool.available, 0, 0) != 0)
+		goto close_fd;
+
+	atomic_store(&pool.stopping, false);
+	atomic_store(&pool.reserved_completions, 0);
+	for(pool.thread_count = 0; pool.thread_count < threads; pool.thread_count++) {
+		if(pthread_create(&pool.threads[pool.thread_count], NULL, run_worker, NULL) != 0)
+			break;
+	}
+
+	if(pool.thread_count == 0) {
+		sem_destroy(&pool.available);
+		goto close_fd;
+	}
+
+	atomic_store(&pool.started, true);
+	failed = false;
+	goto unlock;
+
+close_fd:
+	close_completion_fd();
+free_threads:
+	die_free(pool.threads);
+close_completions:
+	ring_close(&pool.completions);
+close_submissions:
+	ring_close(&pool.submissions);
+unlock:
+	pthread_mutex_unlock(&pool.lock);
+	return failed;
+}
+
+void die_async_stop()
+{
+	pthread_mutex_lock(&pool.lock);
+	if(!atomic_load(&pool.started)) {
+		pthread_mutex_unlock(&pool.lock);
+		return;
+	}
+
+	atomic_store(&pool.stopping, true);
+	for(unsigned i = 0; i < pool.thread_count; i++)
+		sem_post(&pool.available);
+	for(unsigned i = 0; i < pool.thread_count; i++)
+		pthread_join(pool.threads[i], NULL);
+
+	sem_destroy(&pool.available);
+	close_completion_fd();
+	die_free(pool.threads);
+	ring_close(&pool.completions);
+	ring_close(&pool.submissions);
+
+	atomic_store(&pool.started, false);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+bool die_submit(const struct Operation *operation, char *calc_string, short flags,
+		die_callback callback, void *userdata)
+{
+	struct job job = {
+		.operation = operation,
+		.calc_string = calc_string,
+		.flags = flags,
+		.callback = callback,
+		.userdata = userdata
+	};
+
+	if(!atomic_load(&pool.started) && die_async_start(0))
+		return true;
+
+	if(!callback && atomic_fetch_add(&pool.reserved_completions, 1) >= RING_CAPACITY) {
+		atomic_fetch_sub(&pool.reserved_completions, 1);
+		return true;
+	}
+
+	if(get_dice_count(operation) < INLINE_DICE_LIMIT) {
+		deliver(&job);
+		return false;
+	}
+
+	if(ring_push(&pool.submissions, &job)) {
+		if(!callback)
+			atomic_fetch_sub(&pool.reserved_completions, 1);
+		return true;
+	}
+
+	sem_post(&pool.available);
+	return false;
+}
+
+int die_completion_fd()
+{
+	return pool.completion_fd;
+}
+
+size_t die_reap(struct die_completion *completions, size_t max)
+{
+	struct job job;
+	size_t count = 0;
+
+	if(!atomic_load(&pool.started))
+		return 0;
+
+	drain_completion_fd();
+
+	while(count < max && !ring_pop(&pool.completions, &job)) {
+		completions[count].result = job.result;
+		completions[count].userdata = job.userdata;
+		count++;
+	}
+	atomic_fetch_sub(&pool.reserved_completions, count);
+
+	// Keep the fd readable while completions are left.
+	if(count == max && max != 0)
+		signal_completion();
+
+	return count;
+}
@@ -0,0 +1,243 @@
+/* Calculating an operation many times at once.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The trials are calculated in blocks of BATCH_LANES: each node of the operation is visited once per
+ * block, calculating a value for every lane (trial), and the operators run as loops over the lanes
+ * (with the operator chosen outside the loop, so the compiler may vectorize them).
+ *
+ * Each nesting level needs a buffer of lanes for the section being calculated (the node's own values
+ * are accumulated in the lanes given by its parent), so the scratch space is depth * BATCH_LANES. */
+
+#include "libdie.h"
+#include "alloc.h"
+
+#include <math.h>
+
+#define BATCH_LANES 1024
+
+void just_roll_lanes(struct Die die, double *lanes, size_t count);
+
+unsigned get_operation_depth(const struct Operation *operation);
+void batch_section(struct NumSection section, double *lanes, size_t count, double *scratch,
+		const double *slot_values);
+void batch_node(const struct Operation *operation, double *lanes, size_t count, double *scratch,
+		const double *slot_values);
+void combine_lanes(double *lanes, char operator, const double *values, size_t count);
+void combine_lanes_scalar(double *lanes, char operator, double value, size_t count);
+size_t get_batch_scratch_length(const struct Operation *operation);
+void batch_blocks(const struct Operation *operation, double *results, size_t count, double *scratch,
+		const double *slot_values);
+
+
+/* Return the number of nodes in the deepest path of operation (1 if it has no parenthesis). */
+unsigned get_operation_depth(const struct Operation *operation)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	struct NumSection section;
+	unsigned depth = 0;
+	unsigned sub_depth;
+
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section))
+		if(section.type == type_op && (sub_depth = get_operation_depth(section.data.operation)) > depth)
+			depth = sub_depth;
+
+	return depth + 1;
+}
+
+// lanes[i] = lanes[i] <operator> values[i]
+void combine_lanes(double *lanes, char operator, const double *values, size_t count)
+{
+	switch(operator) {
+	case('+'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] += values[i];
+		break;
+	case('-'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] -= values[i];
+		break;
+	case('*'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] *= values[i];
+		break;
+	case('/'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] /= values[i];
+		break;
+	case('%'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = fmod(lanes[i], values[i]);
+		break;
+	case('^'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = pow(lanes[i], values[i]);
+		break;
+	case('<'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] < values[i];
+		break;
+	case('>'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] > values[i];
+		break;
+	case(OPERATOR_LESS_EQUAL):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] <= values[i];
+		break;
+	case(OPERATOR_GREATER_EQUAL):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] >= values[i];
+		break;
+	case(OPERATOR_EQUAL):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] == values[i];
+		break;
+	}
+}
+
+// lanes[i] = lanes[i] <operator> value
+void combine_lanes_scalar(double *lanes, char operator, double value, size_t count)
+{
+	switch(operator) {
+	case('+'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] += value;
+		break;
+	case('-'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] -= value;
+		break;
+	case('*'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] *= value;
+		break;
+	case('/'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] /= value;
+		break;
+	case('%'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = fmod(lanes[i], value);
+		break;
+	case('^'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = pow(lanes[i], value);
+		break;
+	case('<'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] < value;
+		break;
+	case('>'):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] > value;
+		break;
+	case(OPERATOR_LESS_EQUAL):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] <= value;
+		break;
+	case(OPERATOR_GREATER_EQUAL):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] >= value;
+		break;
+	case(OPERATOR_EQUAL):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = lanes[i] == value;
+		break;
+	}
+}
+
+/* Set lanes to the values of section. */
+void batch_section(struct NumSection section, double *lanes, size_t count, double *scratch,
+		const double *slot_values)
+{
+	switch(section.type) {
+	case(type_num):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = section.data.num;
+		break;
+	case(type_die):
+		just_roll_lanes(section.data.die, lanes, count);
+		break;
+	case(type_op):
+		batch_node(section.data.operation, lanes, count, scratch, slot_values);
+		break;
+	case(type_slot):
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = slot_values[section.data.slot];
+		break;
+	}
+}
+
+/* Set lanes to the values of operation (left to right like operate_rec).
+ * scratch has BATCH_LANES for each level of nesting in operation. */
+void batch_node(const struct Operation *operation, double *lanes, size_t count, double *scratch,
+		const double *slot_values)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	char_iterator operator_ite = get_char_list_iterator(&operation->operators);
+	struct NumSection section;
+	char operator;
+
+	NumSection_list_get(&section_ite, &operation->numbers, &section);
+	batch_section(section, lanes, count, scratch, slot_values);
+	if(operation->prefix == '-')
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = -lanes[i];
+
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section)
+			&& !char_list_get(&operator_ite, &operation->operators, &operator)) {
+		if(section.type == type_num) {
+			combine_lanes_scalar(lanes, operator, section.data.num, count);
+		} else if(section.type == type_slot) {
+			combine_lanes_scalar(lanes, operator, slot_values[section.data.slot], count);
+		} else {
+			batch_section(section, scratch, count, scratch + BATCH_LANES, slot_values);
+			combine_lanes(lanes, operator, scratch, count);
+		}
+	}
+}
+
+/* Return the number of doubles batch_blocks needs as scratch for operation. */
+size_t get_batch_scratch_length(const struct Operation *operation)
+{
+	return (size_t) get_operation_depth(operation) * BATCH_LANES;
+}
+
+/* Same as operate_batch, with scratch (of get_batch_scratch_length(operation) doubles) given. */
+void batch_blocks(const struct Operation *operation, double *results, size_t count, double *scratch,
+		const double *slot_values)
+{
+	size_t block;
+
+	for(size_t start = 0; start < count; start += block) {
+		block = (count - start < BATCH_LANES) ? count - start : BATCH_LANES;
+		batch_node(operation, results + start, block, scratch, slot_values);
+	}
+}
+
+bool operate_batch(const struct Operation *operation, double *results, size_t count, const double *slot_values)
+{
+	double *scratch;
+
+	if(!(scratch = die_malloc(get_batch_scratch_length(operation) * sizeof(*scratch))))
+		return true;
+
+	batch_blocks(operation, results, count, scratch, slot_values);
+
+	die_free(scratch);
+	return false;
+}
@@ -0,0 +1,339 @@
+/* libdie benchmarks - report the cost of the library's functions as JSON.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Usage: libdie_bench [minimum milliseconds per benchmark]
+ *
+ * Each benchmark is run with doubling iterations until it takes at least the minimum time
+ * (100ms by default), and is printed to stdout as an element of the "benchmarks" array:
+ * 	{"name": ..., "expression": ..., "iterations": ..., "ns_per_op": ...,
+ * 	 "ops_per_sec": ..., "allocs_per_op": ...}
+ *
+ * allocs_per_op counts the allocations made through the library's allocator. */
+
+#include "../libdie.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int64_t just_roll(struct Die die);
+
+// Expressions benchmarked, from tiny to huge and deeply nested.
+static char *const corpus[] = {
+	"d20",
+	"3d6",
+	"d20+5",
+	"2d6+d4+3",
+	"4d6*2-1",
+	"d100-2^2d4",
+	"2d7+5/d6+4(d10)",
+	"d20+$0",
+	"6x4d6",
+	"1000d6",
+	"100000d20+30000d6",
+	"((((((((d6+1)*2)-3)/4)+5)*6)-7)^1)+(d4*(d8-(d10/(d12+(d20%7)))))",
+	NULL
+};
+
+// Sides given to the just_roll benchmarks (both standard and not).
+static const int roll_sides[] = { 4, 6, 8, 10, 12, 20, 100, 7, 30 };
+#define ROLL_REPETITIONS 1000
+
+static const double slot_values[] = { 3 };
+
+static double min_ns = 100e6;
+static bool first_result = true;
+
+
+/* -- Allocation counting -- */
+
+// The library is given a counting allocator (see die_allocator).
+static size_t allocation_count = 0;
+
+void* counting_malloc(size_t size, void *context)
+{
+	(void) context;
+	allocation_count++;
+	return malloc(size);
+}
+
+void* counting_realloc(void *ptr, size_t size, void *context)
+{
+	(void) context;
+	allocation_count++;
+	return realloc(ptr, size);
+}
+
+void counting_free(void *ptr, void *context)
+{
+	(void) context;
+	free(ptr);
+}
+
+static const struct die_allocator counting_allocator = {
+	.malloc = counting_malloc,
+	.realloc = counting_realloc,
+	.free = counting_free,
+	.context = NULL
+};
+
+#define GET_ALLOCATIONS() ((long) allocation_count)
+
+
+/* -- Timing -- */
+
+static double now_ns()
+{
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+void* bench_malloc(size_t size)
+{
+	void *ret;
+
+	if(!(ret = malloc(size))) {
+		fputs("Memory allocation failed, dying...\n", stderr);
+		exit(1);
+	}
+	return ret;
+}
+
+struct Operation* bench_exp_to_op(char *dice_exp)
+{
+	struct Operation *operation;
+	struct Dierror *errors;
+
+	if(!(operation = exp_to_op(dice_exp, &errors))) {
+		fprintf(stderr, "Failed to parse \"%s\", dying...\n", dice_exp);
+		exit(1);
+	}
+
+	return operation;
+}
+
+void print_result(char *name, char *dice_exp, size_t iterations, double ns, long allocations)
+{
+	const double ns_per_op = ns / iterations;
+
+	printf("%s\n\t\t{\"name\": \"%s\", \"expression\": \"%s\", \"iterations\": %zu, "
+			"\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f, \"allocs_per_op\": %.2f}",
+			first_result ? "" : ",",
+			name, dice_exp, iterations,
+			ns_per_op, 1e9 / ns_per_op, (double) allocations / iterations);
+	first_result = false;
+}
+
+/* Run the benchmark with doubling iterations until body takes min_ns, then print it.
+ * setup and teardown are run before and after each body, and are not measured.
+ * All three may use `iterations`. */
+#define RUN_BENCH(name, dice_exp, setup, body, teardown) do {			\
+	size_t iterations;							\
+	double start, ns;							\
+	long start_allocations, allocations;					\
+										\
+	for(iterations = 1;; iterations *= 2) {					\
+		setup								\
+		start_allocations = GET_ALLOCATIONS();				\
+		start = now_ns();						\
+		body								\
+		ns = now_ns() - start;						\
+		allocations = GET_ALLOCATIONS() - start_allocations;		\
+		teardown							\
+		if(ns >= min_ns)						\
+			break;							\
+	}									\
+	print_result((name), (dice_exp), iterations, ns, allocations);		\
+} while(0)
+
+
+/* -- Benchmarks -- */
+
+void bench_expression(char *dice_exp)
+{
+	struct Operation *operation;
+	struct Operation **operations;
+	char *calc_string;
+	double *results;
+	size_t *offsets;
+	volatile double sink;
+	volatile size_t size_sink;
+	struct die_token token;
+	void *serialized;
+	struct flat_operation *flat;
+	size_t serialized_size;
+	double *batch_results;
+	struct die_histogram histogram;
+	struct die_stats_acc acc;
+
+	RUN_BENCH("exp_to_op", dice_exp, ,
+		for(size_t i = 0; i < iterations; i++)
+			clear_operation_pointer(bench_exp_to_op(dice_exp));
+	, );
+
+	RUN_BENCH("clear_operation_pointer", dice_exp,
+		operations = bench_malloc(iterations * sizeof(*operations));
+		for(size_t i = 0; i < iterations; i++)
+			operations[i] = bench_exp_to_op(dice_exp);
+	,
+		for(size_t i = 0; i < iterations; i++)
+			clear_operation_pointer(operations[i]);
+	,
+		free(operations);
+	);
+
+	operation = bench_exp_to_op(dice_exp);
+	calc_string = bench_malloc(get_repeat_calc_string_length(operation));
+	results = bench_malloc(operation->repetitions * sizeof(*results));
+	offsets = bench_malloc(operation->repetitions * sizeof(*offsets));
+	serialized_size = op_serialize(operation, NULL, 0);
+	serialized = bench_malloc(serialized_size);
+	op_serialize(operation, serialized, serialized_size);
+
+	RUN_BENCH("op_deserialize", dice_exp, ,
+		for(size_t i = 0; i < iterations; i++)
+			clear_operation_pointer(op_deserialize(serialized, serialized_size, NULL));
+	, );
+
+	RUN_BENCH("get_calc_string_length", dice_exp, ,
+		for(size_t i = 0; i < iterations; i++)
+			size_sink = get_calc_string_length(operation);
+	, );
+
+	if(!(flat = op_to_flat(operation))) {
+		fputs("op_to_flat failed.\n", stderr);
+		exit(1);
+	}
+	RUN_BENCH("flat_operate", dice_exp, ,
+		for(size_t i = 0; i < iterations; i++)
+			sink = flat_operate(flat, slot_values);
+	, );
+
+	RUN_BENCH("operate_batch", dice_exp,
+		batch_results = bench_malloc(iterations * sizeof(*batch_results));
+	,
+		if(operate_batch(operation, batch_results, iterations, slot_values)) {
+			fputs("operate_batch failed.\n", stderr);
+			exit(1);
+		}
+	,
+		free(batch_results);
+	);
+
+	if(operation->integral && get_slot_count(operation) == 0) {
+		RUN_BENCH("operate_histogram", dice_exp,
+			histogram.bin_count = 0;
+		,
+			if(operate_histogram(operation, iterations, &histogram)) {
+				fputs("operate_histogram failed.\n", stderr);
+				exit(1);
+			}
+		,
+			clear_die_histogram(&histogram);
+		);
+	}
+	if(get_slot_count(operation) == 0) {
+		RUN_BENCH("operate_accumulate", dice_exp,
+			die_stats_acc_init(&acc);
+		,
+			if(operate_accumulate(operation, iterations, &acc)) {
+				fputs("operate_accumulate failed.\n", stderr);
+				exit(1);
+			}
+		,
+			clear_die_stats_acc(&acc);
+		);
+	}
+
+	if(get_slot_count(operation) != 0) {
+		RUN_BENCH("operate_bound", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				sink = operate_bound(operation, slot_values, NULL, NO_FLAG);
+		, );
+		RUN_BENCH("operate_bound+calc_string", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				sink = operate_bound(operation, slot_values, calc_string, NO_FLAG);
+		, );
+	} else if(operation->repetitions != 1) {
+		RUN_BENCH("operate_repeat", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				operate_repeat(operation, results, NULL, NULL, NO_FLAG);
+		, );
+		RUN_BENCH("operate_repeat+calc_string", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				operate_repeat(operation, results, calc_string, offsets, NO_FLAG);
+		, );
+	} else {
+		RUN_BENCH("operate", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				sink = operate(operation, NULL, NO_FLAG);
+		, );
+		RUN_BENCH("operate+calc_string", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				sink = operate(operation, calc_string, NO_FLAG);
+		, );
+		RUN_BENCH("operate_token", dice_exp, ,
+			for(size_t i = 0; i < iterations; i++)
+				sink = operate_token(operation, &token);
+		, );
+	}
+
+	(void) sink, (void) size_sink;
+	free(serialized);
+	clear_flat_operation(flat);
+	free(offsets);
+	free(results);
+	free(calc_string);
+	clear_operation_pointer(operation);
+}
+
+void bench_just_roll(int sides)
+{
+	char name[32];
+	struct Die die = { .repetitions = ROLL_REPETITIONS, .sides = sides };
+	volatile int64_t sink;
+
+	snprintf(name, sizeof(name), "just_roll/%dd%d", ROLL_REPETITIONS, sides);
+	RUN_BENCH(name, "", ,
+		for(size_t i = 0; i < iterations; i++)
+			sink = just_roll(die);
+	, );
+	(void) sink;
+}
+
+int main(int argc, char *argv[])
+{
+	if(argc > 1)
+		min_ns = atof(argv[1]) * 1e6;
+
+	srand(time(NULL));
+	die_set_allocator(&counting_allocator);
+
+	printf("{\n\t\"library\": \"libdie\",\n\t\"benchmarks\": [");
+
+	for(char *const *dice_exp = corpus; *dice_exp; dice_exp++)
+		bench_expression(*dice_exp);
+
+	for(size_t i = 0; i < sizeof(roll_sides)/sizeof(*roll_sides); i++)
+		bench_just_roll(roll_sides[i]);
+
+	printf("\n\t]\n}\n");
+	return 0;
+}
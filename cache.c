@@ -0,0 +1,289 @@
+/* Persistent cache of distributions.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Each distribution is a file of its own in the cache directory, named after the hash of its key:
+ * the operation serialized (see op_serialize, which doesn't depend on how it was parsed or where it
+ * is in memory) without its header, since the distribution doesn't depend on the repetitions, the
+ * values of its placeholders, and the limits.
+ *
+ * A file is a header, the key (so a hash collision is a miss, not a wrong distribution), and the
+ * values, probabilities and cumulative probabilities as arrays of doubles, aligned so the file may be
+ * mapped and used as is.
+ *
+ * Files are written under a temporary name and renamed over the old one, so a reader sees either the
+ * whole old file or the whole new one, and mappings of the old one stay valid. They're created with
+ * open (not mkstemp, which makes them private), so their mode is up to the umask like other files. */
+
+#include "libdie.h"
+#include "alloc.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC "LDDC"
+#define CACHE_FILE_SUFFIX ".ldd"
+#define BYTE_ORDER_MARK 0x01020304	// (The doubles are in the byte order of the writer).
+// Key bytes are padded to a multiple of ARRAY_ALIGNMENT, so the arrays after them are aligned.
+#define ARRAY_ALIGNMENT 8
+// Temporary files are named after the file, the process and a counter (see store_cached_distribution).
+#define TEMP_SUFFIX_FORMAT ".%ld.%u.tmp"
+#define TEMP_SUFFIX_SIZE (sizeof(".-9223372036854775808.4294967295.tmp"))
+#define TEMP_ATTEMPTS 100	// Names tried before giving up (they're taken by files left by a crash).
+
+static atomic_uint temp_counter;
+
+struct cache_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t key_size;
+	uint64_t length;
+	double rebinned;
+	double pruned;
+};
+
+// The key of a distribution, and the file it's cached in.
+struct cache_key {
+	unsigned char *bytes;
+	size_t size;
+	char *path;
+};
+
+size_t get_cache_file_size(size_t key_size, uint64_t length);
+uint64_t hash_bytes(const unsigned char *bytes, size_t size);
+bool make_cache_key(struct cache_key *key, const char *dir, const struct Operation *operation,
+		const double *slot_values, const struct die_dist_limits *limits);
+void clear_cache_key(struct cache_key *key);
+bool load_cached_distribution(const struct cache_key *key, struct die_distribution *dist);
+bool store_cached_distribution(const struct cache_key *key, const struct die_distribution *dist);
+bool write_all(int fd, const void *data, size_t size);
+// Write operation without the header of op_serialize (defined in serialize.c).
+size_t op_serialize_body(const struct Operation *operation, void *buffer, size_t size);
+
+
+/* -- Keys -- */
+
+size_t get_cache_file_size(size_t key_size, uint64_t length)
+{
+	const size_t key_end = sizeof(struct cache_header) + key_size;
+
+	return (key_end + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT + 3 * length * sizeof(double);
+}
+
+// FNV-1a.
+uint64_t hash_bytes(const unsigned char *bytes, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for(size_t i = 0; i < size; i++)
+		hash = (hash ^ bytes[i]) * 0x100000001b3;
+	return hash;
+}
+
+/* Set *key to that of the distribution of operation, cached in dir. Return true on memory failure. */
+bool make_cache_key(struct cache_key *key, const char *dir, const struct Operation *operation,
+		const double *slot_values, const struct die_dist_limits *limits)
+{
+	// (The version of the format of the operation, since it's without the header).
+	const uint16_t format_version = OP_FORMAT_VERSION;
+	const size_t operation_size = op_serialize_body(operation, NULL, 0);
+	const size_t slots_size = get_slot_count(operation) * sizeof(*slot_values);
+	const uint64_t max_support = limits->max_support;
+	size_t path_size;
+	unsigned char *position;
+
+	key->size = sizeof(format_version) + operation_size + slots_size + sizeof(max_support)
+		+ sizeof(limits->min_probability);
+	if(!(key->bytes = die_malloc(key->size)))
+		return true;
+
+	position = key->bytes;
+	memcpy(position, &format_version, sizeof(format_version));
+	position += sizeof(format_version);
+	op_serialize_body(operation, position, operation_size);
+	position += operation_size;
+	if(slots_size > 0)
+		memcpy(position, slot_values, slots_size);
+	position += slots_size;
+	memcpy(position, &max_support, sizeof(max_support));
+	position += sizeof(max_support);
+	memcpy(position, &limits->min_probability, sizeof(limits->min_probability));
+
+	path_size = snprintf(NULL, 0, "%s/%016llx" CACHE_FILE_SUFFIX, dir, 0ULL) + 1;
+	if(!(key->path = die_malloc(path_size))) {
+		die_free(key->bytes);
+		return true;
+	}
+	snprintf(key->path, path_size, "%s/%016llx" CACHE_FILE_SUFFIX, dir,
+			(unsigned long long) hash_bytes(key->bytes, key->size));
+	return false;
+}
+
+void clear_cache_key(struct cache_key *key)
+{
+	die_free(key->bytes);
+	die_free(key->path);
+}
+
+
+/* -- Files -- */
+
+/* Map the file of key into *dist. Return true if it's missing, not valid, or for another key. */
+bool load_cached_distribution(const struct cache_key *key, struct die_distribution *dist)
+{
+	const struct cache_header *header;
+	const unsigned char *mapping;
+	const double *arrays;
+	struct stat file_stat;
+	int fd;
+
+	if((fd = open(key->path, O_RDONLY | O_CLOEXEC)) < 0)
+		return true;
+	if(fstat(fd, &file_stat) != 0 || (size_t) file_stat.st_size < sizeof(*header)) {
+		close(fd);
+		return true;
+	}
+	mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);	// (The mapping stays).
+	if(mapping == MAP_FAILED)
+		return true;
+
+	header = (const struct cache_header*) mapping;
+	if(memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) != 0 || header->version != DIE_CACHE_VERSION
+			|| header->byte_order != BYTE_ORDER_MARK || header->key_size != key->size
+			|| header->length > (uint64_t) file_stat.st_size	// (So the size can't overflow).
+			|| get_cache_file_size(header->key_size, header->length) != (size_t) file_stat.st_size
+			|| memcmp(mapping + sizeof(*header), key->bytes, key->size) != 0) {
+		munmap((void*) mapping, file_stat.st_size);
+		return true;
+	}
+
+	arrays = (const double*) (mapping + file_stat.st_size - 3 * header->length * sizeof(double));
+	*dist = (struct die_distribution) {
+		.length = header->length,
+		.values = (double*) arrays,
+		.probabilities = (double*) arrays + header->length,
+		.cumulative = (double*) arrays + 2 * header->length,
+		.rebinned = header->rebinned,
+		.pruned = header->pruned,
+		.mapping = (void*) mapping,
+		.mapping_size = file_stat.st_size,
+	};
+	return false;
+}
+
+/* Write size bytes of data to fd. Return true on failure. */
+bool write_all(int fd, const void *data, size_t size)
+{
+	const unsigned char *position = data;
+	ssize_t written;
+
+	while(size > 0) {
+		if((written = write(fd, position, size)) < 0)
+			return true;
+		position += written;
+		size -= written;
+	}
+	return false;
+}
+
+/* Write dist to the file of key (atomically replacing it). Return true on failure. */
+bool store_cached_distribution(const struct cache_key *key, const struct die_distribution *dist)
+{
+	const size_t key_end = sizeof(struct cache_header) + key->size;
+	const unsigned char padding[ARRAY_ALIGNMENT] = { 0 };
+	struct cache_header header = {
+		.version = DIE_CACHE_VERSION,
+		.byte_order = BYTE_ORDER_MARK,
+		.key_size = key->size,
+		.length = dist->length,
+		.rebinned = dist->rebinned,
+		.pruned = dist->pruned,
+	};
+	const size_t temp_path_size = strlen(key->path) + TEMP_SUFFIX_SIZE;
+	char *temp_path;
+	bool failed;
+	int fd = -1;
+
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+
+	if(!(temp_path = die_malloc(temp_path_size)))
+		return true;
+	for(unsigned attempt = 0; fd < 0 && attempt < TEMP_ATTEMPTS; attempt++) {
+		snprintf(temp_path, temp_path_size, "%s" TEMP_SUFFIX_FORMAT, key->path, (long) getpid(),
+				atomic_fetch_add(&temp_counter, 1));
+		if((fd = open(temp_path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666)) < 0 && errno != EEXIST)
+			break;
+	}
+	if(fd < 0) {
+		die_free(temp_path);
+		return true;
+	}
+
+	failed = write_all(fd, &header, sizeof(header))
+		|| write_all(fd, key->bytes, key->size)
+		|| write_all(fd, padding, (ARRAY_ALIGNMENT - key_end % ARRAY_ALIGNMENT) % ARRAY_ALIGNMENT)
+		|| write_all(fd, dist->values, dist->length * sizeof(*dist->values))
+		|| write_all(fd, dist->probabilities, dist->length * sizeof(*dist->probabilities))
+		|| write_all(fd, dist->cumulative, dist->length * sizeof(*dist->cumulative))
+		|| fsync(fd) != 0;
+	failed |= close(fd) != 0;
+
+	if(failed || rename(temp_path, key->path) != 0) {
+		unlink(temp_path);
+		failed = true;
+	}
+
+	die_free(temp_path);
+	return failed;
+}
+
+
+/* -- Interface -- */
+
+bool op_distribution_cached(const char *dir, const struct Operation *operation, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist)
+{
+	const struct die_dist_limits default_limits = {
+		.max_support = DIE_DIST_MAX_SUPPORT,
+		.min_probability = 0,
+	};
+	struct cache_key key;
+
+	if(!limits)
+		limits = &default_limits;
+	if(make_cache_key(&key, dir, operation, slot_values, limits))
+		return op_distribution(operation, slot_values, limits, dist);
+
+	if(load_cached_distribution(&key, dist)) {
+		if(op_distribution(operation, slot_values, limits, dist)) {
+			clear_cache_key(&key);
+			return true;
+		}
+		store_cached_distribution(&key, dist);	// (It's still calculated if it can't be stored).
+	}
+
+	clear_cache_key(&key);
+	return false;
+}
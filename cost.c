@@ -0,0 +1,123 @@
+/* Estimating the cost of operations, and limiting it.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The cost is a walk over the tree (without rolling anything), so it's linear in the length of the
+ * expression no matter how many dice it has. The counts saturate at UINT64_MAX instead of wrapping,
+ * so an expression can't overflow its way under a limit. */
+
+#include "libdie.h"
+
+// Rough times of operate (see op_cost_estimate), on the order of the ones measured for rolling a die
+// and for calculating a section (number, die or operation) other than its dice.
+#define NS_PER_DIE 10
+#define NS_PER_SECTION 20
+
+// Overrides global_limits in the thread if thread_limits_set.
+static struct die_op_limits global_limits = { 0 };
+static _Thread_local struct die_op_limits thread_limits;
+static _Thread_local bool thread_limits_set = false;
+
+#define CURRENT_LIMITS() (thread_limits_set ? &thread_limits : &global_limits)
+
+uint64_t saturating_add(uint64_t a, uint64_t b);
+uint64_t saturating_mul(uint64_t a, uint64_t b);
+void count_operation_cost(const struct Operation *operation, uint64_t *dice, uint64_t *sections);
+// Return true if value is over limit (0 being no limit).
+bool is_over_limit(uint64_t value, uint64_t limit);
+// Return true if operation exceeds the limits set (defined here for exp_to_op, see parse_exp.c).
+bool exceeds_op_limits(const struct Operation *operation);
+
+
+uint64_t saturating_add(uint64_t a, uint64_t b)
+{
+	return (a > UINT64_MAX - b) ? UINT64_MAX : a + b;
+}
+
+uint64_t saturating_mul(uint64_t a, uint64_t b)
+{
+	return (b != 0 && a > UINT64_MAX / b) ? UINT64_MAX : a * b;
+}
+
+/* Add the dice and sections of operation (once, ignoring its repetitions) to *dice and *sections. */
+void count_operation_cost(const struct Operation *operation, uint64_t *dice, uint64_t *sections)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	struct NumSection section;
+
+	*sections = saturating_add(*sections, 1);	// (The operation itself).
+
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section)) {
+		if(section.type == type_op) {
+			count_operation_cost(section.data.operation, dice, sections);
+			continue;
+		}
+
+		*sections = saturating_add(*sections, 1);
+		if(section.type == type_die)
+			*dice = saturating_add(*dice, section.data.die.repetitions);
+	}
+}
+
+void op_cost_estimate(const struct Operation *operation, struct die_op_cost *cost)
+{
+	uint64_t dice = 0;
+	uint64_t sections = 0;
+
+	count_operation_cost(operation, &dice, &sections);
+
+	*cost = (struct die_op_cost) {
+		.dice = saturating_mul(dice, operation->repetitions),
+		.calc_string_bytes = saturating_mul(get_calc_string_length(operation), operation->repetitions),
+		.sections = sections,
+		.estimated_ns = saturating_mul(saturating_add(saturating_mul(dice, NS_PER_DIE),
+					saturating_mul(sections, NS_PER_SECTION)), operation->repetitions),
+	};
+}
+
+
+/* -- Limits -- */
+
+void die_set_op_limits(const struct die_op_limits *limits)
+{
+	global_limits = (limits) ? *limits : (struct die_op_limits) { 0 };
+}
+
+void die_set_thread_op_limits(const struct die_op_limits *limits)
+{
+	if((thread_limits_set = (limits != NULL)))
+		thread_limits = *limits;
+}
+
+bool is_over_limit(uint64_t value, uint64_t limit)
+{
+	return limit != 0 && value > limit;
+}
+
+bool exceeds_op_limits(const struct Operation *operation)
+{
+	const struct die_op_limits *const limits = CURRENT_LIMITS();
+	struct die_op_cost cost;
+
+	if(!limits->max_dice && !limits->max_calc_string_bytes && !limits->max_sections && !limits->max_estimated_ns)
+		return false;	// (Don't walk the tree for nothing).
+
+	op_cost_estimate(operation, &cost);
+	return is_over_limit(cost.dice, limits->max_dice)
+		|| is_over_limit(cost.calc_string_bytes, limits->max_calc_string_bytes)
+		|| is_over_limit(cost.sections, limits->max_sections)
+		|| is_over_limit(cost.estimated_ns, limits->max_estimated_ns);
+}
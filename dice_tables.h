@@ -0,0 +1,34 @@
+/* libdie - probability tables of standard dice.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The tables are generated at build time by tools/gen_dice_tables.c (into dice_tables.c in the build
+ * directory), which includes this header for the dice to generate. */
+
+#pragma once
+
+// Sides common enough to get their own rolling functions (eg. just_roll_d20, see parse_operation.c)
+// and probability tables.
+#define STANDARD_SIDES(X) X(4) X(6) X(8) X(10) X(12) X(20) X(100)
+
+// Most dice of each of STANDARD_SIDES with a table.
+#define DICE_TABLE_MAX_DICE 10
+
+const double* get_dice_table(unsigned dice, int sides);
+/* Return the probabilities of the sums of dice dice of sides sides (from dice to dice * sides), or NULL
+ * if there's no table for them.
+ *
+ * They're calculated like get_die_distribution does (see distribution.c), so they're the same. */
@@ -0,0 +1,694 @@
+/* Exact distributions of results.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* A distribution is a sorted array of the values a result may have, with an array of their
+ * probabilities. Each section is rolled independently, so the distribution of a node is that of its
+ * sections combined pairwise, left to right like operate_rec.
+ *
+ * NdS is N convolutions with the uniform distribution of a die, each a sliding window sum (the
+ * probability of k is the sum of the previous probabilities of k-S to k-1, over S), starting from the
+ * generated table of the most dice there is one for (see dice_tables.h). Comparisons
+ * only need the cumulative probabilities of the right side, so they're linear too.
+ *
+ * The other operators go over every pair of values: when both sides are integers (and the range of the
+ * result isn't much bigger than the number of pairs) the results are counted into a dense array
+ * indexed by value, otherwise the pairs are sorted and equal values merged.
+ *
+ * NaN results (like 0/0) sort last, as a single value.
+ *
+ * The cumulative probabilities are only summed for the result (see op_distribution), so queries on it
+ * are binary searches. */
+
+#include "libdie.h"
+#include "alloc.h"
+#include "dice_tables.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+// Values in [-EXACT_LIMIT, EXACT_LIMIT] are exactly representable as double.
+#define EXACT_LIMIT 0x1p53
+// Dense results may range over up to DENSE_FACTOR times the number of pairs (and MAX_DENSE_RANGE values).
+#define DENSE_FACTOR 4
+#define MAX_DENSE_RANGE (1 << 23)
+// Most pairs the sparse combination holds at once (16 bytes each), DIE_DIST_MAX_WORK would be gigabytes.
+#define MAX_SPARSE_PAIRS (1 << 22)
+
+struct value_probability {
+	double value;
+	double probability;
+};
+
+double binary_calc(double val1, char operand, double val2);
+bool combine_integer_ranges(double *min, double *max, char operator, double sec_min, double sec_max);
+
+bool alloc_distribution(struct die_distribution *dist, size_t length);
+bool make_point_distribution(struct die_distribution *dist, double value);
+bool get_die_distribution(struct Die die, struct die_distribution *dist, size_t max_support);
+bool get_section_distribution(struct NumSection section, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist);
+bool get_operation_distribution(const struct Operation *operation, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist);
+bool combine_distributions(struct die_distribution *dist, char operator, struct die_distribution *other,
+		const struct die_dist_limits *limits);
+bool compare_distributions(struct die_distribution *dist, char operator, const struct die_distribution *other);
+bool combine_dense(struct die_distribution *dist, char operator, const struct die_distribution *other,
+		double min, double max);
+bool combine_sparse(struct die_distribution *dist, char operator, const struct die_distribution *other);
+bool is_integer_distribution(const struct die_distribution *dist);
+void rebin_pairs(struct die_distribution *dist, struct die_distribution *other, size_t max_pairs);
+bool is_dense_combination(const struct die_distribution *dist, char operator,
+		const struct die_distribution *other, double *min, double *max);
+void negate_distribution(struct die_distribution *dist);
+size_t get_nan_index(const struct die_distribution *dist);
+void rebin_distribution(struct die_distribution *dist, size_t max_length);
+void prune_distribution(struct die_distribution *dist, double min_probability);
+// Prune and rebin dist as limits says.
+void limit_distribution(struct die_distribution *dist, const struct die_dist_limits *limits);
+int comp_value_probabilities(const void *v1, const void *v2);
+size_t find_last_at_most(const struct die_distribution *dist, double x);
+size_t find_first_cumulative(const struct die_distribution *dist, size_t length, double probability);
+double uniform_01();
+
+
+/* -- Building distributions -- */
+
+/* Set dist to an exact distribution of length (uninitialized) values.
+ * Return true on memory failure (dist is then cleared). */
+bool alloc_distribution(struct die_distribution *dist, size_t length)
+{
+	dist->length = length;
+	dist->cumulative = NULL;
+	dist->mapping = NULL;
+	dist->rebinned = 0;
+	dist->pruned = 0;
+
+	// (At least one element, so NULL is only returned on failure).
+	dist->values = die_malloc((length ? length : 1) * sizeof(*dist->values));
+	dist->probabilities = die_malloc((length ? length : 1) * sizeof(*dist->probabilities));
+	if(!dist->values || !dist->probabilities) {
+		clear_die_distribution(dist);
+		return true;
+	}
+	return false;
+}
+
+bool make_point_distribution(struct die_distribution *dist, double value)
+{
+	if(alloc_distribution(dist, 1))
+		return true;
+	dist->values[0] = value;
+	dist->probabilities[0] = 1;
+	return false;
+}
+
+/* Return true if the support of the die is bigger than max_support, its convolutions would take over
+ * DIE_DIST_MAX_WORK steps, or on memory failure. */
+bool get_die_distribution(struct Die die, struct die_distribution *dist, size_t max_support)
+{
+	const double support = (double) die.repetitions * (die.sides - 1) + 1;
+	const unsigned table_dice = (die.repetitions < DICE_TABLE_MAX_DICE) ? die.repetitions : DICE_TABLE_MAX_DICE;
+	const double *const table = get_dice_table(table_dice, die.sides);
+	double *previous;
+	double window;
+	size_t length = 1;
+	unsigned rolled = 0;
+
+	if(support > max_support || support * (die.repetitions - ((table) ? table_dice : 0)) > DIE_DIST_MAX_WORK)
+		return true;
+	if(alloc_distribution(dist, support))
+		return true;
+	if(!(previous = die_malloc(dist->length * sizeof(*previous)))) {
+		clear_die_distribution(dist);
+		return true;
+	}
+
+	// (Indexed from the sum of the dice rolled so far; starting at 0 with none rolled).
+	dist->probabilities[0] = 1;
+	if(table) {
+		rolled = table_dice;
+		length = (size_t) rolled * (die.sides - 1) + 1;
+		for(size_t i = 0; i < length; i++)
+			dist->probabilities[i] = table[i];
+	}
+	for(; rolled < die.repetitions; rolled++) {
+		for(size_t i = 0; i < length; i++)
+			previous[i] = dist->probabilities[i];
+
+		// Each sum moves up by 0 to sides - 1 (by 1 to sides, less the one first moved up by).
+		window = 0;
+		for(size_t i = 0; i < length + die.sides - 1; i++) {
+			if(i < length)
+				window += previous[i];
+			if(i >= (size_t) die.sides)
+				window -= previous[i - die.sides];
+			dist->probabilities[i] = window / die.sides;
+		}
+		length += die.sides - 1;
+	}
+
+	for(size_t i = 0; i < dist->length; i++)
+		dist->values[i] = (double) die.repetitions + i;
+
+	die_free(previous);
+	return false;
+}
+
+bool get_section_distribution(struct NumSection section, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist)
+{
+	switch (section.type) {
+	case(type_num):
+		return make_point_distribution(dist, section.data.num);
+	case(type_die):
+		return get_die_distribution(section.data.die, dist, limits->max_support);
+	case(type_op):
+		return get_operation_distribution(section.data.operation, slot_values, limits, dist);
+	case(type_slot):
+		return make_point_distribution(dist, slot_values[section.data.slot]);
+
+	default:
+		exit(1);	// Should never happen.
+	}
+}
+
+/* Return the index of the NaN value of dist (the last), or its length if it has none. */
+size_t get_nan_index(const struct die_distribution *dist)
+{
+	return (dist->length > 0 && isnan(dist->values[dist->length - 1])) ? dist->length - 1 : dist->length;
+}
+
+void negate_distribution(struct die_distribution *dist)
+{
+	const size_t length = get_nan_index(dist);	// (NaN stays last).
+	double swap;
+
+	for(size_t i = 0; i < length / 2; i++) {
+		swap = dist->values[i];
+		dist->values[i] = dist->values[length - 1 - i];
+		dist->values[length - 1 - i] = swap;
+
+		swap = dist->probabilities[i];
+		dist->probabilities[i] = dist->probabilities[length - 1 - i];
+		dist->probabilities[length - 1 - i] = swap;
+	}
+	for(size_t i = 0; i < length; i++)
+		dist->values[i] = -dist->values[i];
+}
+
+
+/* -- Limits -- */
+
+/* Drop the values of dist with a probability below min_probability (adding it to dist->pruned),
+ * and those with a probability of 0. */
+void prune_distribution(struct die_distribution *dist, double min_probability)
+{
+	size_t length = 0;
+
+	for(size_t i = 0; i < dist->length; i++) {
+		if(dist->probabilities[i] > 0 && dist->probabilities[i] >= min_probability) {
+			dist->values[length] = dist->values[i];
+			dist->probabilities[length++] = dist->probabilities[i];
+		} else {
+			dist->pruned += dist->probabilities[i];
+		}
+	}
+	dist->length = length;
+}
+
+/* Merge consecutive values of dist into bins (at their mean, weighted by probability) so it has at most
+ * max_length (>= 2) values, adding the probability of bins of more than one value to dist->rebinned. */
+void rebin_distribution(struct die_distribution *dist, size_t max_length)
+{
+	const size_t length = get_nan_index(dist);
+	const size_t bin_count = max_length - (length < dist->length);
+	size_t bin_length;
+	size_t bins = 0;
+	size_t end;
+	double probability, weighted_sum, mean;
+
+	if(dist->length <= max_length)
+		return;
+	bin_length = (length + bin_count - 1) / bin_count;
+
+	for(size_t start = 0; start < length; start = end) {
+		end = (start + bin_length < length) ? start + bin_length : length;
+
+		probability = 0;
+		weighted_sum = 0;
+		for(size_t i = start; i < end; i++) {
+			probability += dist->probabilities[i];
+			weighted_sum += dist->values[i] * dist->probabilities[i];
+		}
+		// (The mean is between the first and last values, so the bins stay sorted).
+		mean = weighted_sum / probability;
+		if(isnan(mean))		// (No probability, or infinities of both signs).
+			mean = dist->values[start];
+		if(end - start > 1)
+			dist->rebinned += probability;
+
+		dist->values[bins] = mean;
+		dist->probabilities[bins++] = probability;
+	}
+	if(length < dist->length) {
+		dist->values[bins] = NAN;
+		dist->probabilities[bins++] = dist->probabilities[length];
+	}
+	// (Bins may hold probability that was already rebinned, which would be counted twice).
+	if(dist->rebinned > 1)
+		dist->rebinned = 1;
+
+	dist->length = bins;
+}
+
+void limit_distribution(struct die_distribution *dist, const struct die_dist_limits *limits)
+{
+	prune_distribution(dist, limits->min_probability);
+	rebin_distribution(dist, (limits->max_support > 2) ? limits->max_support : 2);
+}
+
+
+/* -- Combining distributions -- */
+
+/* Set dist to that of `dist operator other` for a comparison operator (see combine_distributions). */
+bool compare_distributions(struct die_distribution *dist, char operator, const struct die_distribution *other)
+{
+	const size_t other_length = get_nan_index(other);
+	const double other_nan = (other_length < other->length) ? other->probabilities[other_length] : 0;
+	double other_total = 0;
+	double below = 0;	// The probability other is below the value (so far).
+	double equal, above;
+	double hit;		// The probability the comparison is true for the value.
+	double p_true = 0;
+	double p_false = 0;
+	double value;
+	size_t j = 0;
+
+	for(size_t i = 0; i < other->length; i++)
+		other_total += other->probabilities[i];
+
+	for(size_t i = 0; i < dist->length; i++) {
+		value = dist->values[i];
+
+		if(isnan(value)) {	// (Comparisons with NaN are false).
+			p_false += dist->probabilities[i] * other_total;
+			continue;
+		}
+
+		// (The values are sorted, so j only moves forward).
+		for(; j < other_length && other->values[j] < value; j++)
+			below += other->probabilities[j];
+		equal = (j < other_length && other->values[j] == value) ? other->probabilities[j] : 0;
+		above = other_total - other_nan - below - equal;
+
+		switch (operator) {
+		case('<'):
+			hit = above;
+			break;
+		case('>'):
+			hit = below;
+			break;
+		case(OPERATOR_LESS_EQUAL):
+			hit = above + equal;
+			break;
+		case(OPERATOR_GREATER_EQUAL):
+			hit = below + equal;
+			break;
+		default:	// (OPERATOR_EQUAL).
+			hit = equal;
+			break;
+		}
+		p_true += dist->probabilities[i] * hit;
+		p_false += dist->probabilities[i] * (other_total - hit);
+	}
+
+	clear_die_distribution(dist);
+	if(alloc_distribution(dist, 2))
+		return true;
+	dist->values[0] = 0;
+	dist->probabilities[0] = p_false;
+	dist->values[1] = 1;
+	dist->probabilities[1] = p_true;
+	return false;
+}
+
+/* Return true if all values of dist are integers in [-EXACT_LIMIT, EXACT_LIMIT]. */
+bool is_integer_distribution(const struct die_distribution *dist)
+{
+	for(size_t i = 0; i < dist->length; i++)
+		if(!(fabs(dist->values[i]) <= EXACT_LIMIT) || dist->values[i] != floor(dist->values[i]))
+			return false;
+	return true;
+}
+
+/* Set dist to that of `dist operator other`, where all results are integers in [min, max], by
+ * counting them into an array indexed by value. Return true on memory failure. */
+bool combine_dense(struct die_distribution *dist, char operator, const struct die_distribution *other,
+		double min, double max)
+{
+	const size_t range = max - min + 1;
+	struct die_distribution result;
+	double *counts;
+	size_t length = 0;
+
+	if(!(counts = die_calloc(range, sizeof(*counts))))
+		return true;
+	for(size_t i = 0; i < dist->length; i++)
+		for(size_t j = 0; j < other->length; j++)
+			counts[(size_t) (binary_calc(dist->values[i], operator, other->values[j]) - min)]
+				+= dist->probabilities[i] * other->probabilities[j];
+
+	for(size_t i = 0; i < range; i++)
+		length += (counts[i] != 0);
+	if(alloc_distribution(&result, length)) {
+		die_free(counts);
+		return true;
+	}
+	length = 0;
+	for(size_t i = 0; i < range; i++) {
+		if(counts[i] != 0) {
+			result.values[length] = min + i;
+			result.probabilities[length++] = counts[i];
+		}
+	}
+	die_free(counts);
+
+	clear_die_distribution(dist);
+	*dist = result;
+	return false;
+}
+
+// Sort by value, NaN last.
+int comp_value_probabilities(const void *v1, const void *v2)
+{
+	const double val1 = ((const struct value_probability*) v1)->value;
+	const double val2 = ((const struct value_probability*) v2)->value;
+
+	if(isnan(val1) || isnan(val2))
+		return isnan(val1) - isnan(val2);
+	return (val1 > val2) - (val1 < val2);
+}
+
+/* Set dist to that of `dist operator other` by sorting the results of every pair of values, and
+ * merging equal ones. Return true on memory failure. */
+bool combine_sparse(struct die_distribution *dist, char operator, const struct die_distribution *other)
+{
+	const size_t pair_count = dist->length * other->length;
+	struct die_distribution result;
+	struct value_probability *pairs;
+	size_t length = 0;
+
+	if(!(pairs = die_malloc((pair_count ? pair_count : 1) * sizeof(*pairs))))
+		return true;
+	for(size_t i = 0; i < dist->length; i++)
+		for(size_t j = 0; j < other->length; j++)
+			pairs[i * other->length + j] = (struct value_probability) {
+				.value = binary_calc(dist->values[i], operator, other->values[j]),
+				.probability = dist->probabilities[i] * other->probabilities[j],
+			};
+	qsort(pairs, pair_count, sizeof(*pairs), comp_value_probabilities);
+
+	// Merge equal values (NaN with NaN too).
+	for(size_t i = 0; i < pair_count; i++) {
+		if(length > 0 && comp_value_probabilities(&pairs[length - 1], &pairs[i]) == 0)
+			pairs[length - 1].probability += pairs[i].probability;
+		else
+			pairs[length++] = pairs[i];
+	}
+
+	if(alloc_distribution(&result, length)) {
+		die_free(pairs);
+		return true;
+	}
+	for(size_t i = 0; i < length; i++) {
+		result.values[i] = pairs[i].value;
+		result.probabilities[i] = pairs[i].probability;
+	}
+	die_free(pairs);
+
+	clear_die_distribution(dist);
+	*dist = result;
+	return false;
+}
+
+/* Rebin the bigger of dist and other so there are at most max_pairs pairs of their values. */
+void rebin_pairs(struct die_distribution *dist, struct die_distribution *other, size_t max_pairs)
+{
+	const double side = floor(sqrt(max_pairs));
+
+	if((double) dist->length * other->length <= max_pairs)
+		return;
+
+	if(dist->length <= side) {
+		rebin_distribution(other, max_pairs / dist->length);
+	} else if(other->length <= side) {
+		rebin_distribution(dist, max_pairs / other->length);
+	} else {
+		rebin_distribution(dist, side);
+		rebin_distribution(other, side);
+	}
+}
+
+/* Return true if `dist operator other` should be counted by combine_dense, setting *min and *max to the
+ * range of the result: both are integer distributions, there are at most DIE_DIST_MAX_WORK pairs, and
+ * the range isn't much bigger than that. */
+bool is_dense_combination(const struct die_distribution *dist, char operator,
+		const struct die_distribution *other, double *min, double *max)
+{
+	const double pair_count = (double) dist->length * other->length;
+
+	if(dist->length == 0 || other->length == 0 || pair_count > DIE_DIST_MAX_WORK
+			|| !is_integer_distribution(dist) || !is_integer_distribution(other))
+		return false;
+
+	*min = dist->values[0];
+	*max = dist->values[dist->length - 1];
+	return combine_integer_ranges(min, max, operator, other->values[0], other->values[other->length - 1])
+		&& *min >= -EXACT_LIMIT && *max <= EXACT_LIMIT
+		&& *max - *min < DENSE_FACTOR * pair_count && *max - *min < MAX_DENSE_RANGE;
+}
+
+/* Set dist to that of `dist operator other`, and apply limits to it.
+ * Comparisons are linear, and integers are counted over up to DIE_DIST_MAX_WORK pairs of values.
+ * Otherwise, if there are more than MAX_SPARSE_PAIRS pairs, the bigger of dist and other are rebinned
+ * first (other may be modified).
+ * Return true on memory failure (dist is then cleared). */
+bool combine_distributions(struct die_distribution *dist, char operator, struct die_distribution *other,
+		const struct die_dist_limits *limits)
+{
+	const bool comparison = operator == '<' || operator == '>' || operator == OPERATOR_LESS_EQUAL
+		|| operator == OPERATOR_GREATER_EQUAL || operator == OPERATOR_EQUAL;
+	bool dense = false;
+	double min, max;
+	double rebinned, pruned;
+	bool failed;
+
+	if(!comparison && !(dense = is_dense_combination(dist, operator, other, &min, &max)))
+		rebin_pairs(dist, other, MAX_SPARSE_PAIRS);
+
+	// The result has the errors of both: the probability of a pair with a value moved from either side.
+	// (Exact for pruning, where the rest sums to (1 - pruned) * (1 - other pruned), and at most 1).
+	rebinned = 1 - (1 - dist->rebinned) * (1 - other->rebinned);
+	pruned = 1 - (1 - dist->pruned) * (1 - other->pruned);
+
+	if(comparison)
+		failed = compare_distributions(dist, operator, other);
+	else if(dense)
+		failed = combine_dense(dist, operator, other, min, max);
+	else
+		failed = combine_sparse(dist, operator, other);
+	if(failed)
+		goto fail;
+
+	dist->rebinned = rebinned;
+	dist->pruned = pruned;
+	limit_distribution(dist, limits);
+	return false;
+
+fail:
+	clear_die_distribution(dist);
+	return true;
+}
+
+/* Set dist to the distribution of operation, with limits applied to each part.
+ * Return true on failure (see op_distribution), with dist cleared. */
+bool get_operation_distribution(const struct Operation *operation, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	char_iterator operator_ite = get_char_list_iterator(&operation->operators);
+	struct die_distribution other;
+	struct NumSection section;
+	char operator;
+	bool failed;
+
+	NumSection_list_get(&section_ite, &operation->numbers, &section);
+	if(get_section_distribution(section, slot_values, limits, dist))
+		return true;
+	if(operation->prefix == '-')
+		negate_distribution(dist);
+	limit_distribution(dist, limits);
+
+	while(!char_list_get(&operator_ite, &operation->operators, &operator)) {
+		NumSection_list_get(&section_ite, &operation->numbers, &section);
+		if(get_section_distribution(section, slot_values, limits, &other)) {
+			clear_die_distribution(dist);
+			return true;
+		}
+		limit_distribution(&other, limits);
+
+		failed = combine_distributions(dist, operator, &other, limits);
+		clear_die_distribution(&other);
+		if(failed)
+			return true;
+	}
+
+	return false;
+}
+
+
+/* -- Interface -- */
+
+bool op_distribution(const struct Operation *operation, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist)
+{
+	const struct die_dist_limits default_limits = {
+		.max_support = DIE_DIST_MAX_SUPPORT,
+		.min_probability = 0,
+	};
+
+	if(get_operation_distribution(operation, slot_values, (limits) ? limits : &default_limits, dist)) {
+		*dist = (struct die_distribution) { .length = 0, .values = NULL, .probabilities = NULL,
+			.cumulative = NULL, .mapping = NULL };
+		return true;
+	}
+
+	if(!(dist->cumulative = die_malloc((dist->length ? dist->length : 1) * sizeof(*dist->cumulative)))) {
+		clear_die_distribution(dist);
+		return true;
+	}
+	for(size_t i = 0; i < dist->length; i++)
+		dist->cumulative[i] = ((i > 0) ? dist->cumulative[i - 1] : 0) + dist->probabilities[i];
+	return false;
+}
+
+void clear_die_distribution(struct die_distribution *dist)
+{
+	if(dist->mapping) {	// (Loaded by op_distribution_cached).
+		munmap(dist->mapping, dist->mapping_size);
+		dist->mapping = NULL;
+	} else {
+		die_free(dist->values);
+		die_free(dist->probabilities);
+		die_free(dist->cumulative);
+	}
+	dist->values = NULL;
+	dist->probabilities = NULL;
+	dist->cumulative = NULL;
+	dist->length = 0;
+}
+
+double op_probability_true(const struct Operation *operation)
+{
+	struct die_distribution dist;
+	double ret = 0;
+
+	if(get_slot_count(operation) != 0 || op_distribution(operation, NULL, NULL, &dist))
+		return NAN;
+
+	if(dist.rebinned > 0 || dist.pruned > 0) {
+		ret = NAN;
+	} else {
+		for(size_t i = 0; i < dist.length; i++)
+			if(dist.values[i] != 0)		// (Including NaN).
+				ret += dist.probabilities[i];
+	}
+
+	clear_die_distribution(&dist);
+	return ret;
+}
+
+
+/* -- Queries -- */
+
+/* Return the index of the last value of dist at most x, or dist->length if there's none. */
+size_t find_last_at_most(const struct die_distribution *dist, double x)
+{
+	size_t start = 0;
+	size_t end = get_nan_index(dist);
+	size_t middle;
+
+	// (The first value above x is in [start, end]).
+	while(start < end) {
+		middle = start + (end - start) / 2;
+		if(dist->values[middle] <= x)
+			start = middle + 1;
+		else
+			end = middle;
+	}
+	return (start > 0) ? start - 1 : dist->length;
+}
+
+/* Return the index of the first of the length first values of dist whose cumulative probability is at
+ * least probability, or length if there's none. */
+size_t find_first_cumulative(const struct die_distribution *dist, size_t length, double probability)
+{
+	size_t start = 0;
+	size_t end = length;
+	size_t middle;
+
+	while(start < end) {
+		middle = start + (end - start) / 2;
+		if(dist->cumulative[middle] < probability)
+			start = middle + 1;
+		else
+			end = middle;
+	}
+	return start;
+}
+
+double die_dist_cdf(const struct die_distribution *dist, double x)
+{
+	const size_t index = find_last_at_most(dist, x);
+
+	return (index < dist->length) ? dist->cumulative[index] : 0;
+}
+
+double die_dist_quantile(const struct die_distribution *dist, double q)
+{
+	const size_t length = get_nan_index(dist);
+	size_t index;
+
+	if(length == 0 || !(q >= 0 && q <= 1))
+		return NAN;
+
+	index = find_first_cumulative(dist, length, q);
+	return dist->values[(index < length) ? index : length - 1];
+}
+
+double die_dist_sample(const struct die_distribution *dist)
+{
+	size_t index;
+
+	if(dist->length == 0)
+		return NAN;
+
+	// (Out of the total probability, so dropped values don't count).
+	index = find_first_cumulative(dist, dist->length, uniform_01() * dist->cumulative[dist->length - 1]);
+	return dist->values[(index < dist->length) ? index : dist->length - 1];
+}
@@ -24,7 +24,7 @@ int main()
 		// Invalid expression...
 		// We're not gonna print it here.
 		fprintf(stderr, "Invalid expression...\n");
-		free(dierrors);	// Technically not neccessary since we're exiting now...
+		die_free(dierrors);	// Technically not neccessary since we're exiting now...
 		exit(2);
 	}
 
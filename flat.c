@@ -0,0 +1,416 @@
+/* Flat (structure of arrays) form of operations.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* All the arrays of a flat operation are in one allocation, right after the struct, ordered by
+ * alignment (doubles, then 32-bit arrays, then bytes). Serialized, the arrays are the same, after a
+ * header instead of the struct, so loading only checks them and points a struct to them (in the data).
+ *
+ * The sections are in the order operate calculates them: those of a parenthesis come right before the
+ * type_op section standing for it. So calculating is a single pass over the sections, with a stack of
+ * values: the first section of each operation pushes its value, the others are combined with the top
+ * one, and type_op sections pop the result of their parenthesis. */
+
+#include "libdie.h"
+#include "alloc.h"
+#include "lassert.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FLAT_NEGATIVE 1		// (section_flags) The first section of an operation with a '-' prefix.
+#define FLAT_PARENTHESIS 2	// (section_flags) A type_op section of an operation in parenthesis.
+
+// Values flat_operate keeps on the stack (deeper operations allocate theirs).
+#define FLAT_STACK_SIZE 32
+
+#define FLAT_MAGIC "LDFL"
+#define BYTE_ORDER_MARK 0x01020304	// (The arrays are in the byte order of the writer).
+#define FLAT_ALIGNMENT 8		// Of the doubles (and so of the arrays, and of serialized flat operations).
+// Bytes of a section in the arrays (a double, two 32-bit members and three bytes).
+#define FLAT_SECTION_SIZE (sizeof(double) + sizeof(uint32_t) + sizeof(int32_t) + 3)
+#define FLAT_OPERATORS "+-*/%^<>LG="	// (See OPERATOR_LESS_EQUAL in libdie.h).
+#define FLAT_INTEGER_LIMIT 9007199254740992.0	// 2^53 (numbers of integral operations are within it).
+
+// Precedes the arrays of a serialized flat operation (a multiple of FLAT_ALIGNMENT).
+struct flat_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t section_count;
+	uint32_t depth;
+	uint32_t repetitions;
+	uint32_t integral;
+	uint32_t reserved;	// (0).
+};
+
+// Used while filling a flat operation.
+struct flat_filler {
+	struct flat_operation *flat;
+	uint32_t next_section;
+};
+
+// A value of the stack of flat_operate (integral operations are calculated with integers, like operate).
+union flat_value {
+	double num;
+	int64_t integer;
+};
+
+int64_t just_roll(struct Die die);
+double binary_calc(double val1, char operand, double val2);
+int64_t binary_calc_i64(int64_t val1, char operand, int64_t val2, bool *overflow);
+
+size_t get_flat_arrays_size(uint32_t section_count);
+void set_flat_arrays(struct flat_operation *flat, char *arrays);
+bool is_valid_flat_operation(const struct flat_operation *flat);
+void count_flat_operation(const struct Operation *operation, size_t *section_count);
+void fill_flat_sections(struct flat_filler *filler, const struct Operation *operation, uint32_t level);
+double flat_calc(const struct flat_operation *flat, const double *slot_values, union flat_value *stack);
+int64_t flat_calc_i64(const struct flat_operation *flat, union flat_value *stack);
+
+
+/* -- Conversion -- */
+
+/* Return the size of the arrays of section_count sections (padded to a multiple of FLAT_ALIGNMENT). */
+size_t get_flat_arrays_size(uint32_t section_count)
+{
+	const size_t size = (size_t) section_count * FLAT_SECTION_SIZE;
+
+	return (size + FLAT_ALIGNMENT - 1) / FLAT_ALIGNMENT * FLAT_ALIGNMENT;
+}
+
+/* Point the arrays of flat (of flat->section_count sections) to their place in arrays (aligned to
+ * FLAT_ALIGNMENT), in the order of alignment. */
+void set_flat_arrays(struct flat_operation *flat, char *arrays)
+{
+#define TAKE_ARRAY(member) do {							\
+	flat->member = (void*) arrays;						\
+	arrays += flat->section_count * sizeof(*flat->member);			\
+} while(0)
+	TAKE_ARRAY(values);
+	TAKE_ARRAY(section_data);
+	TAKE_ARRAY(die_sides);
+	TAKE_ARRAY(section_types);
+	TAKE_ARRAY(section_flags);
+	TAKE_ARRAY(operators);
+#undef TAKE_ARRAY
+}
+
+void count_flat_operation(const struct Operation *operation, size_t *section_count)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	struct NumSection section;
+
+	*section_count += NumSection_list_length(&operation->numbers);
+
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section))
+		if(section.type == type_op)
+			count_flat_operation(section.data.operation, section_count);
+}
+
+/* Fill the next sections with those of operation (level levels deep), each parenthesis before the
+ * section standing for it. */
+void fill_flat_sections(struct flat_filler *filler, const struct Operation *operation, uint32_t level)
+{
+	struct flat_operation *const flat = filler->flat;
+	const uint32_t section_count = NumSection_list_length(&operation->numbers);
+	struct NumSection section;
+	uint32_t index;
+
+	if(level > flat->depth)
+		flat->depth = level;
+
+	for(uint32_t i = 0; i < section_count; i++) {
+		section = NumSection_list_get_index(&operation->numbers, i);
+		if(section.type == type_op)
+			fill_flat_sections(filler, section.data.operation, level + 1);
+
+		index = filler->next_section++;
+		flat->section_types[index] = section.type;
+		flat->operators[index] = (i == 0) ? '\0' : char_list_get_index(&operation->operators, i - 1);
+		flat->section_flags[index] = (i == 0 && operation->prefix == '-') ? FLAT_NEGATIVE : 0;
+		flat->values[index] = 0;
+		flat->section_data[index] = 0;
+		flat->die_sides[index] = 0;
+
+		switch(section.type) {
+		case(type_num):
+			flat->values[index] = section.data.num;
+			break;
+		case(type_die):
+			flat->section_data[index] = section.data.die.repetitions;
+			flat->die_sides[index] = section.data.die.sides;
+			break;
+		case(type_op):
+			if(((const struct Operation*) section.data.operation)->parenthesis)
+				flat->section_flags[index] |= FLAT_PARENTHESIS;
+			break;
+		case(type_slot):
+			flat->section_data[index] = section.data.slot;
+			break;
+		}
+	}
+}
+
+struct flat_operation* op_to_flat(const struct Operation *operation)
+{
+	struct flat_operation *flat;
+	struct flat_filler filler;
+	size_t section_count = 0;
+
+	count_flat_operation(operation, &section_count);
+	if(section_count > UINT32_MAX)
+		return NULL;
+
+	// (sizeof(*flat) is a multiple of FLAT_ALIGNMENT, since it has a double pointer).
+	if(!(flat = die_malloc(sizeof(*flat) + get_flat_arrays_size(section_count))))
+		return NULL;
+
+	flat->section_count = section_count;
+	flat->depth = 0;
+	flat->repetitions = operation->repetitions;
+	flat->integral = operation->integral;
+	set_flat_arrays(flat, (char*) (flat + 1));
+
+	filler.flat = flat;
+	filler.next_section = 0;
+	fill_flat_sections(&filler, operation, 1);
+
+	return flat;
+}
+
+void clear_flat_operation(struct flat_operation *flat)
+{
+	die_free(flat);
+}
+
+
+/* -- Calculation -- */
+
+// (Same order and arithmetic as operate_rec, so the results are the same for the same dice).
+double flat_calc(const struct flat_operation *flat, const double *slot_values, union flat_value *stack)
+{
+	uint32_t top = 0;
+	struct Die die;
+	double value;
+
+	for(uint32_t section = 0; section < flat->section_count; section++) {
+		switch(flat->section_types[section]) {
+		case(type_num):
+			value = flat->values[section];
+			break;
+		case(type_die):
+			die.repetitions = flat->section_data[section];
+			die.sides = flat->die_sides[section];
+			value = (double) just_roll(die);
+			break;
+		case(type_op):
+			value = stack[--top].num;	// (The parenthesis, just calculated).
+			break;
+		default:	// type_slot
+			value = slot_values[flat->section_data[section]];
+			break;
+		}
+
+		if(flat->operators[section] == '\0')
+			stack[top++].num = (flat->section_flags[section] & FLAT_NEGATIVE) ? -value : value;
+		else
+			stack[top - 1].num = binary_calc(stack[top - 1].num, flat->operators[section], value);
+	}
+
+	return stack[0].num;
+}
+
+// (Same as operate_rec_i64, an integral operation can't overflow).
+int64_t flat_calc_i64(const struct flat_operation *flat, union flat_value *stack)
+{
+	uint32_t top = 0;
+	struct Die die;
+	int64_t value;
+	bool overflow;
+
+	for(uint32_t section = 0; section < flat->section_count; section++) {
+		switch(flat->section_types[section]) {
+		case(type_num):
+			value = (int64_t) flat->values[section];
+			break;
+		case(type_die):
+			die.repetitions = flat->section_data[section];
+			die.sides = flat->die_sides[section];
+			value = just_roll(die);
+			break;
+		default:	// type_op (type_slot is never integral).
+			value = stack[--top].integer;
+			break;
+		}
+
+		if(flat->operators[section] == '\0')
+			stack[top++].integer = (flat->section_flags[section] & FLAT_NEGATIVE)
+				? binary_calc_i64(0, '-', value, &overflow) : value;
+		else
+			stack[top - 1].integer = binary_calc_i64(stack[top - 1].integer, flat->operators[section],
+					value, &overflow);
+	}
+
+	return stack[0].integer;
+}
+
+double flat_operate(const struct flat_operation *flat, const double *slot_values)
+{
+	union flat_value stack_buffer[FLAT_STACK_SIZE];
+	union flat_value *stack = stack_buffer;
+	double ret;
+
+	if(flat->depth > FLAT_STACK_SIZE && !(stack = die_malloc(flat->depth * sizeof(*stack))))
+		return NAN;
+
+	// Every value of an integral operation is exact as a double (see operate).
+	ret = (flat->integral) ? (double) flat_calc_i64(flat, stack) : flat_calc(flat, slot_values, stack);
+
+	if(stack != stack_buffer)
+		die_free(stack);
+	return ret;
+}
+
+unsigned flat_get_slot_count(const struct flat_operation *flat)
+{
+	unsigned count = 0;
+
+	// (A single pass over the sections, regardless of nesting).
+	// Indexes are below DIE_MAX_SLOT_COUNT (checked by exp_to_op and op_deserialize), so + 1 can't wrap to 0.
+	for(uint32_t section = 0; section < flat->section_count; section++)
+		if(flat->section_types[section] == type_slot && flat->section_data[section] >= count) {
+			lassert(flat->section_data[section] < DIE_MAX_SLOT_COUNT, ASSERT_LVL_FAST);
+			count = flat->section_data[section] + 1;
+		}
+
+	return count;
+}
+
+
+/* -- Saving and loading -- */
+
+/* Return true if flat (possibly from untrusted data) may be given to flat_operate: its sections are
+ * valid, fit its stack and leave one value, and if it's integral it has no placeholders, operators or
+ * numbers the integer calculation doesn't handle. */
+bool is_valid_flat_operation(const struct flat_operation *flat)
+{
+	uint32_t top = 0;
+	char operator;
+
+	if(flat->section_count == 0 || flat->repetitions == 0 || flat->depth > flat->section_count)
+		return false;
+
+	for(uint32_t section = 0; section < flat->section_count; section++) {
+		operator = flat->operators[section];
+		if((flat->section_flags[section] & ~(FLAT_NEGATIVE | FLAT_PARENTHESIS))
+				|| (operator != '\0' && !memchr(FLAT_OPERATORS, operator, sizeof(FLAT_OPERATORS) - 1))
+				|| (flat->integral && (operator == '/' || operator == '^')))
+			return false;
+
+		switch(flat->section_types[section]) {
+		case(type_num):
+			if(flat->integral && !(fabs(flat->values[section]) <= FLAT_INTEGER_LIMIT
+						&& flat->values[section] == floor(flat->values[section])))
+				return false;
+			break;
+		case(type_die):
+			if(flat->section_data[section] == 0 || flat->die_sides[section] < 1)
+				return false;
+			break;
+		case(type_op):
+			if(top-- == 0)	// (Pops its parenthesis).
+				return false;
+			break;
+		case(type_slot):
+			if(flat->integral || flat->section_data[section] >= DIE_MAX_SLOT_COUNT)
+				return false;
+			break;
+		default:
+			return false;
+		}
+
+		if(operator == '\0') {
+			if(++top > flat->depth)
+				return false;
+		} else if(top == 0) {
+			return false;
+		}
+	}
+
+	return top == 1;
+}
+
+size_t flat_serialize(const struct flat_operation *flat, void *buffer, size_t size)
+{
+	const size_t total = sizeof(struct flat_header) + get_flat_arrays_size(flat->section_count);
+	struct flat_operation copy = *flat;
+	struct flat_header header = {
+		.version = FLAT_FORMAT_VERSION,
+		.byte_order = BYTE_ORDER_MARK,
+		.section_count = flat->section_count,
+		.depth = flat->depth,
+		.repetitions = flat->repetitions,
+		.integral = flat->integral,
+		.reserved = 0,
+	};
+
+	if(total > size)
+		return total;
+
+	memcpy(header.magic, FLAT_MAGIC, sizeof(header.magic));
+	memcpy(buffer, &header, sizeof(header));
+	memset((char*) buffer + sizeof(header), 0, total - sizeof(header));	// (The padding).
+	set_flat_arrays(&copy, (char*) buffer + sizeof(header));
+#define COPY_ARRAY(member) memcpy(copy.member, flat->member, flat->section_count * sizeof(*flat->member))
+	COPY_ARRAY(values);
+	COPY_ARRAY(section_data);
+	COPY_ARRAY(die_sides);
+	COPY_ARRAY(section_types);
+	COPY_ARRAY(section_flags);
+	COPY_ARRAY(operators);
+#undef COPY_ARRAY
+
+	return total;
+}
+
+bool flat_load(const void *data, size_t size, struct flat_operation *flat, size_t *used)
+{
+	const struct flat_header *const header = data;
+
+	if((uintptr_t) data % FLAT_ALIGNMENT != 0 || size < sizeof(*header)
+			|| memcmp(header->magic, FLAT_MAGIC, sizeof(header->magic)) != 0
+			|| header->version != FLAT_FORMAT_VERSION || header->byte_order != BYTE_ORDER_MARK
+			|| header->integral > 1
+			|| header->section_count > (size - sizeof(*header)) / FLAT_SECTION_SIZE	// (No overflow).
+			|| get_flat_arrays_size(header->section_count) > size - sizeof(*header))
+		return true;
+
+	*flat = (struct flat_operation) {
+		.section_count = header->section_count,
+		.depth = header->depth,
+		.repetitions = header->repetitions,
+		.integral = header->integral,
+	};
+	set_flat_arrays(flat, (char*) (header + 1));	// (Not modified, see libdie.h).
+	if(!is_valid_flat_operation(flat))
+		return true;
+
+	if(used)
+		*used = sizeof(*header) + get_flat_arrays_size(header->section_count);
+	return false;
+}
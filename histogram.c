@@ -0,0 +1,299 @@
+/* Counting the results of an operation into a histogram.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The trials are split between threads, each calculating blocks of results with batch_blocks (see
+ * batch.c) and counting them into a histogram (or accumulator) of its own, so nothing is shared until
+ * they're summed at the end. The first job is run by the calling thread.
+ *
+ * Everything is allocated by the calling thread, so the thread's allocator (see die_allocator) is the
+ * one used (accumulators reserve the levels they'll need beforehand).
+ *
+ * The dice are rolled with generators of their own (see rng.h): a seed per call, and a stream per job. */
+
+#include "libdie.h"
+#include "alloc.h"
+#include "rng.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#define HISTOGRAM_BLOCK 1024		// Results calculated at a time (by each job).
+#define MIN_JOB_TRIALS (1 << 16)	// Fewer trials aren't worth another thread.
+// Results of integral operations are in [-EXACT_LIMIT, EXACT_LIMIT] (see is_exact_integer_operation).
+#define EXACT_LIMIT 0x1p53
+
+struct histogram_job {
+	const struct Operation *operation;
+	uint64_t trials;
+	uint64_t seed;
+	uint64_t stream;
+
+	// Results go to acc if it's set, otherwise to the bins.
+	double first;
+	double scale;		// 1 / width.
+	size_t bin_count;
+	uint64_t *bins;
+	uint64_t below;
+	uint64_t above;
+	struct die_stats_acc *acc;
+	bool failed;		// (Adding to acc).
+
+	double *scratch;	// (For batch_blocks).
+	pthread_t thread;
+	bool joinable;		// Run by its own thread.
+};
+
+size_t get_batch_scratch_length(const struct Operation *operation);
+void batch_blocks(const struct Operation *operation, double *results, size_t count, double *scratch,
+		const double *slot_values);
+bool get_integer_range(const struct Operation *operation, double limit, double *min, double *max);
+bool reserve_acc_levels(struct die_stats_acc *acc, unsigned level_count);
+
+void count_results(struct histogram_job *job, const double *results, size_t count);
+void* run_histogram_job(void *job);
+void run_histogram_jobs(struct histogram_job *jobs, unsigned job_count);
+unsigned get_histogram_job_count(uint64_t trials, size_t bin_count);
+struct histogram_job* make_histogram_jobs(const struct Operation *operation, uint64_t trials, unsigned job_count);
+void free_histogram_jobs(struct histogram_job *jobs, unsigned job_count);
+unsigned get_acc_level_count(uint64_t count);
+
+
+/* -- Jobs -- */
+
+void count_results(struct histogram_job *job, const double *results, size_t count)
+{
+	uint64_t *const bins = job->bins;
+	const double bin_count = job->bin_count;
+	double offset;
+
+	for(size_t i = 0; i < count; i++) {
+		offset = (results[i] - job->first) * job->scale;
+		if(offset < 0)
+			job->below++;
+		else if(offset < bin_count)
+			bins[(size_t) offset]++;
+		else
+			job->above++;	// (Including NaN).
+	}
+}
+
+void* run_histogram_job(void *job_pointer)
+{
+	struct histogram_job *const job = job_pointer;
+	struct die_rng *const previous_rng = active_rng;
+	struct die_rng rng;
+	double results[HISTOGRAM_BLOCK];
+	size_t block;
+
+	rng_seed(&rng, job->seed, job->stream);
+	active_rng = &rng;
+
+	for(uint64_t done = 0; done < job->trials; done += block) {
+		block = (job->trials - done < HISTOGRAM_BLOCK) ? job->trials - done : HISTOGRAM_BLOCK;
+		batch_blocks(job->operation, results, block, job->scratch, NULL);
+		if(job->acc)
+			job->failed |= die_stats_acc_add_array(job->acc, results, block);
+		else
+			count_results(job, results, block);
+	}
+
+	active_rng = previous_rng;
+	return NULL;
+}
+
+/* Run jobs[1] onward on threads of their own (or the calling thread if one can't be started),
+ * and jobs[0] on the calling thread, and wait for them all. */
+void run_histogram_jobs(struct histogram_job *jobs, unsigned job_count)
+{
+	for(unsigned i = 1; i < job_count; i++)
+		jobs[i].joinable = (pthread_create(&jobs[i].thread, NULL, run_histogram_job, &jobs[i]) == 0);
+	run_histogram_job(&jobs[0]);
+
+	for(unsigned i = 1; i < job_count; i++) {
+		if(jobs[i].joinable)
+			pthread_join(jobs[i].thread, NULL);
+		else
+			run_histogram_job(&jobs[i]);
+	}
+}
+
+/* Return the number of jobs to split trials between: one per processor, as long as each has at least
+ * MIN_JOB_TRIALS trials, and at least as many trials as bins (summing the histograms costs more otherwise). */
+unsigned get_histogram_job_count(uint64_t trials, size_t bin_count)
+{
+	const uint64_t job_trials = (bin_count > MIN_JOB_TRIALS) ? bin_count : MIN_JOB_TRIALS;
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t count = trials / job_trials;
+
+	if(processors < 1)
+		processors = 1;
+	if(count > (uint64_t) processors)
+		count = processors;
+	return (count > 0) ? count : 1;
+}
+
+/* Return job_count jobs splitting the trials of operation, with their scratch allocated (the rest of
+ * the members are zeroed), or NULL on memory failure. */
+struct histogram_job* make_histogram_jobs(const struct Operation *operation, uint64_t trials, unsigned job_count)
+{
+	const size_t scratch_length = get_batch_scratch_length(operation);
+	const uint64_t seed = make_token_seed();
+	struct histogram_job *jobs;
+
+	if(!(jobs = die_calloc(job_count, sizeof(*jobs))))
+		return NULL;
+
+	for(unsigned i = 0; i < job_count; i++) {
+		jobs[i].operation = operation;
+		jobs[i].trials = trials / job_count + (i < trials % job_count);
+		jobs[i].seed = seed;
+		jobs[i].stream = i;
+		if(!(jobs[i].scratch = die_malloc(scratch_length * sizeof(*jobs[i].scratch)))) {
+			free_histogram_jobs(jobs, i);
+			return NULL;
+		}
+	}
+
+	return jobs;
+}
+
+/* Free jobs, their scratch, and their bins (except the first's). */
+void free_histogram_jobs(struct histogram_job *jobs, unsigned job_count)
+{
+	for(unsigned i = 0; i < job_count; i++) {
+		die_free(jobs[i].scratch);
+		if(i != 0)
+			die_free(jobs[i].bins);
+	}
+	die_free(jobs);
+}
+
+
+/* -- Histograms -- */
+
+bool operate_histogram(const struct Operation *operation, uint64_t trials, struct die_histogram *histogram)
+{
+	struct histogram_job *jobs;
+	unsigned job_count;
+	double min, max;
+
+	if(histogram->bin_count == 0) {
+		if(!operation->integral || !get_integer_range(operation, EXACT_LIMIT, &min, &max)
+				|| max - min >= DIE_HISTOGRAM_MAX_BINS)
+			return true;
+		histogram->first = min;
+		histogram->width = 1;
+		histogram->bin_count = max - min + 1;
+	} else if(!(histogram->width > 0)) {
+		return true;
+	}
+
+	job_count = get_histogram_job_count(trials, histogram->bin_count);
+	if(!(jobs = make_histogram_jobs(operation, trials, job_count)))
+		goto fail;
+
+	for(unsigned i = 0; i < job_count; i++) {
+		jobs[i].first = histogram->first;
+		jobs[i].scale = 1 / histogram->width;
+		jobs[i].bin_count = histogram->bin_count;
+		if(!(jobs[i].bins = die_calloc(histogram->bin_count, sizeof(*jobs[i].bins)))) {
+			die_free(jobs[0].bins);
+			free_histogram_jobs(jobs, job_count);
+			goto fail;
+		}
+	}
+
+	run_histogram_jobs(jobs, job_count);
+
+	// Sum the other jobs' histograms into the first's.
+	for(unsigned i = 1; i < job_count; i++) {
+		for(size_t bin = 0; bin < histogram->bin_count; bin++)
+			jobs[0].bins[bin] += jobs[i].bins[bin];
+		jobs[0].below += jobs[i].below;
+		jobs[0].above += jobs[i].above;
+	}
+	histogram->bins = jobs[0].bins;
+	histogram->below = jobs[0].below;
+	histogram->above = jobs[0].above;
+
+	free_histogram_jobs(jobs, job_count);
+	return false;
+
+fail:
+	histogram->bins = NULL;
+	return true;
+}
+
+void clear_die_histogram(struct die_histogram *histogram)
+{
+	die_free(histogram->bins);
+	histogram->bins = NULL;
+}
+
+
+/* -- Accumulators -- */
+
+/* Return the number of sketch levels an accumulator needs for count values (see accumulator.c). */
+unsigned get_acc_level_count(uint64_t count)
+{
+	unsigned level_count = 1;
+
+	// (Level h fills up after DIE_ACC_LEVEL_SIZE * 2^h values).
+	while(level_count < DIE_ACC_MAX_LEVELS && count >= (uint64_t) DIE_ACC_LEVEL_SIZE << (level_count - 1))
+		level_count++;
+	return level_count;
+}
+
+bool operate_accumulate(const struct Operation *operation, uint64_t trials, struct die_stats_acc *acc)
+{
+	struct histogram_job *jobs;
+	struct die_stats_acc *accs;
+	unsigned job_count;
+	unsigned acc_count;
+	bool failed = true;
+
+	job_count = get_histogram_job_count(trials, 0);
+	if(!(jobs = make_histogram_jobs(operation, trials, job_count)))
+		return true;
+	if(!(accs = die_malloc(job_count * sizeof(*accs))))
+		goto free_jobs;
+
+	for(acc_count = 0; acc_count < job_count; acc_count++) {
+		die_stats_acc_init(&accs[acc_count]);
+		jobs[acc_count].acc = &accs[acc_count];
+		if(reserve_acc_levels(&accs[acc_count], get_acc_level_count(jobs[acc_count].trials))) {
+			acc_count++;	// (So it's cleared below).
+			goto clear_accs;
+		}
+	}
+
+	run_histogram_jobs(jobs, job_count);
+
+	failed = false;
+	for(unsigned i = 0; i < job_count; i++) {
+		if(die_stats_acc_merge(acc, &accs[i]) || jobs[i].failed)
+			failed = true;
+	}
+
+clear_accs:
+	for(unsigned i = 0; i < acc_count; i++)
+		clear_die_stats_acc(&accs[i]);
+	die_free(accs);
+free_jobs:
+	free_histogram_jobs(jobs, job_count);
+	return failed;
+}
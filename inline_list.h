@@ -0,0 +1,141 @@
+/* Lists keeping their first elements inline - internal header.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Same interface as the lists of list.h (the functions used by this library), only the first
+ * inline_count elements are kept in the list itself, and only longer lists allocate (through the
+ * library's allocator, see alloc.h).
+ *
+ * Used for the lists of struct Operation, which usually hold a few elements.
+ *
+ * inline_list_def_proto(type, name, inline_count) defines name##_list, name##_iterator and declares:
+ * 	bool name##_list_init(name##_list *list);			(true on memory failure, never happens)
+ * 	bool name##_list_append(name##_list *list, type value);	(true on memory failure)
+ * 	void name##_list_close(name##_list *list, void (*clear)(type));	(clear may be NULL)
+ * 	size_t name##_list_length(const name##_list *list);
+ * 	name##_iterator get_##name##_list_iterator(const name##_list *list);
+ * 	bool name##_list_get(name##_iterator *ite, const name##_list *list, type *out);	(true at the end)
+ * 	type name##_list_get_index(const name##_list *list, size_t index);
+ * 	int name##_list_comp(const name##_list *l1, const name##_list *l2, int (*comp)(type, type));
+ * inline_list_def_funcs(type, name, inline_count) defines them (once, with the same arguments). */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Return the elements of list (inline or allocated).
+#define INLINE_LIST_ARRAY(list, inline_count) (((list)->size > (inline_count)) ? (list)->data.heap : (list)->data.inline_array)
+
+#define inline_list_def_proto(type, name, inline_count)					\
+typedef struct name##_list {								\
+	union {										\
+		type inline_array[inline_count];	/* While size == inline_count. */	\
+		type *heap;				/* Once it's bigger. */			\
+	} data;										\
+	unsigned length;								\
+	unsigned size;									\
+} name##_list;										\
+											\
+typedef struct name##_iterator {							\
+	unsigned index;									\
+} name##_iterator;									\
+											\
+bool name##_list_init(name##_list *list);						\
+bool name##_list_append(name##_list *list, type value);				\
+void name##_list_close(name##_list *list, void (*clear)(type));			\
+size_t name##_list_length(const name##_list *list);					\
+name##_iterator get_##name##_list_iterator(const name##_list *list);			\
+bool name##_list_get(name##_iterator *ite, const name##_list *list, type *out);	\
+type name##_list_get_index(const name##_list *list, size_t index);			\
+int name##_list_comp(const name##_list *l1, const name##_list *l2, int (*comp)(type, type));
+
+// (Requires alloc.h).
+#define inline_list_def_funcs(type, name, inline_count)					\
+bool name##_list_init(name##_list *list)						\
+{											\
+	list->length = 0;								\
+	list->size = (inline_count);							\
+	return false;									\
+}											\
+											\
+bool name##_list_append(name##_list *list, type value)				\
+{											\
+	type *new_heap;									\
+											\
+	if(list->length == list->size) {						\
+		if(list->size == (inline_count)) {					\
+			if(!(new_heap = die_malloc(2 * list->size * sizeof(type))))	\
+				return true;						\
+			memcpy(new_heap, list->data.inline_array, list->length * sizeof(type)); \
+		} else if(!(new_heap = die_realloc(list->data.heap, 2 * list->size * sizeof(type)))) { \
+			return true;							\
+		}									\
+		list->data.heap = new_heap;						\
+		list->size *= 2;							\
+	}										\
+											\
+	INLINE_LIST_ARRAY(list, inline_count)[list->length++] = value;			\
+	return false;									\
+}											\
+											\
+void name##_list_close(name##_list *list, void (*clear)(type))			\
+{											\
+	type *const array = INLINE_LIST_ARRAY(list, inline_count);			\
+											\
+	if(clear)									\
+		for(unsigned i = 0; i < list->length; i++)				\
+			clear(array[i]);						\
+	if(list->size > (inline_count))							\
+		die_free(list->data.heap);						\
+}											\
+											\
+size_t name##_list_length(const name##_list *list)					\
+{											\
+	return list->length;								\
+}											\
+											\
+name##_iterator get_##name##_list_iterator(const name##_list *list)			\
+{											\
+	(void) list;									\
+	return (name##_iterator) { .index = 0 };					\
+}											\
+											\
+bool name##_list_get(name##_iterator *ite, const name##_list *list, type *out)	\
+{											\
+	if(ite->index >= list->length)							\
+		return true;								\
+	*out = INLINE_LIST_ARRAY(list, inline_count)[ite->index++];			\
+	return false;									\
+}											\
+											\
+type name##_list_get_index(const name##_list *list, size_t index)			\
+{											\
+	return INLINE_LIST_ARRAY(list, inline_count)[index];				\
+}											\
+											\
+int name##_list_comp(const name##_list *l1, const name##_list *l2, int (*comp)(type, type)) \
+{											\
+	const type *const array1 = INLINE_LIST_ARRAY(l1, inline_count);		\
+	const type *const array2 = INLINE_LIST_ARRAY(l2, inline_count);		\
+	int comparison;									\
+											\
+	if(l1->length != l2->length)							\
+		return (l1->length > l2->length) ? 1 : -1;				\
+	for(unsigned i = 0; i < l1->length; i++)					\
+		if((comparison = comp(array1[i], array2[i])) != 0)			\
+			return comparison;						\
+	return 0;									\
+}
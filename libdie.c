@@ -15,9 +15,22 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "libdie.h"
+#include "alloc.h"
 
+#include <string.h>
+
+// Make the generated list functions use the library's allocator (see alloc.h).
+#define malloc(size) die_malloc(size)
+#define calloc(nmemb, size) die_calloc(nmemb, size)
+#define realloc(ptr, size) die_realloc(ptr, size)
+#define free(ptr) die_free(ptr)
 named_list_def_funcs(struct Dierror, Dierror)
-named_list_def_funcs(struct NumSection, NumSection)
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+
+inline_list_def_funcs(struct NumSection, NumSection, NUM_SECTION_INLINE_COUNT)
 
 void clear_num_section(struct NumSection section)
 {
@@ -30,6 +43,6 @@ void clear_operation_pointer(struct Operation *operation)
 {
 	NumSection_list_close(&operation->numbers, clear_num_section);
 	char_list_close(&operation->operators, NULL);
-	free(operation);
+	die_free(operation);
 }
 
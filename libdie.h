@@ -16,16 +16,29 @@
  */
 
 /* Calculate dice expression (like "d20+2" or "2d4+5/d10^d3") into a number after rolling the dice along
- * with an optional calculation string. */
+ * with an optional calculation string.
+ *
+ * The whole expression may be repeated by starting it with a number and 'x' (like "6x4d6"),
+ * see operate_repeat.
+ *
+ * A number may also be a placeholder: '$' followed by an index (like "d20+$0"), whose value is given
+ * when calculating (see operate_bound). Placeholders may also be named ("d20+$mod"), see exp_to_op_named.
+ * Placeholders are numbers only: they can't be the count or sides of dice ("$0d20" and "d$0" are
+ * invalid_placeholder and invalid_sides errors), so those have to be in the expression itself.
+ *
+ * Comparisons ('<', "<=", '>', ">=", "==") have the lowest precedence and result in 1 if true or 0 if
+ * false, so "d20+5>=15" is 1 when the roll hits (see op_probability_true). */
 
 #pragma once
 
 #include "list/list.h"
 #include "list_defs.h"
+#include "inline_list.h"
 
 #include <stddef.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 
 /* Contain the type of error and any data associated with it. */
@@ -46,6 +59,10 @@ typedef struct Dierror {
 		invalid_parenthesis,
 		empty_expression,
 
+		invalid_placeholder,
+
+		exceeds_limits,		// The operation costs more than the limits set (see die_set_op_limits).
+
 		end_of_list		// (not an error but marks the end of the list).
 	} type;
 
@@ -58,19 +75,22 @@ struct Die {
 	int sides;	// >= 1
 };
 
-// Struct to contain either a number, die, or operation.
+// Struct to contain either a number, die, operation, or placeholder.
 struct NumSection {
-	enum { type_num, type_die, type_op } type;
+	enum { type_num, type_die, type_op, type_slot } type;
 	union {
 		double num;
 		struct Die die;
 		void *operation;
+		unsigned slot;	// Index of the placeholder's value (see operate_bound).
 	} data;
 };
 
 // Define lists
 named_list_def_proto(struct Dierror, Dierror)
-named_list_def_proto(struct NumSection, NumSection)
+// (Inline, see inline_list.h: most operations have up to 4 numbers).
+#define NUM_SECTION_INLINE_COUNT 4
+inline_list_def_proto(struct NumSection, NumSection, NUM_SECTION_INLINE_COUNT)
 
 /* Contain a list of binary operations:
  *
@@ -79,9 +99,19 @@ named_list_def_proto(struct NumSection, NumSection)
  *
  * The operators should be of the same, or decreasing precedence (eg. `1^3/4*2-1+12`), otherwise
  * the next number will be of type op, and should be called recursively to get the value of each number
- * (eg `1+op(3*4)`). */
+ * (eg `1+op(3*4)`).
+ *
+ * Each operator is a single char: the one in the expression, or for comparisons of two chars: */
+#define OPERATOR_LESS_EQUAL	'L'	// "<="
+#define OPERATOR_GREATER_EQUAL	'G'	// ">="
+#define OPERATOR_EQUAL		'='	// "=="
 struct Operation {
 	unsigned parenthesis :1;
+	unsigned integral :1;	// Set by exp_to_op if operate may use integer arithmetic (see operate_i64).
+	unsigned repetitions;	// Times the expression is repeated by operate_repeat (1 unless given).
+	// Set by exp_to_op for common expressions ("NdS", "NdS+K", "NdS+MdT+K"), to be used by
+	// operate instead of the generic calculation when there's no calc_string (NULL otherwise).
+	double (*evaluator)(const struct Operation *operation);
 	struct NumSection_list numbers;
 	struct char_list operators;
 	char prefix;
@@ -103,15 +133,24 @@ struct Operation* exp_to_op(char *dice_exp, struct Dierror **errors);
  * 	Otherwise:
  * 		*errors is set to an array of errors terminated by dierror of type end_of_list.
  * 			(fprint_dierrors is available to print the array).
- * 		*errors must be freed with free.
+ * 		*errors must be freed with die_free (free may be used if no allocator was set).
  *
  * In each case, dice_exp will remain unmodified.
  */
 
+struct Operation* exp_to_op_named(char *dice_exp, const char *const *names, size_t name_count,
+		struct Dierror **errors);
+/* Same as exp_to_op, only a placeholder may also be '$' followed by one of the name_count names
+ * (anything up to the next operator or parenthesis, not starting with a digit): "$names[i]" is the
+ * same as "$i", so names is also the lookup of the values for operate_bound.
+ * Other names are invalid_placeholder errors (as are all names with exp_to_op). */
+
 
 size_t get_calc_string_length(const struct Operation *operation);
 /* Return the needed length of the calc_string buffer optionally used by operate below.
- * (The maximum length required to represent the operation as a string.) */
+ * (The maximum length required to represent the operation as a string.)
+ *
+ * Note: since their value isn't known, placeholders are counted as the longest possible number. */
 
 
 double operate(const struct Operation *operation, char *calc_string, short flags);
@@ -132,6 +171,564 @@ double operate(const struct Operation *operation, char *calc_string, short flags
  */
 
 
+void operate_repeat(const struct Operation *operation, double *results,
+		char *calc_string, size_t *calc_string_offsets, short flags);
+/* Calculate operation operation->repetitions times (see "6x4d6" above), without allocating.
+ *
+ * pre:
+ * 	Same as operate, only calc_string (if not NULL) is the size of get_repeat_calc_string_length(operation)
+ * 		or bigger.
+ * 	results has at least operation->repetitions elements.
+ * 	calc_string_offsets has at least operation->repetitions elements if calc_string != NULL
+ * 		(it may be NULL otherwise).
+ * post:
+ * 	results[i] is set to the result of repetition i.
+ * 	If calc_string != NULL, the calculation strings are written one after another, each terminated
+ * 		by '\0', and the string of repetition i starts at calc_string + calc_string_offsets[i].
+ *
+ * Note: operate calculates the operation once, ignoring repetitions. */
+
+
+size_t get_repeat_calc_string_length(const struct Operation *operation);
+/* Return the needed length of the calc_string buffer used by operate_repeat
+ * (SIZE_MAX if it's too big for a size_t). */
+
+
+#define DIE_MAX_SLOT_COUNT (1 << 16)	// Placeholder indexes must be below this ("$65536" is invalid).
+
+double operate_bound(const struct Operation *operation, const double *values, char *calc_string, short flags);
+/* Same as operate, only placeholders are replaced by values: "$i" is given values[i].
+ *
+ * pre:
+ * 	Same as operate.
+ * 	values has at least get_slot_count(operation) elements (may be NULL if it's 0).
+ *
+ * The operation is not modified, so the same operation may be calculated with different values
+ * without parsing it again. */
+
+
+unsigned get_slot_count(const struct Operation *operation);
+/* Return the number of values operate_bound expects for operation: the highest placeholder
+ * index + 1, or 0 if there are no placeholders.
+ *
+ * Note: operate may only be used if this is 0. */
+
+
+int64_t operate_i64(const struct Operation *operation, char *calc_string, short flags, bool *overflow);
+/* Same as operate, only the calculation is done with 64-bit integers.
+ *
+ * pre:
+ * 	Same as operate.
+ * 	is_integer_operation(operation) is true.
+ * 	overflow != NULL.
+ * post:
+ * 	Same as operate, only if an overflow (or modulo by 0) occured *overflow is set to true, and the
+ * 		returned value is unspecified. Otherwise *overflow is set to false.
+ *
+ * Note: operate already calls this when it's safe (the integral member of operation), so this is only
+ * 	needed when an integer result is desired. */
+
+
+// Identifies the dice rolled by operate_token, so the calculation can be replayed.
+struct die_token {
+	uint64_t seed;
+	uint64_t stream;
+};
+
+double operate_token(const struct Operation *operation, struct die_token *token);
+/* Same as operate without a calc_string, only the dice are rolled with a generator of their own
+ * (not rand()), identified by *token, which is set.
+ * Calculating the string is deferred: die_replay_calc_string may get it later, when needed.
+ *
+ * Tokens are (seed, stream) pairs: each thread takes a seed on its first call (see die_set_token_seed),
+ * and the stream is incremented every call. */
+
+double die_replay_calc_string(const struct Operation *operation, const struct die_token *token,
+		char *calc_string, short flags);
+/* Repeat the calculation operate_token did when it set *token: the dice are rolled the same, so
+ * calc_string (as in operate) is set to the string the calculation would have had, and the same result
+ * is returned.
+ *
+ * pre: operation is the operation passed to operate_token (or one parsed from the same expression). */
+
+void die_set_token_seed(uint64_t seed);
+/* Set the seed of the calling thread's tokens, and restart their streams from 0 (so the following
+ * calls to operate_token roll the same as after the last call with this seed).
+ * Otherwise a seed is chosen (different for each thread) on the first call of operate_token. */
+
+
+bool is_integer_operation(const struct Operation *operation);
+/* Return true if operation may be calculated with operate_i64: there are no '/' or '^' operators,
+ * and all numbers are integers (placeholders are not).
+ *
+ * Examples:
+ * 	"d20+5", "2*3d6-1", "4d6%3", "d20+5>=15" would return true.
+ * 	"d20/2", "2^d4", "1.5*d6" would return false. */
+
+
+// The cost of calculating an operation (see op_cost_estimate).
+struct die_op_cost {
+	uint64_t dice;			// Dice rolled by operate_repeat (all repetitions).
+	uint64_t calc_string_bytes;	// Same as get_repeat_calc_string_length.
+	uint64_t sections;		// Numbers, dice, placeholders and operations in the tree.
+	uint64_t estimated_ns;		// Rough time of operate_repeat without a calc_string.
+};	// (Members saturate at UINT64_MAX).
+
+void op_cost_estimate(const struct Operation *operation, struct die_op_cost *cost);
+/* Set *cost to the cost of calculating operation, without calculating it (the time is linear in the
+ * size of the tree, not in the number of dice).
+ *
+ * Example: "4000000000d1000000" has 4000000000 dice and 32000000000 calc_string_bytes. */
+
+// Limits on the cost of operations returned by exp_to_op. 0 is no limit.
+struct die_op_limits {
+	uint64_t max_dice;
+	uint64_t max_calc_string_bytes;
+	uint64_t max_sections;
+	uint64_t max_estimated_ns;
+};
+
+void die_set_op_limits(const struct die_op_limits *limits);
+/* Set the limits used by all threads (unless they set their own below): expressions exceeding them
+ * (see op_cost_estimate) are rejected by exp_to_op with an error of type exceeds_limits.
+ * *limits is copied. If limits is NULL, there are no limits (the default).
+ *
+ * Note: op_deserialize doesn't check them (op_cost_estimate may be used on what it returns).
+ *
+ * Should be called before any thread uses the library. */
+
+void die_set_thread_op_limits(const struct die_op_limits *limits);
+/* Set the limits used by the calling thread, overriding the ones set by die_set_op_limits.
+ * *limits is copied. If limits is NULL, the thread goes back to using die_set_op_limits's. */
+
+
+// Counters of the library's work (see die_stats_snapshot).
+struct die_stats {
+	uint64_t dice_rolled;
+	// Random numbers drawn: one per die (and more when one is rejected to keep the rolls uniform),
+	// and the ones of die_approx_sample.
+	uint64_t rng_draws;
+	uint64_t calc_string_bytes;	// Written by the operate functions (not counting '\0').
+	uint64_t allocations;		// Made through the library's allocator (see die_allocator).
+	uint64_t parse_errors[end_of_list];	// Returned by exp_to_op, by type.
+	uint64_t exp_to_op_calls;
+	uint64_t exp_to_op_cycles;
+	uint64_t operate_calls;		// (Each repetition of operate_repeat counts).
+	uint64_t operate_cycles;
+};	// (All members must be uint64_t).
+
+bool die_stats_snapshot(struct die_stats *out);
+/* Set *out to the sum of the counters of all threads (including ones that exited).
+ *
+ * The counters are only kept if the library is compiled with LIBDIE_STATS defined (the LIBDIE_STATS
+ * cmake option), otherwise they cost nothing, *out is zeroed and false is returned.
+ *
+ * The *_cycles members are CPU cycles on x86, and nanoseconds elsewhere.
+ * Counters are per-thread, and updated without synchronization, so a snapshot taken while other
+ * threads are working may miss their latest updates. */
+
+
+// Allocator used for all of the library's allocations.
+// Each function receives context as it's last argument.
+struct die_allocator {
+	void* (*malloc)(size_t size, void *context);
+	void* (*realloc)(void *ptr, size_t size, void *context);	// (ptr may be NULL).
+	void (*free)(void *ptr, void *context);			// (ptr may be NULL).
+	void *context;
+};
+
+void die_set_allocator(const struct die_allocator *allocator);
+/* Set the allocator used by all threads (unless they set their own below).
+ * *allocator is copied. If allocator is NULL, the standard library's malloc/realloc/free are used
+ * (the default).
+ *
+ * Should be called before any thread uses the library. */
+
+void die_set_thread_allocator(const struct die_allocator *allocator);
+/* Set the allocator used by the calling thread, overriding the one set by die_set_allocator.
+ * *allocator is copied. If allocator is NULL, the thread goes back to using die_set_allocator's.
+ *
+ * Note: memory allocated by the library (operations, error arrays) must be freed while the same allocator
+ * 	is set. */
+
+void die_free(void *ptr);
+/* Free memory returned by the library (like the errors of exp_to_op) using the current allocator. */
+
+
+/* -- Saving and loading -- */
+
+#define OP_FORMAT_VERSION 1	// Version of the format written by op_serialize.
+
+size_t op_serialize(const struct Operation *operation, void *buffer, size_t size);
+/* Write operation into buffer in a binary format (versioned, with no pointers or alignment
+ * requirements, so it may be saved to a file and loaded by op_deserialize in another process).
+ *
+ * Returns the size of the serialized operation. If it's bigger than size, nothing useful is written
+ * (so op_serialize(operation, NULL, 0) may be used to get the size first). */
+
+struct Operation* op_deserialize(const void *data, size_t size, size_t *used);
+/* Return an operation read from data (written by op_serialize), without parsing an expression.
+ * data may be read where it is (like a mapped file): it isn't modified, and has no alignment requirements.
+ * The operation is a copy (a tree allocated like exp_to_op's), so data isn't needed after the call.
+ * To calculate straight from the serialized bytes instead, see flat_serialize.
+ *
+ * If used != NULL, *used is set to the size of the serialized operation, so serialized operations
+ * written one after another may be read in turn.
+ *
+ * Returns NULL if data isn't a valid serialized operation (of this version), or if a memory allocation
+ * failed. The returned pointer must be freed with clear_operation_pointer. */
+
+
+/* -- Flat operations -- */
+
+/* An operation held in a few contiguous arrays instead of a tree of allocations, for calculating
+ * (or analyzing) many operations kept in memory.
+ *
+ * The sections (numbers, dice, placeholders and parenthesis) are in the order they're calculated: the
+ * sections of a parenthesis come right before the type_op section standing for it in its operation,
+ * and the first section of each operation has no operator before it. */
+struct flat_operation {
+	uint32_t section_count;
+	uint32_t depth;			// Levels of parenthesis + 1.
+	unsigned repetitions;
+	bool integral;			// (See struct Operation).
+
+	// Per section:
+	double *values;			// The number (type_num).
+	uint32_t *section_data;		// Die repetitions (type_die), or slot (type_slot).
+	int32_t *die_sides;		// (type_die).
+	uint8_t *section_types;		// type_num, type_die, type_op or type_slot.
+	uint8_t *section_flags;		// (Internal: prefix and parenthesis).
+	char *operators;		// The operator before the section ('\0' for the first of an operation).
+};
+
+struct flat_operation* op_to_flat(const struct Operation *operation);
+/* Return a flat copy of operation (in a single allocation), or NULL if a memory allocation failed.
+ * The returned pointer must be freed with clear_flat_operation. */
+
+void clear_flat_operation(struct flat_operation *flat);
+
+double flat_operate(const struct flat_operation *flat, const double *slot_values);
+/* Calculate flat into a number (without a calculation string), like operate_bound.
+ * The dice are rolled in the same order as operate, so the result is the same for the same rand seed.
+ * Returns NaN if a memory allocation failed (only for operations deeper than 32 levels).
+ *
+ * pre: slot_values has at least flat_get_slot_count(flat) elements (may be NULL if it's 0). */
+
+unsigned flat_get_slot_count(const struct flat_operation *flat);
+/* Same as get_slot_count. */
+
+#define FLAT_FORMAT_VERSION 1	// Version of the format written by flat_serialize.
+
+size_t flat_serialize(const struct flat_operation *flat, void *buffer, size_t size);
+/* Write flat into buffer (aligned to 8 bytes) as a header followed by its arrays, with no pointers, so
+ * it may be saved to a file and used in place by flat_load in another process (on a machine of the
+ * same byte order).
+ * The size is a multiple of 8, so flat operations written one after another stay aligned.
+ *
+ * Returns the size of the serialized flat operation. If it's bigger than size, nothing is written
+ * (so flat_serialize(flat, NULL, 0) may be used to get the size first). */
+
+bool flat_load(const void *data, size_t size, struct flat_operation *flat, size_t *used);
+/* Set *flat to the flat operation in data (written by flat_serialize), without copying it: the arrays
+ * of *flat point into data (like a mapped file), so it may be calculated right away, and is valid as
+ * long as data is. Loading checks every section (so bad data can't make flat_operate misbehave), but
+ * allocates nothing.
+ * *flat must not be modified, nor given to clear_flat_operation.
+ *
+ * If used != NULL, *used is set to the size of the serialized flat operation.
+ *
+ * Returns true if data isn't aligned to 8 bytes, or isn't a valid serialized flat operation (of this
+ * version and byte order). */
+
+
+/* -- Batch calculation -- */
+
+bool operate_batch(const struct Operation *operation, double *results, size_t count, const double *slot_values);
+/* Calculate operation count times (ignoring its repetitions), into results[0] to results[count - 1],
+ * without calculation strings.
+ * Return true if a memory allocation failed (results are then unset).
+ *
+ * The trials are calculated together in blocks, an operator at a time over all of them, which is
+ * faster than calling operate_bound count times when there are many trials.
+ * Each result has the distribution of operate_bound's, but the dice are rolled in a different order,
+ * so they aren't the same results as count calls to operate_bound for the same rand seed.
+ *
+ * pre: slot_values has at least get_slot_count(operation) elements (may be NULL if it's 0). */
+
+
+/* -- Histograms -- */
+
+#define DIE_HISTOGRAM_MAX_BINS (1 << 24)	// Most exact integer bins operate_histogram will use.
+
+// Counts of results in bins of equal width: bins[i] counts results in [first + i*width, first + (i+1)*width).
+struct die_histogram {
+	double first;
+	double width;
+	size_t bin_count;
+	uint64_t *bins;
+	uint64_t below;		// Results below first.
+	uint64_t above;		// Results past the last bin (and NaN results).
+};
+
+bool operate_histogram(const struct Operation *operation, uint64_t trials, struct die_histogram *histogram);
+/* Calculate operation trials times (ignoring its repetitions), counting the results into *histogram
+ * instead of keeping them (memory is in the number of bins, not trials).
+ *
+ * If histogram->bin_count is 0, the bins are exact: one for each integer the operation may result in
+ * (first is the smallest, width is 1), which requires operation->integral (see is_integer_operation),
+ * and a range of at most DIE_HISTOGRAM_MAX_BINS integers.
+ * Otherwise first, width (> 0) and bin_count are used as set by the caller.
+ *
+ * Large counts of trials are split between threads (one per processor), each counting into a histogram
+ * of its own, summed at the end. The dice are rolled with generators of their own (not rand()), seeded
+ * differently on each call.
+ *
+ * pre: get_slot_count(operation) == 0.
+ * post: histogram->bins is allocated (free with clear_die_histogram), and the rest of the members are set.
+ * Return true if the exact bins can't be used, or a memory allocation failed (histogram->bins is then NULL). */
+
+void clear_die_histogram(struct die_histogram *histogram);
+/* Free the bins of histogram. */
+
+
+/* -- Statistics accumulators -- */
+
+#define DIE_ACC_LEVEL_SIZE 128	// Values kept per level of the quantile sketch (a power of 2, more is more accurate).
+#define DIE_ACC_MAX_LEVELS 64
+
+// Running statistics of the values added to it, without keeping them (see die_stats_acc_add).
+struct die_stats_acc {
+	uint64_t count;		// (Not counting NaN values).
+	uint64_t nan_count;	// NaN values, which are otherwise ignored.
+	double mean;
+	double m2;		// Sum of squared differences from the mean (see die_stats_acc_variance).
+	double min;		// (INFINITY while empty).
+	double max;		// (-INFINITY while empty).
+
+	// Quantile sketch (internal).
+	double *levels;
+	unsigned level_count;
+	unsigned level_lengths[DIE_ACC_MAX_LEVELS];
+	uint64_t compaction_parity;
+};
+
+void die_stats_acc_init(struct die_stats_acc *acc);
+/* Set acc to an empty accumulator (doesn't allocate). */
+
+bool die_stats_acc_add(struct die_stats_acc *acc, double value);
+bool die_stats_acc_add_array(struct die_stats_acc *acc, const double *values, size_t count);
+/* Add value (or the count values), and return true if a memory allocation failed (the value is still
+ * in the mean and variance, but may be missing from the quantiles). */
+
+bool die_stats_acc_merge(struct die_stats_acc *acc, const struct die_stats_acc *other);
+/* Add the values of other to acc (as if they were added to it), leaving other as is.
+ * Accumulators of different threads may be merged this way once they're done.
+ * Return true if a memory allocation failed (like die_stats_acc_add). */
+
+double die_stats_acc_variance(const struct die_stats_acc *acc);
+/* Return the (population) variance of acc's values, or NaN if it's empty. */
+
+double die_stats_acc_quantile(const struct die_stats_acc *acc, double q);
+/* Return an estimate of the q quantile (0 <= q <= 1) of acc's values: q = 0.5 is the median, 0 the min
+ * and 1 the max (which are exact).
+ * Exact while there are fewer than DIE_ACC_LEVEL_SIZE values, otherwise the rank of the returned value
+ * is usually within 1% of q * count.
+ * Return NaN if acc is empty, q is out of range, or a memory allocation failed (for 0 < q < 1 also if acc
+ * was cleared, or an add failed before it had any values in memory). */
+
+void clear_die_stats_acc(struct die_stats_acc *acc);
+/* Free the memory of acc (it's then empty of values, but its statistics remain). */
+
+bool operate_accumulate(const struct Operation *operation, uint64_t trials, struct die_stats_acc *acc);
+/* Calculate operation trials times (ignoring its repetitions), adding the results to acc, without
+ * keeping them.
+ * Like operate_histogram, the trials are split between threads (each with an accumulator of its own,
+ * merged into acc at the end), and the dice are rolled with generators of their own.
+ *
+ * pre: get_slot_count(operation) == 0, acc was set by die_stats_acc_init.
+ * Return true if a memory allocation failed (acc then has none, some or all of the results). */
+
+
+/* -- Probabilities -- */
+
+#define DIE_DIST_MAX_SUPPORT (1 << 20)	// Default most values a distribution (of any part) may have.
+#define DIE_DIST_MAX_WORK (1 << 28)	// Most steps rolling dice, or pairs of integers combined by an operator.
+
+// The distribution of the results of an operation: values[i] has probability probabilities[i].
+struct die_distribution {
+	size_t length;
+	double *values;		// Sorted, without repetitions (NaN, if possible, is last).
+	double *probabilities;
+	double *cumulative;	// cumulative[i] is the sum of probabilities up to i (see die_dist_cdf).
+	// Probability moved by the limits, in [0, 1] (0 if the distribution is exact, see struct die_dist_limits).
+	// The parts' are combined as the probability that a value from either was moved: 1 - (1 - a)(1 - b).
+	double rebinned;	// Of values merged into bins (an upper bound).
+	double pruned;		// Of values dropped (the probabilities then sum to 1 - pruned).
+
+	// The arrays are in a mapped file if set (read-only, see op_distribution_cached).
+	void *mapping;
+	size_t mapping_size;
+};
+
+// How big distributions may get (for each part of the operation, not only the result).
+struct die_dist_limits {
+	size_t max_support;	// Consecutive values are merged into bins (at their mean) past this many.
+	double min_probability;	// Values less likely than this are dropped.
+};
+
+bool op_distribution(const struct Operation *operation, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist);
+/* Set *dist to the distribution of the results of operation (ignoring its repetitions), calculated
+ * without rolling: each part's distribution is combined with the next's by the operator between them,
+ * like operate would (dice are convolved, comparisons use cumulative probabilities, and any other
+ * operator goes over every pair of values).
+ *
+ * limits may be NULL for the defaults (max_support DIE_DIST_MAX_SUPPORT, no min_probability).
+ * Comparisons are linear in the values compared. Other operators count the pairs of integers (up to
+ * DIE_DIST_MAX_WORK of them) in an array indexed by value, and otherwise sort the pairs: if there would be
+ * more than 2^22 of those, the distributions are rebinned first regardless of limits.
+ * The mean is kept by rebinning (not by pruning), and dist->rebinned and dist->pruned tell how far
+ * off the distribution may be.
+ *
+ * pre: slot_values has at least get_slot_count(operation) elements (may be NULL if it's 0).
+ * post: dist is allocated (free with clear_die_distribution).
+ * Return true if dice have more than max_support possible sums (or too many to roll, see
+ * DIE_DIST_MAX_WORK), or a memory allocation failed (dist is then empty). */
+
+void clear_die_distribution(struct die_distribution *dist);
+/* Free the memory of dist. */
+
+#define DIE_CACHE_VERSION 2	// Version of the files written by op_distribution_cached.
+
+bool op_distribution_cached(const char *dir, const struct Operation *operation, const double *slot_values,
+		const struct die_dist_limits *limits, struct die_distribution *dist);
+/* Same as op_distribution, only the distribution is loaded from the cache directory dir (which must
+ * exist) if it was calculated before, and otherwise calculated and saved there, for later calls and
+ * other processes.
+ *
+ * Distributions are cached by the operation (as serialized by op_serialize, ignoring the repetitions like
+ * op_distribution, so "6x3d6" and "3d6" share a file), the slot values and the limits, in a file each
+ * (created with the umask's permissions). Loading maps the file (read-only), without copying or calculating anything,
+ * so a loaded dist must not be modified. Files are replaced atomically, so processes may share dir
+ * while others write to it. Files of another version (see DIE_CACHE_VERSION) or byte order are
+ * recalculated and replaced.
+ *
+ * Failing to save the distribution isn't an error (it's only calculated again next time). */
+
+double die_dist_cdf(const struct die_distribution *dist, double x);
+/* Return the probability that the result is at most x (NaN results never are), in O(log length). */
+
+double die_dist_quantile(const struct die_distribution *dist, double q);
+/* Return the q quantile of the results (0 <= q <= 1): the smallest value for which die_dist_cdf is at
+ * least q (the biggest value other than NaN if there's none, since values may have been pruned).
+ * O(log length). Return NaN if q is out of range or there are no values other than NaN. */
+
+double die_dist_sample(const struct die_distribution *dist);
+/* Return a random result (one of dist->values, by its probability out of the total probability of the
+ * values kept), by a binary search for a uniform random value (from rand(), like operate) in the
+ * cumulative probabilities. Return NaN if there are no values. */
+
+double op_probability_true(const struct Operation *operation);
+/* Return the probability that operation results in a true (non-zero) value, like a comparison being 1
+ * (eg. 0.55 for "d20+5>=15"), ignoring its repetitions.
+ *
+ * Calculated from the exact distribution of the result (see op_distribution), not by rolling.
+ *
+ * Return NaN if operation has placeholders, its distribution can't be calculated exactly with the
+ * default limits, or a memory allocation failed. */
+
+
+/* -- Approximations -- */
+
+#define DIE_APPROX_MAX_ERROR 0.01	// Most error_bound for which an approximation is preferred.
+#define DIE_APPROX_MIN_WORK (1 << 20)	// Fewest steps of an exact distribution for which it's preferred.
+
+// The normal approximation of an operation, corrected to its skewness and kurtosis (see op_normal_approx).
+struct die_normal_approx {
+	double mean;
+	double variance;
+	double skewness;
+	double excess_kurtosis;
+	double lattice;		// Results are lattice_base + k * lattice for integers k (lattice is 0 if unknown).
+	double lattice_base;
+	double error_bound;	// Bound on the error of the normal CDF (Berry-Esseen).
+	bool preferred;		// The exact distribution is costly, and error_bound <= DIE_APPROX_MAX_ERROR.
+};
+
+bool op_normal_approx(const struct Operation *operation, struct die_normal_approx *approx);
+/* Set *approx to an approximation of the distribution of the results of operation (ignoring its
+ * repetitions), found in time linear in its number of sections from the cumulants of each die.
+ * This is meant for giant pools (like "50000d20+30000d6"), whose exact distribution (see op_distribution)
+ * or rolling is costly.
+ *
+ * Only linear operations may be approximated: dice and numbers added or subtracted, or multiplied or
+ * divided by numbers (eg. "2*(10d6+d8)-5").
+ *
+ * approx->error_bound is a bound on the difference between the CDF of the normal distribution (of the
+ * same mean and variance) and the real one, which gets smaller with more dice. The skewness and
+ * kurtosis corrections (Edgeworth series) usually make the error of die_approx_cdf much smaller.
+ * approx->preferred is set if the approximation should be used instead of the exact distribution:
+ * its error_bound is at most DIE_APPROX_MAX_ERROR, and the exact distribution would take more than
+ * DIE_APPROX_MIN_WORK steps (or have more than DIE_DIST_MAX_SUPPORT values).
+ *
+ * Return true if operation isn't linear, has placeholders, or has no dice (of more than one side). */
+
+double die_approx_cdf(const struct die_normal_approx *approx, double x);
+/* Return the approximate probability that the result is at most x. */
+
+double die_approx_quantile(const struct die_normal_approx *approx, double q);
+/* Return the approximate q quantile of the results (0 < q < 1, NaN otherwise): the smallest result
+ * (lattice point, if there's a lattice) for which die_approx_cdf is at least q. */
+
+double die_approx_sample(const struct die_normal_approx *approx);
+/* Return a random result of the approximate distribution (the quantile of a uniform random value). */
+
+
+/* -- Asynchronous calculation -- */
+
+#define DIE_ASYNC_CAPACITY 1024	// Submissions (and completions waiting for die_reap) that may be queued.
+
+typedef void (*die_callback)(double result, void *userdata);
+
+bool die_submit(const struct Operation *operation, char *calc_string, short flags,
+		die_callback callback, void *userdata);
+/* Calculate operation like operate, without blocking the caller on big operations: they're queued to a
+ * pool of threads (started by the first call, see die_async_start), while small ones are calculated
+ * right away.
+ *
+ * pre:
+ * 	Same as operate, and operation (and calc_string) must stay valid until the result is delivered.
+ * 	callback is either NULL or a function that will be called with the result and userdata.
+ * post:
+ * 	If callback != NULL, it's called with the result (from the pool's threads, or the calling thread).
+ * 	Otherwise the result is queued for die_reap (see die_completion_fd).
+ *
+ * Returns true if the operation couldn't be queued (too many are queued, or the pool couldn't start). */
+
+bool die_async_start(unsigned threads);
+/* Start the thread pool used by die_submit with threads threads (the number of processors if 0).
+ * Does nothing if it's already running. Returns true on failure. */
+
+void die_async_stop();
+/* Wait for the queued operations and stop the thread pool (completions not reaped are dropped).
+ * Must not be called concurrently with die_submit. */
+
+int die_completion_fd();
+/* Return a file descriptor that's readable (for poll/epoll) while completions wait for die_reap,
+ * or -1 if the pool isn't running.
+ * It must only be read by die_reap. */
+
+struct die_completion {
+	double result;
+	void *userdata;
+};
+
+size_t die_reap(struct die_completion *completions, size_t max);
+/* Move up to max results of operations submitted without a callback into completions,
+ * and return how many were moved. Doesn't block. */
+
+
 void clear_operation_pointer(struct Operation *operation);
 /* Free memory associated with operation. */
 void clear_num_section(struct NumSection section);
@@ -15,5 +15,8 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 #include "list_defs.h"
+#include "alloc.h"
 
-list_def_funcs(char)
+#include <string.h>
+
+inline_list_def_funcs(char, char, CHAR_INLINE_COUNT)
@@ -15,11 +15,14 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
-/* Place to contain general lists generated from list.h.
+/* Place to contain general lists generated from list.h (or inline_list.h).
  * If a list is of type defined elsewhere in the program, it should be generated there and not here. */
 #pragma once
 
 #include "list/list.h"
+#include "inline_list.h"
 
-list_def_proto(char)
+// (Inline, see inline_list.h: operators of operations, which fit in the space of a pointer).
+#define CHAR_INLINE_COUNT 8
+inline_list_def_proto(char, char, CHAR_INLINE_COUNT)
 
@@ -17,6 +17,10 @@
 #include "libdie.h"
 #include "lassert.h"
 #include "string_ops.h"
+#include "stats.h"
+#include "alloc.h"
+
+#include <string.h>
 
 // Recursively does the parsing.
 bool exp_to_op_rec(struct Operation * const operation, char **dice_exp,
@@ -29,13 +33,29 @@ bool parse_num_section(struct NumSection *out, char **dice_exp,
 		struct Dierror_list *error_list);
 bool parse_operators(char * const out_operator, char **dice_exp, bool after_parenthesis_section,
 		struct Dierror_list *error_list);
+// Set *out_slot to the index of the placeholder name from start to end (excluded) in slot_names.
+// Return true if it isn't one of them.
+bool get_slot_name_index(const char *start, const char *end, unsigned *out_slot);
+// exp_to_op without the counters (see die_stats_snapshot).
+struct Operation* parse_dice_exp(char *dice_exp, struct Dierror **errors);
+// Parse the repetitions of the whole expression ("6x" in "6x4d6"), if they exist.
+bool parse_repetitions(unsigned *out_repetitions, char **dice_exp, struct Dierror_list *error_list);
 // Receive operator and return it's precedence.
 short get_operator_precedence(char operator);
+// Return the operator of the two chars of a comparison ("<=", ">=", "=="), or '\0' if they aren't one.
+char get_comparison_operator(const char *operator_section);
 // Allocate an operation and initialize it's content.
 struct Operation* make_operation(bool parenthesis);
 // Make an operation and add initial_num and initial_operator.
 struct Operation* make_operation_with_start(bool parenthesis,
 		char prefix, struct NumSection initial_num, char initial_operator);
+// Return true if operation may be calculated with integers without losing precision as double
+// (defined in parse_operation.c).
+bool is_exact_integer_operation(const struct Operation *operation);
+// Return the specialized evaluator for operation's shape, or NULL (defined in parse_operation.c).
+double (*get_shape_evaluator(const struct Operation *operation))(const struct Operation*);
+// Return true if operation exceeds the limits set by die_set_op_limits (defined in cost.c).
+bool exceeds_op_limits(const struct Operation *operation);
 
 // Return values of exp_to_op_rec
 #define ETOP__MEM_FAIL true
@@ -46,15 +66,19 @@ struct Operation* make_operation_with_start(bool parenthesis,
 #define PNS__NO_MEM_FAIL false
 
 // Legalparenthesis are treated like an operand, but are replaced by '*', (printing parenthesis is done with the flag in Operation).
-#define LEGAL_OPERANDS 			"+-/*%^"			// All legal operands
+#define LEGAL_OPERANDS 			"+-/*%^<>="			// All legal operands (see get_comparison_operator).
 #define LEGAL_PARENTHESIS_OPENING	"([{"				// (Update code below if adding parenthesis)
 #define LEGAL_PARENTHESIS_CLOSING	")]}"				// (especially parse_num_section).
 #define LEGAL_PARENTHESIS	 	LEGAL_PARENTHESIS_OPENING LEGAL_PARENTHESIS_CLOSING	// All legal parenthesis
 #define LEGAL_MODS LEGAL_OPERANDS LEGAL_PARENTHESIS	// All legal characters that are not a number/dice (not [d0-9.]).
 
+// Names of the placeholders, given to exp_to_op_named while it parses (see get_slot_name_index).
+static _Thread_local const char *const *slot_names = NULL;
+static _Thread_local size_t slot_name_count = 0;
+
 #define BELOW_MINIMAL_PRECEDENCE -1
-#define PLUS_MINUS_PERCEDENCE 0
-#define HIGHEST_PRECEDENCE 2
+#define PLUS_MINUS_PERCEDENCE 1
+#define HIGHEST_PRECEDENCE 3
 
 /* -- Other -- */
 
@@ -64,8 +88,10 @@ struct Operation* make_operation_with_start(bool parenthesis,
  * and the program will exit. */
 short get_operator_precedence(char operator)
 {
-	static const char operators_array[] =               { '+', '-', '*', '(', '/', '%', '^', '\0'};
-	static const short operator_precedence_array[] =    { 0,   0,   1,   1,   1,   1,   2 };
+	static const char operators_array[] =               { '<', '>', OPERATOR_LESS_EQUAL, OPERATOR_GREATER_EQUAL,
+								OPERATOR_EQUAL, '+', '-', '*', '(', '/', '%', '^', '\0'};
+	static const short operator_precedence_array[] =    { 0,   0,   0, 0,
+								0,   1,   1,   2,   2,   2,   2,   3 };
 
 	for(size_t i = 0; operators_array[i]; i++)
 		if(operator == operators_array[i])
@@ -73,6 +99,23 @@ short get_operator_precedence(char operator)
 	exit(1);	// Should never happen.
 }
 
+char get_comparison_operator(const char *operator_section)
+{
+	if(operator_section[1] != '=')
+		return '\0';
+
+	switch (operator_section[0]) {
+	case('<'):
+		return OPERATOR_LESS_EQUAL;
+	case('>'):
+		return OPERATOR_GREATER_EQUAL;
+	case('='):
+		return OPERATOR_EQUAL;
+	default:
+		return '\0';
+	}
+}
+
 /* -- Error handling -- */
 
 /* Add error to error list.
@@ -102,20 +145,23 @@ struct Operation* make_operation(bool parenthesis)
 	struct Operation *operation;
 
 	// Allocate it, then allocate the lists.
-	operation = malloc(sizeof(*operation));
+	operation = die_malloc(sizeof(*operation));
 	if(!operation)
 		return NULL;
 	if(NumSection_list_init(&operation->numbers)) {
-		free(operation);
+		die_free(operation);
 		return NULL;
 	}
 	if(char_list_init(&operation->operators)) {
 		NumSection_list_close(&operation->numbers, NULL);
-		free(operation);
+		die_free(operation);
 		return NULL;
 	}
 
 	operation->parenthesis = parenthesis;
+	operation->integral = false;
+	operation->repetitions = 1;
+	operation->evaluator = NULL;
 	return operation;
 }
 
@@ -176,6 +222,7 @@ struct Operation* make_operation_with_start(bool parenthesis, char prefix,
  *
  *		On error (other than memory failure) it is added to the list and *out is:
  *			If section is a num: the value is 0.
+ *			If section is a placeholder ('$' then index or name): the index is 0.
  *			If section is dice: each invalid number is set to 1.
  *			If section is operation (parenthesis): ... it is set by exp_to_op_rec and this function.
  */
@@ -222,6 +269,28 @@ bool parse_num_section(struct NumSection *out_section, char **dice_exp,
 		return PNS__NO_MEM_FAIL;
 	}
 
+	// If it's a placeholder, get the index (or the index of its name).
+	if(**dice_exp == '$') {
+		section_start = *dice_exp;
+		*dice_exp = get_next_in_chars(*dice_exp, LEGAL_MODS);
+
+		out_section->type = type_slot;
+		if(*dice_exp == section_start+1)	// Missing index.
+			invalid_char = true;
+		else if(section_start[1] < '0' || section_start[1] > '9')
+			invalid_char = get_slot_name_index(section_start+1, *dice_exp, &out_section->data.slot);
+		else
+			out_section->data.slot = str_section_to_unsigned(section_start+1, *dice_exp, &invalid_char);
+
+		if(invalid_char || out_section->data.slot >= DIE_MAX_SLOT_COUNT) {
+			out_section->data.slot = 0;
+			return (add_dierror(error_list, invalid_placeholder, section_start, *dice_exp))
+				? PNS__MEM_FAIL : PNS__NO_MEM_FAIL;
+		}
+
+		return PNS__NO_MEM_FAIL;
+	}
+
 	// Set section_start to start, and *dice_exp to either the end or 'd'.
 	section_start = *dice_exp;
 	*dice_exp = get_next_in_chars(*dice_exp, LEGAL_MODS "d");
@@ -298,9 +367,10 @@ bool parse_num_section(struct NumSection *out_section, char **dice_exp,
  *
  * If multiple operators are found, unless they're all minus, they're reported.
  *
- * To clarify, there are three legal states (in which no error is reported):
+ * To clarify, there are four legal states (in which no error is reported):
  * 	No operators (replaced with '*').
- * 	Single operator.
+ * 	Single operator (other than '=').
+ * 	Two chars of a comparison ("<=", ">=", "=="), replaced with their operator (see libdie.h).
  * 	Multiple minus operators.
  *
  * Simplest way to use this function is to meet it's requirements.
@@ -325,9 +395,11 @@ bool parse_operators(char *const out_operator, char **dice_exp, bool after_paren
 {
 	char *operator_section_start;
 	char *operator_section_ptr;
+	char comparison;
 
 	// Legal cases:					E.g.
 	// single operator, <section-end>		"+<section-end>"
+	// comparison, <section-end>			"<=<section-end>"
 	// Multiple minus, <section-end>		"----<section-end>"
 	// <section-end>				"<section-end>"
 	//
@@ -346,6 +418,9 @@ bool parse_operators(char *const out_operator, char **dice_exp, bool after_paren
 		lassert(after_parenthesis_section || equals_any(**dice_exp, LEGAL_PARENTHESIS),
 				ASSERT_LVL_PRETTY_FAST);
 		*out_operator = '*';	// (Replace parenthesis with '*').
+	} else if(*dice_exp == operator_section_start + 2
+			&& (comparison = get_comparison_operator(operator_section_start))) {
+		*out_operator = comparison;
 	} else if(*dice_exp != operator_section_start + 1) {	// Multiple operators.
 
 		// Check if only '-'.
@@ -363,12 +438,45 @@ bool parse_operators(char *const out_operator, char **dice_exp, bool after_paren
 
 	} else {	// Single operator.
 		*out_operator = *operator_section_start;
+		if(*out_operator == '=')	// (Only part of "==").
+			return add_dierror(error_list, invalid_operator, operator_section_start, *dice_exp);
 	}
 
 	return false;
 
 }
 
+/* Parse the repetitions at the start of the expression: a number followed by 'x'.
+ *
+ * If the expression doesn't start with digits followed by 'x', *out_repetitions is set to 1 and
+ * *dice_exp is unmodified. Otherwise *dice_exp is set after the 'x'.
+ * If the number is 0 or too big for an unsigned, an error is added and *out_repetitions is set to 1.
+ *
+ * Returns true if a memory allocation error occured. */
+bool parse_repetitions(unsigned *out_repetitions, char **dice_exp, struct Dierror_list *error_list)
+{
+	char *repetitions_end;
+	bool invalid_char;
+
+	*out_repetitions = 1;
+
+	repetitions_end = get_next_non_pchars(*dice_exp, "0123456789");
+	if(*repetitions_end != 'x' || repetitions_end == *dice_exp)
+		return false;
+
+	*out_repetitions = str_section_to_unsigned(*dice_exp, repetitions_end, &invalid_char);
+
+	// (Only digits were taken, so an invalid char means it's too big).
+	if(invalid_char || *out_repetitions == 0) {
+		*out_repetitions = 1;
+		if(add_dierror(error_list, (invalid_char) ? invalid_reps : zero_reps, *dice_exp, repetitions_end))
+			return true;
+	}
+
+	*dice_exp = repetitions_end + 1;
+	return false;
+}
+
 bool parse_prefix(char *const out_prefix, char **dice_exp, Dierror_list *error_list)
 {
 	char* prefix_start;
@@ -535,12 +643,27 @@ bool exp_to_op_rec(struct Operation * const operation, char **dice_exp,
 	return ETOP__NO_MEM_FAIL;
 }
 
-struct Operation* exp_to_op(char *dice_exp, struct Dierror **errors)
+bool get_slot_name_index(const char *start, const char *end, unsigned *out_slot)
+{
+	const size_t length = end - start;
+
+	for(size_t i = 0; i < slot_name_count; i++) {
+		if(strlen(slot_names[i]) == length && memcmp(slot_names[i], start, length) == 0) {
+			*out_slot = (i < DIE_MAX_SLOT_COUNT) ? i : DIE_MAX_SLOT_COUNT;	// (Invalid if too far).
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct Operation* parse_dice_exp(char *dice_exp, struct Dierror **errors)
 {
 	lassert(dice_exp != NULL, ASSERT_LVL_FAST);
 
 	struct Operation *ret;
 	struct Dierror_list error_list;
+	unsigned repetitions;
 
 	// Initialize error list.
 	if(Dierror_list_init(&error_list)) {
@@ -548,6 +671,10 @@ struct Operation* exp_to_op(char *dice_exp, struct Dierror **errors)
 		return NULL;
 	}
 
+	// Get the repetitions of the whole expression if they're given.
+	if(parse_repetitions(&repetitions, &dice_exp, &error_list))
+		goto memory_failed__close_error_list;
+
 	// Check if dice_exp is empty.
 	if(*dice_exp == '\0') {
 		if(add_dierror(&error_list, empty_expression, NULL, NULL) ||
@@ -579,7 +706,21 @@ struct Operation* exp_to_op(char *dice_exp, struct Dierror **errors)
 		return NULL;
 	}
 
-	// All good, free the error buffer and return.
+	// Reject it if it's too costly to calculate (before anything is rolled).
+	ret->repetitions = repetitions;
+	if(exceeds_op_limits(ret)) {
+		clear_operation_pointer(ret);
+		if(add_dierror(&error_list, exceeds_limits, NULL, NULL) ||
+				add_dierror(&error_list, end_of_list, NULL, NULL) ||
+				(*errors = Dierror_list_to_array(&error_list)) == NULL)
+			goto memory_failed__close_error_list;
+		return NULL;
+	}
+
+	// All good, decide how to calculate it, free the error buffer and return.
+	ret->integral = is_exact_integer_operation(ret);
+	ret->evaluator = get_shape_evaluator(ret);
+
 	Dierror_list_close(&error_list, NULL);
 	*errors = NULL;
 	return ret;
@@ -590,3 +731,35 @@ memory_failed__close_error_list:
 	return NULL;
 }
 
+struct Operation* exp_to_op(char *dice_exp, struct Dierror **errors)
+{
+	struct Operation *ret;
+
+	STAT_TIMER_START(timer);
+	STAT_ADD(exp_to_op_calls, 1);
+
+	ret = parse_dice_exp(dice_exp, errors);
+
+#ifdef LIBDIE_STATS
+	if(!ret && *errors)
+		for(const struct Dierror *error = *errors; error->type != end_of_list; error++)
+			STAT_ADD(parse_errors[error->type], 1);
+#endif
+
+	STAT_TIMER_STOP(timer, exp_to_op_cycles);
+	return ret;
+}
+
+struct Operation* exp_to_op_named(char *dice_exp, const char *const *names, size_t name_count,
+		struct Dierror **errors)
+{
+	struct Operation *ret;
+
+	slot_names = names;
+	slot_name_count = name_count;
+	ret = exp_to_op(dice_exp, errors);
+	slot_names = NULL;
+	slot_name_count = 0;
+
+	return ret;
+}
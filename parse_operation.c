@@ -17,24 +17,63 @@
 #include "libdie.h"
 #include "lassert.h"
 #include "string_ops.h"
+#include "stats.h"
+#include "rng.h"
+#include "dice_tables.h"
 
 #include <limits.h>
+#include <float.h>
 #include <math.h>
+#include <inttypes.h>
 
 /* Prototypes */
 
 // For calculating an operation:
 
+// Calculate the operation once, moving *calc_string (if not NULL) to the '\0' written after it.
+double operate_move(const struct Operation *operation, char **calc_string, short flags);
 // Recursively converts the operation.
-double operate_rec(const struct Operation *operation, char **calc_string, short flags);
+double operate_rec(const struct Operation *operation, char **calc_string, short flags,
+		const double *slot_values);
 // Do a calculation on 2 values.
 double binary_calc(double val1, char operand, double val2);
-double calc_section(struct NumSection section, char **calc_string, short flags);
-double roll_dice(struct Die die, char **calc_string, short flags);
+// Write operand to *calc_string as it's written in the expression, moving *calc_string after it.
+void write_operator(char **calc_string, char operand);
+double calc_section(struct NumSection section, char **calc_string, short flags, const double *slot_values);
+int64_t roll_dice(struct Die die, char **calc_string, short flags);
 // See collapse flag in header.
-int roll_nocollapse(struct Die die, char **calc_string);
+int64_t roll_nocollapse(struct Die die, char **calc_string);
 // Self explanatory.
-int just_roll(struct Die die);
+int64_t just_roll(struct Die die);
+// Roll die into each of count lanes (see operate_batch).
+void just_roll_lanes(struct Die die, double *lanes, size_t count);
+
+// For calculating an integer operation (see operate_i64 in header):
+
+// Recursively converts the operation, setting *overflow on overflow.
+int64_t operate_rec_i64(const struct Operation *operation, char **calc_string, short flags, bool *overflow);
+// Integer equivalent of binary_calc.
+int64_t binary_calc_i64(int64_t val1, char operand, int64_t val2, bool *overflow);
+int64_t calc_section_i64(struct NumSection section, char **calc_string, short flags, bool *overflow);
+
+// Specialized evaluators for common shapes (see evaluator in struct Operation):
+
+// "NdS"
+double evaluate_die(const struct Operation *operation);
+// "NdS+K" or "NdS-K"
+double evaluate_die_num(const struct Operation *operation);
+// "NdS+MdT+K" (with any of the operators being '-')
+double evaluate_die_die_num(const struct Operation *operation);
+// Return the evaluator fitting operation, or NULL if there isn't one.
+double (*get_shape_evaluator(const struct Operation *operation))(const struct Operation*);
+
+// To analyze an operation:
+
+// Get the range of an operation that may be calculated with integers.
+bool get_integer_range(const struct Operation *operation, double limit, double *min, double *max);
+// Get the range of `val1 operator val2` from the ranges of the values.
+bool combine_integer_ranges(double *min, double *max, char operator, double sec_min, double sec_max);
+bool get_section_integer_range(struct NumSection section, double limit, double *min, double *max);
 
 // To calculate the maximum buffer length needed by operate:
 
@@ -48,44 +87,64 @@ size_t int_req_digits(int num);
 
 // The number of maximum digits displayed after the dot.
 #define NUM_PRECISION 4
+// The maximum length of a double as a string: sign, digits, dot and digits after the dot.
+#define MAX_DOUBLE_STRING_LENGTH (1 + (DBL_MAX_10_EXP + 1) + 1 + NUM_PRECISION)
 
 // Internal flag for operate functions.
 #define HIGHER_OPERAND (1<<1)
 
+// (inline alone is only a hint).
+#if defined(__GNUC__) || defined(__clang__)
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define ALWAYS_INLINE inline
+#endif
+
 // To reduce code duplication:
-#define ROLL_D(sides) (rand() % (sides) + 1)
+// rng is active_rng (loaded once by the caller), rand() is used if it's NULL.
+#define ROLL_D(rng, sides) ((rng) ? rng_roll((rng), (sides)) : rand() % (sides) + 1)
+// Count the dice rolled, and the first random number drawn for each (rng_roll counts the draws it rejects).
+#define COUNT_ROLLS(reps) do {				\
+	STAT_ADD(dice_rolled, (reps));			\
+	STAT_ADD(rng_draws, (reps));			\
+} while(0)
+
 
 
 /* -- Functions used for the calculation -- */
 
-int just_roll(struct Die die)
+/* Rolling functions used by just_roll and roll_nocollapse.
+ * They're always inlined (by GCC and Clang, see ALWAYS_INLINE), so when sides is a constant
+ * the compiler sees it. */
+
+static ALWAYS_INLINE int64_t just_roll_sides(unsigned reps, const int sides)
 {
-	unsigned reps;
-	int ret;
+	struct die_rng *const rng = active_rng;
+	int64_t ret;
 
+	COUNT_ROLLS(reps);
 	ret = 0;
-	reps = die.repetitions;
 
 	while(reps-- > 0)
-		ret += ROLL_D(die.sides);
+		ret += ROLL_D(rng, sides);
 
 	return ret;
 }
 
-// (See COLLAPSE_DICE flag in header)
-int roll_nocollapse(struct Die die, char **calc_string)
+static ALWAYS_INLINE int64_t roll_nocollapse_sides(unsigned reps, const int sides, char **calc_string)
 {
+	struct die_rng *const rng = active_rng;
 	int roll;
-	int ret;
-	unsigned reps;
+	int64_t ret;
+
+	COUNT_ROLLS(reps);
 
-	roll = ROLL_D(die.sides);
+	roll = ROLL_D(rng, sides);
 	sprintf_move(calc_string, "%d", roll);
 	ret = roll;
 
-	reps = die.repetitions;
 	while(reps-- > 1) {
-		roll = ROLL_D(die.sides);
+		roll = ROLL_D(rng, sides);
 		sprintf_move(calc_string, "+%d", roll);
 		ret += roll;
 	}
@@ -93,19 +152,76 @@ int roll_nocollapse(struct Die die, char **calc_string)
 	return ret;
 }
 
-double roll_dice(struct Die die, char **calc_string, short flags)
+// Define just_roll_d<sides> and roll_nocollapse_d<sides> for each of STANDARD_SIDES (see dice_tables.h),
+// where the sides are a constant so the compiler may replace the division by a multiplication.
+#define DEF_SIDES_ROLLERS(sides)							\
+	int64_t just_roll_d##sides(unsigned reps)					\
+	{										\
+		return just_roll_sides(reps, sides);					\
+	}										\
+	int64_t roll_nocollapse_d##sides(unsigned reps, char **calc_string)		\
+	{										\
+		return roll_nocollapse_sides(reps, sides, calc_string);		\
+	}
+STANDARD_SIDES(DEF_SIDES_ROLLERS)
+#undef DEF_SIDES_ROLLERS
+
+int64_t just_roll(struct Die die)
+{
+	switch (die.sides) {
+#define CASE_JUST_ROLL(sides) case(sides): return just_roll_d##sides(die.repetitions);
+	STANDARD_SIDES(CASE_JUST_ROLL)
+#undef CASE_JUST_ROLL
+
+	default:
+		return just_roll_sides(die.repetitions, die.sides);
+	}
+}
+
+/* Set each of the count lanes to a roll of die (see operate_batch).
+ * The sides are checked once for all the lanes. */
+void just_roll_lanes(struct Die die, double *lanes, size_t count)
+{
+	switch (die.sides) {
+#define CASE_JUST_ROLL_LANES(sides) case(sides):			\
+		for(size_t i = 0; i < count; i++)			\
+			lanes[i] = just_roll_sides(die.repetitions, sides);	\
+		return;
+	STANDARD_SIDES(CASE_JUST_ROLL_LANES)
+#undef CASE_JUST_ROLL_LANES
+
+	default:
+		for(size_t i = 0; i < count; i++)
+			lanes[i] = just_roll_sides(die.repetitions, die.sides);
+	}
+}
+
+// (See COLLAPSE_DICE flag in header)
+int64_t roll_nocollapse(struct Die die, char **calc_string)
+{
+	switch (die.sides) {
+#define CASE_ROLL_NOCOLLAPSE(sides) case(sides): return roll_nocollapse_d##sides(die.repetitions, calc_string);
+	STANDARD_SIDES(CASE_ROLL_NOCOLLAPSE)
+#undef CASE_ROLL_NOCOLLAPSE
+
+	default:
+		return roll_nocollapse_sides(die.repetitions, die.sides, calc_string);
+	}
+}
+
+int64_t roll_dice(struct Die die, char **calc_string, short flags)
 {
 	lassert(die.repetitions != 0, ASSERT_LVL_FAST);
 
-	int rolls;
+	int64_t rolls;
 
 	if(calc_string == NULL)
-		return (double) just_roll(die);
+		return just_roll(die);
 
 	if(die.repetitions == 1 || (flags & HIGHER_OPERAND && flags & COLLAPSE_DICE)) {
 		rolls = just_roll(die);
-		sprintf_move(calc_string, "%d", rolls);
-		return (double) rolls;
+		sprintf_move(calc_string, "%" PRId64, rolls);
+		return rolls;
 	}
 
 	if(flags & HIGHER_OPERAND)
@@ -114,11 +230,12 @@ double roll_dice(struct Die die, char **calc_string, short flags)
 	if(flags & HIGHER_OPERAND)
 		*((*calc_string)++) = ')';
 
-	return (double) rolls;
+	return rolls;
 }
 
 
-double calc_section(const struct NumSection section, char **calc_string, short flags)
+double calc_section(const struct NumSection section, char **calc_string, short flags,
+		const double *slot_values)
 {
 	switch (section.type) {
 	case(type_num):
@@ -126,10 +243,15 @@ double calc_section(const struct NumSection section, char **calc_string, short f
 			*calc_string = stringify_double(section.data.num, NUM_PRECISION, *calc_string);
 		return section.data.num;
 	case(type_die):
-		return roll_dice(section.data.die, calc_string, flags);
+		return (double) roll_dice(section.data.die, calc_string, flags);
 	case(type_op):
-		return operate_rec(section.data.operation, calc_string, flags);
-		
+		return operate_rec(section.data.operation, calc_string, flags, slot_values);
+	case(type_slot):
+		lassert(slot_values != NULL, ASSERT_LVL_FAST);
+		if(calc_string != NULL)
+			*calc_string = stringify_double(slot_values[section.data.slot], NUM_PRECISION, *calc_string);
+		return slot_values[section.data.slot];
+
 	default:
 		exit(1);	// Should never happen.
 	}
@@ -152,13 +274,43 @@ double binary_calc(double val1, char operand, double val2)
 		return fmod(val1, val2);
 	case('^'):
 		return pow(val1, val2);
+	case('<'):
+		return val1 < val2;
+	case('>'):
+		return val1 > val2;
+	case(OPERATOR_LESS_EQUAL):
+		return val1 <= val2;
+	case(OPERATOR_GREATER_EQUAL):
+		return val1 >= val2;
+	case(OPERATOR_EQUAL):
+		return val1 == val2;
 		
 	default:
 		exit(1);	// Should never happen.
 	}
 }
 
-double operate_rec(const struct Operation *operation, char **calc_string, short flags)
+void write_operator(char **calc_string, char operand)
+{
+	switch (operand) {
+	case(OPERATOR_LESS_EQUAL):
+		*((*calc_string)++) = '<';
+		break;
+	case(OPERATOR_GREATER_EQUAL):
+		*((*calc_string)++) = '>';
+		break;
+	case(OPERATOR_EQUAL):
+		*((*calc_string)++) = '=';
+		break;
+	default:
+		*((*calc_string)++) = operand;
+		return;
+	}
+	*((*calc_string)++) = '=';
+}
+
+double operate_rec(const struct Operation *operation, char **calc_string, short flags,
+		const double *slot_values)
 {
 	
 	char_iterator operand_ite = get_char_list_iterator(&operation->operators);
@@ -181,7 +333,7 @@ double operate_rec(const struct Operation *operation, char **calc_string, short
 
 	// Get first operator. If it doesn't exist, we have 1 section.
 	if(char_list_get(&operand_ite, &operation->operators, &operand)) {
-		ret = calc_section(section, calc_string, flags);
+		ret = calc_section(section, calc_string, flags, slot_values);
 		if(calc_string && operation->parenthesis)
 			*((*calc_string)++) = ')';
 		return (operation->prefix == '-') ? -ret : ret;
@@ -190,9 +342,9 @@ double operate_rec(const struct Operation *operation, char **calc_string, short
 	// If the section is a die, then we care if the precedence is higher than +-.
 	// Pass internal flag to indicate it.
 	if(section.type == type_die && ((operand != '+' && operand != '-')))
-		ret = calc_section(section, calc_string, flags | HIGHER_OPERAND);
+		ret = calc_section(section, calc_string, flags | HIGHER_OPERAND, slot_values);
 	else
-		ret = calc_section(section, calc_string, flags);
+		ret = calc_section(section, calc_string, flags, slot_values);
 	if(operation->prefix == '-')
 		ret = -ret;
 
@@ -203,29 +355,29 @@ double operate_rec(const struct Operation *operation, char **calc_string, short
 	while(!char_list_get(&operand_ite, &operation->operators, &next_operand)) {
 
 		if(calc_string)
-			*((*calc_string)++) = operand;	// add the operand.
+			write_operator(calc_string, operand);	// add the operand.
 
 		// Get next section and calculate it.
 		NumSection_list_get(&sec_ite, &operation->numbers, &section);
 
 		if(section.type == type_die &&
 				((operand != '+' && operand != '-') || (next_operand != '+' && next_operand != '-')))
-			next_value = calc_section(section, calc_string, flags | HIGHER_OPERAND);
+			next_value = calc_section(section, calc_string, flags | HIGHER_OPERAND, slot_values);
 		else
-			next_value = calc_section(section, calc_string, flags);
+			next_value = calc_section(section, calc_string, flags, slot_values);
 
 		ret = binary_calc(ret, operand, next_value);
 		operand = next_operand;
 	}
 
 	if(calc_string)
-		*((*calc_string)++) = operand;
+		write_operator(calc_string, operand);
 
 	NumSection_list_get(&sec_ite, &operation->numbers, &section);
 	if(section.type == type_die && ((operand != '+' && operand != '-')))
-		next_value = calc_section(section, calc_string, flags | HIGHER_OPERAND);
+		next_value = calc_section(section, calc_string, flags | HIGHER_OPERAND, slot_values);
 	else
-		next_value = calc_section(section, calc_string, flags);
+		next_value = calc_section(section, calc_string, flags, slot_values);
 
 	ret = binary_calc(ret, operand, next_value);
 
@@ -235,20 +387,332 @@ double operate_rec(const struct Operation *operation, char **calc_string, short
 	return ret;
 }
 
+double operate_move(const struct Operation *operation, char **calc_string, short flags)
+{
+	double ret;
+	bool overflow;
+
+	STAT_TIMER_START(timer);
+	STAT_ADD(operate_calls, 1);
+
+	if(!calc_string && operation->evaluator) {
+		ret = operation->evaluator(operation);
+		STAT_TIMER_STOP(timer, operate_cycles);
+		return ret;
+	}
+
+	const char *const calc_string_start = (calc_string) ? *calc_string : NULL;
+
+	// Every value of an integral operation is exact as a double, so the integer path
+	// gives the same result.
+	if(operation->integral) {
+		overflow = false;
+		ret = (double) operate_rec_i64(operation, calc_string, flags, &overflow);
+	} else {
+		ret = operate_rec(operation, calc_string, flags, NULL);
+	}
+
+	if(calc_string) {
+		**calc_string = '\0';
+		STAT_ADD(calc_string_bytes, *calc_string - calc_string_start);
+	}
+
+	STAT_TIMER_STOP(timer, operate_cycles);
+	return ret;
+}
+
 /* operate - calculate operation with the dice rolled.
  *
  * calc_string_buf - is a buffer to contain the calculation, the length
  * should be received from get_operation_calc_string_len. */
 double operate(const struct Operation *operation, char *calc_string, short flags)
+{
+	return operate_move(operation, (calc_string) ? &calc_string : NULL, flags);
+}
+
+void operate_repeat(const struct Operation *operation, double *results,
+		char *calc_string, size_t *calc_string_offsets, short flags)
+{
+	char *calc_string_ptr;
+	unsigned i;
+
+	if(!calc_string) {
+		for(i = 0; i < operation->repetitions; i++)
+			results[i] = operate_move(operation, NULL, flags);
+		return;
+	}
+
+	// Write each string right after the '\0' of the last.
+	calc_string_ptr = calc_string;
+	for(i = 0; i < operation->repetitions; i++) {
+		calc_string_offsets[i] = calc_string_ptr - calc_string;
+		results[i] = operate_move(operation, &calc_string_ptr, flags);
+		calc_string_ptr++;
+	}
+}
+
+double operate_bound(const struct Operation *operation, const double *values, char *calc_string, short flags)
 {
 	double ret;
+	const char *const calc_string_start = calc_string;
+
+	STAT_TIMER_START(timer);
+	STAT_ADD(operate_calls, 1);
 
 	if(calc_string) {
-		ret = operate_rec(operation, &calc_string, flags);
+		ret = operate_rec(operation, &calc_string, flags, values);
 		*calc_string = '\0';
+		STAT_ADD(calc_string_bytes, calc_string - calc_string_start);
 	} else
-		ret = operate_rec(operation, NULL, flags);
+		ret = operate_rec(operation, NULL, flags, values);
 
+	STAT_TIMER_STOP(timer, operate_cycles);
+	return ret;
+}
+
+
+double operate_token(const struct Operation *operation, struct die_token *token)
+{
+	struct die_rng rng;
+	struct die_rng *const previous_rng = active_rng;
+	double ret;
+
+	next_token(token);
+	rng_seed(&rng, token->seed, token->stream);
+
+	active_rng = &rng;
+	ret = operate_move(operation, NULL, NO_FLAG);
+	active_rng = previous_rng;
+
+	return ret;
+}
+
+double die_replay_calc_string(const struct Operation *operation, const struct die_token *token,
+		char *calc_string, short flags)
+{
+	struct die_rng rng;
+	struct die_rng *const previous_rng = active_rng;
+	double ret;
+
+	rng_seed(&rng, token->seed, token->stream);
+
+	active_rng = &rng;
+	ret = operate(operation, calc_string, flags);
+	active_rng = previous_rng;
+
+	return ret;
+}
+
+/* -- Specialized evaluators -- */
+
+/* Each evaluator assumes the shape was checked by get_shape_evaluator, and rolls the dice
+ * in the same order as operate_rec (so results are the same for the same rand seed). */
+
+double evaluate_die(const struct Operation *operation)
+{
+	return (double) just_roll(NumSection_list_get_index(&operation->numbers, 0).data.die);
+}
+
+double evaluate_die_num(const struct Operation *operation)
+{
+	const double rolls = (double) just_roll(NumSection_list_get_index(&operation->numbers, 0).data.die);
+	const double num = NumSection_list_get_index(&operation->numbers, 1).data.num;
+
+	return (char_list_get_index(&operation->operators, 0) == '+') ? rolls + num : rolls - num;
+}
+
+double evaluate_die_die_num(const struct Operation *operation)
+{
+	double ret;
+	double rolls;
+
+	ret = (double) just_roll(NumSection_list_get_index(&operation->numbers, 0).data.die);
+
+	rolls = (double) just_roll(NumSection_list_get_index(&operation->numbers, 1).data.die);
+	ret = (char_list_get_index(&operation->operators, 0) == '+') ? ret + rolls : ret - rolls;
+
+	rolls = NumSection_list_get_index(&operation->numbers, 2).data.num;
+	return (char_list_get_index(&operation->operators, 1) == '+') ? ret + rolls : ret - rolls;
+}
+
+double (*get_shape_evaluator(const struct Operation *operation))(const struct Operation*)
+{
+	static const unsigned shape_types[][3] = {
+		{ type_die },
+		{ type_die, type_num },
+		{ type_die, type_die, type_num },
+	};
+	static double (*const shape_evaluators[])(const struct Operation*) = {
+		evaluate_die,
+		evaluate_die_num,
+		evaluate_die_die_num,
+	};
+
+	const size_t length = NumSection_list_length(&operation->numbers);
+	size_t i;
+
+	if(operation->prefix == '-' || length > sizeof(shape_types)/sizeof(*shape_types))
+		return NULL;
+
+	for(i = 0; i < length; i++) {
+		if(NumSection_list_get_index(&operation->numbers, i).type != shape_types[length-1][i])
+			return NULL;
+		if(i != 0 && !equals_any(char_list_get_index(&operation->operators, i-1), "+-"))
+			return NULL;
+	}
+
+	return shape_evaluators[length-1];
+}
+
+/* -- Functions used for integer calculation -- */
+
+int64_t calc_section_i64(const struct NumSection section, char **calc_string, short flags, bool *overflow)
+{
+	switch (section.type) {
+	case(type_num):
+		if(calc_string != NULL)
+			sprintf_move(calc_string, "%" PRId64, (int64_t) section.data.num);
+		return (int64_t) section.data.num;
+	case(type_die):
+		return roll_dice(section.data.die, calc_string, flags);
+	case(type_op):
+		return operate_rec_i64(section.data.operation, calc_string, flags, overflow);
+
+	default:	// (Including type_slot, which is never an integer operation).
+		exit(1);	// Should never happen.
+	}
+}
+
+/* Integer equivalent of binary_calc, operand must be one of "+-*%" or a comparison.
+ * On overflow (or modulo by 0), *overflow is set to true and the return value is unspecified. */
+int64_t binary_calc_i64(int64_t val1, char operand, int64_t val2, bool *overflow)
+{
+	int64_t ret;
+
+	switch (operand) {
+	case('+'):
+		if(__builtin_add_overflow(val1, val2, &ret))
+			*overflow = true;
+		return ret;
+	case('-'):
+		if(__builtin_sub_overflow(val1, val2, &ret))
+			*overflow = true;
+		return ret;
+	case('*'):
+		if(__builtin_mul_overflow(val1, val2, &ret))
+			*overflow = true;
+		return ret;
+	case('%'):
+		if(val2 == 0 || (val2 == -1 && val1 == INT64_MIN)) {
+			*overflow = true;
+			return 0;
+		}
+		return val1 % val2;	// (Same sign as val1, like fmod).
+	case('<'):
+		return val1 < val2;
+	case('>'):
+		return val1 > val2;
+	case(OPERATOR_LESS_EQUAL):
+		return val1 <= val2;
+	case(OPERATOR_GREATER_EQUAL):
+		return val1 >= val2;
+	case(OPERATOR_EQUAL):
+		return val1 == val2;
+
+	default:
+		exit(1);	// Should never happen.
+	}
+}
+
+/* Same as operate_rec, only with integers. */
+int64_t operate_rec_i64(const struct Operation *operation, char **calc_string, short flags, bool *overflow)
+{
+	char_iterator operand_ite = get_char_list_iterator(&operation->operators);
+	NumSection_iterator sec_ite = get_NumSection_list_iterator(&operation->numbers);
+
+	char operand;
+	char next_operand;
+	struct NumSection section;
+	int64_t ret;
+	int64_t next_value;
+
+	if(calc_string) {
+		if(operation->parenthesis)
+			*((*calc_string)++) = '(';
+		if(operation->prefix == '-')
+			*((*calc_string)++) = '-';
+	}
+
+	NumSection_list_get(&sec_ite, &operation->numbers, &section);
+
+	// Get first operator. If it doesn't exist, we have 1 section.
+	if(char_list_get(&operand_ite, &operation->operators, &operand)) {
+		ret = calc_section_i64(section, calc_string, flags, overflow);
+		if(calc_string && operation->parenthesis)
+			*((*calc_string)++) = ')';
+		return (operation->prefix == '-') ? binary_calc_i64(0, '-', ret, overflow) : ret;
+	}
+
+	if(section.type == type_die && ((operand != '+' && operand != '-')))
+		ret = calc_section_i64(section, calc_string, flags | HIGHER_OPERAND, overflow);
+	else
+		ret = calc_section_i64(section, calc_string, flags, overflow);
+	if(operation->prefix == '-')
+		ret = binary_calc_i64(0, '-', ret, overflow);
+
+	// (See operate_rec).
+	while(!char_list_get(&operand_ite, &operation->operators, &next_operand)) {
+
+		if(calc_string)
+			write_operator(calc_string, operand);
+
+		NumSection_list_get(&sec_ite, &operation->numbers, &section);
+
+		if(section.type == type_die &&
+				((operand != '+' && operand != '-') || (next_operand != '+' && next_operand != '-')))
+			next_value = calc_section_i64(section, calc_string, flags | HIGHER_OPERAND, overflow);
+		else
+			next_value = calc_section_i64(section, calc_string, flags, overflow);
+
+		ret = binary_calc_i64(ret, operand, next_value, overflow);
+		operand = next_operand;
+	}
+
+	if(calc_string)
+		write_operator(calc_string, operand);
+
+	NumSection_list_get(&sec_ite, &operation->numbers, &section);
+	if(section.type == type_die && ((operand != '+' && operand != '-')))
+		next_value = calc_section_i64(section, calc_string, flags | HIGHER_OPERAND, overflow);
+	else
+		next_value = calc_section_i64(section, calc_string, flags, overflow);
+
+	ret = binary_calc_i64(ret, operand, next_value, overflow);
+
+	if(calc_string && operation->parenthesis)
+		*((*calc_string)++) = ')';
+
+	return ret;
+}
+
+int64_t operate_i64(const struct Operation *operation, char *calc_string, short flags, bool *overflow)
+{
+	int64_t ret;
+	const char *const calc_string_start = calc_string;
+
+	*overflow = false;
+
+	STAT_TIMER_START(timer);
+	STAT_ADD(operate_calls, 1);
+
+	if(calc_string) {
+		ret = operate_rec_i64(operation, &calc_string, flags, overflow);
+		*calc_string = '\0';
+		STAT_ADD(calc_string_bytes, calc_string - calc_string_start);
+	} else
+		ret = operate_rec_i64(operation, NULL, flags, overflow);
+
+	STAT_TIMER_STOP(timer, operate_cycles);
 	return ret;
 }
 
@@ -314,6 +778,8 @@ size_t get_section_calc_string_length(const struct NumSection section)
 			+ section.data.die.repetitions -1;	// The operators.
 	case(type_op):
 		return get_calc_string_length_rec(section.data.operation);
+	case(type_slot):
+		return MAX_DOUBLE_STRING_LENGTH;	// The value isn't known yet.
 
 	default:
 		exit(1);	// Should never happen.
@@ -330,8 +796,12 @@ size_t get_calc_string_length_rec(const struct Operation *operation)
 	char operator, next_operator;
 	struct NumSection section;
 
-	// Count the operators.
+	// Count the operators (comparisons other than '<' and '>' take two chars).
 	length = char_list_length(&operation->operators);
+	operator_ite = get_char_list_iterator(&operation->operators);
+	while(!char_list_get(&operator_ite, &operation->operators, &operator))
+		if(operator == OPERATOR_LESS_EQUAL || operator == OPERATOR_GREATER_EQUAL || operator == OPERATOR_EQUAL)
+			++length;
 
 	// Check prefix and parenthesis.
 	if(operation->prefix == '-')
@@ -381,8 +851,202 @@ size_t get_calc_string_length(const struct Operation *operation)
 		+ 1;	// (To account for '\0')
 }
 
+size_t get_repeat_calc_string_length(const struct Operation *operation)
+{
+	const size_t length = get_calc_string_length(operation);
+
+	// (Saturated, so a buffer can't be sized by a wrapped around length).
+	if(length > SIZE_MAX / operation->repetitions)
+		return SIZE_MAX;
+	return length * operation->repetitions;
+}
+
+/* -- Integer analysis -- */
+
+// Literals must be below this (absolute) to be converted to int64_t.
+#define INT64_LIMIT 0x1p63
+// Values in [-DOUBLE_EXACT_LIMIT, DOUBLE_EXACT_LIMIT] are exactly representable as double.
+#define DOUBLE_EXACT_LIMIT 0x1p53
+
+bool get_section_integer_range(const struct NumSection section, double limit, double *min, double *max)
+{
+	switch (section.type) {
+	case(type_num):
+		if(section.data.num != floor(section.data.num) || fabs(section.data.num) >= INT64_LIMIT)
+			return false;
+		*min = *max = section.data.num;
+		return true;
+	case(type_die):
+		*min = section.data.die.repetitions;
+		*max = (double) section.data.die.repetitions * section.data.die.sides;
+		return true;
+	case(type_op):
+		return get_integer_range(section.data.operation, limit, min, max);
+	case(type_slot):
+		return false;	// May be bound to anything.
+
+	default:
+		exit(1);	// Should never happen.
+	}
+}
+
+/* If operation may be calculated with integers (only integer literals, operators in "+-*%" and comparisons),
+ * and no value in the calculation (including intermediate ones) may exceed [-limit, limit],
+ * return true and set *min and *max to the (inclusive) bounds of the result.
+ * Otherwise return false.
+ *
+ * The bounds are calculated with doubles, so they're approximate when beyond DOUBLE_EXACT_LIMIT. */
+bool get_integer_range(const struct Operation *operation, double limit, double *min, double *max)
+{
+	NumSection_iterator section_ite;
+	char_iterator operator_ite;
+
+	struct NumSection section;
+	char operator;
+	double sec_min, sec_max;
+
+	section_ite = get_NumSection_list_iterator(&operation->numbers);
+	operator_ite = get_char_list_iterator(&operation->operators);
+
+	NumSection_list_get(&section_ite, &operation->numbers, &section);
+	if(!get_section_integer_range(section, limit, min, max))
+		return false;
+
+	if(operation->prefix == '-') {
+		sec_min = *min;
+		*min = -*max;
+		*max = -sec_min;
+	}
+
+	while(!char_list_get(&operator_ite, &operation->operators, &operator)) {
+		NumSection_list_get(&section_ite, &operation->numbers, &section);
+		if(!get_section_integer_range(section, limit, &sec_min, &sec_max)
+				|| !combine_integer_ranges(min, max, operator, sec_min, sec_max))
+			return false;
+
+		if(*min < -limit || *max > limit)
+			return false;
+	}
+
+	return *min >= -limit && *max <= limit;
+}
+
+/* Set [*min, *max] to the range of `val1 operator val2`, where val1 is in [*min, *max] and val2 in
+ * [sec_min, sec_max]. Return false if operator isn't an integer one, or the result may be undefined. */
+bool combine_integer_ranges(double *min, double *max, char operator, double sec_min, double sec_max)
+{
+	double products[4];
+	double modulo_max;
+
+	switch (operator) {
+	case('+'):
+		*min += sec_min;
+		*max += sec_max;
+		break;
+	case('-'):
+		*min -= sec_max;
+		*max -= sec_min;
+		break;
+	case('*'):
+		products[0] = *min * sec_min;
+		products[1] = *min * sec_max;
+		products[2] = *max * sec_min;
+		products[3] = *max * sec_max;
+		*min = fmin(fmin(products[0], products[1]), fmin(products[2], products[3]));
+		*max = fmax(fmax(products[0], products[1]), fmax(products[2], products[3]));
+		break;
+	case('%'):
+		if(sec_min <= 0 && sec_max >= 0)
+			return false;	// May be modulo by 0.
+
+		// The result has the sign of the dividend, and is smaller than the divisor.
+		modulo_max = fmax(fabs(sec_min), fabs(sec_max)) - 1;
+		*min = (*min < 0) ? fmax(*min, -modulo_max) : 0;
+		*max = (*max > 0) ? fmin(*max, modulo_max) : 0;
+		break;
+	case('<'):
+	case('>'):
+	case(OPERATOR_LESS_EQUAL):
+	case(OPERATOR_GREATER_EQUAL):
+	case(OPERATOR_EQUAL):
+		*min = 0;
+		*max = 1;
+		break;
+
+	default:
+		return false;
+	}
+
+	return true;
+}
+
+bool is_integer_operation(const struct Operation *operation)
+{
+	NumSection_iterator section_ite;
+	char_iterator operator_ite;
+
+	struct NumSection section;
+	char operator;
+
+	operator_ite = get_char_list_iterator(&operation->operators);
+	while(!char_list_get(&operator_ite, &operation->operators, &operator))
+		if(!equals_any(operator, "+-*%<>")
+				&& operator != OPERATOR_LESS_EQUAL && operator != OPERATOR_GREATER_EQUAL
+				&& operator != OPERATOR_EQUAL)
+			return false;
+
+	section_ite = get_NumSection_list_iterator(&operation->numbers);
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section)) {
+		switch (section.type) {
+		case(type_num):
+			if(section.data.num != floor(section.data.num) || fabs(section.data.num) >= INT64_LIMIT)
+				return false;
+			break;
+		case(type_die):
+			break;
+		case(type_op):
+			if(!is_integer_operation(section.data.operation))
+				return false;
+			break;
+		case(type_slot):
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool is_exact_integer_operation(const struct Operation *operation)
+{
+	double min, max;
+
+	return get_integer_range(operation, DOUBLE_EXACT_LIMIT, &min, &max);
+}
+
 /* -- Other -- */
 
+unsigned get_slot_count(const struct Operation *operation)
+{
+	NumSection_iterator section_ite;
+	struct NumSection section;
+	unsigned ret;
+	unsigned sub_count;
+
+	ret = 0;
+	section_ite = get_NumSection_list_iterator(&operation->numbers);
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section)) {
+		// (Indexes are below DIE_MAX_SLOT_COUNT, so + 1 can't wrap to 0).
+		if(section.type == type_slot && section.data.slot >= ret) {
+			lassert(section.data.slot < DIE_MAX_SLOT_COUNT, ASSERT_LVL_FAST);
+			ret = section.data.slot + 1;
+		}
+		else if(section.type == type_op && (sub_count = get_slot_count(section.data.operation)) > ret)
+			ret = sub_count;
+	}
+
+	return ret;
+}
+
 bool is_single_num_operation(struct Operation *operation)
 {
 	struct NumSection section;
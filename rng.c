@@ -0,0 +1,63 @@
+/* Seedable random number generator.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "rng.h"
+#include "libdie.h"
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+_Thread_local struct die_rng *active_rng = NULL;
+
+// Tokens of the thread are (token_seed, token_stream++).
+static _Thread_local uint64_t token_seed;
+static _Thread_local uint64_t token_stream;
+static _Thread_local bool token_seed_set = false;
+
+// SplitMix64's finalizer, to spread the bits of a seed.
+static uint64_t mix64(uint64_t x)
+{
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+uint64_t make_token_seed()
+{
+	static atomic_uint_fast64_t seeds_made = 0;
+	struct timespec now;
+
+	timespec_get(&now, TIME_UTC);
+	return mix64((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec
+			+ mix64(atomic_fetch_add(&seeds_made, 1)));
+}
+
+void die_set_token_seed(uint64_t seed)
+{
+	token_seed = seed;
+	token_stream = 0;
+	token_seed_set = true;
+}
+
+void next_token(struct die_token *token)
+{
+	if(!token_seed_set)
+		die_set_token_seed(make_token_seed());
+
+	token->seed = token_seed;
+	token->stream = token_stream++;
+}
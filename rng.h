@@ -0,0 +1,77 @@
+/* Seedable random number generator - internal header.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* PCG32 (O'Neill's XSH-RR variant): a 64-bit state, and an increment chosen by a stream number,
+ * so each (seed, stream) pair is an independent sequence that can be replayed (see die_token).
+ *
+ * Dice are rolled with active_rng if the thread set one, and with rand() otherwise. */
+#pragma once
+
+#include "libdie.h"
+#include "stats.h"
+
+#include <stdint.h>
+
+struct die_rng {
+	uint64_t state;
+	uint64_t increment;	// (Odd).
+};
+
+// Generator used by the calling thread's rolls (NULL to use rand()).
+extern _Thread_local struct die_rng *active_rng;
+
+/* Return a new seed for the calling thread's tokens (different for each call). */
+uint64_t make_token_seed();
+
+/* Set *token to the next token of the calling thread (see die_set_token_seed). */
+void next_token(struct die_token *token);
+
+static inline uint32_t rng_next(struct die_rng *rng)
+{
+	const uint64_t state = rng->state;
+	const uint32_t xorshifted = ((state >> 18) ^ state) >> 27;
+	const uint32_t rotation = state >> 59;
+
+	rng->state = state * 6364136223846793005ULL + rng->increment;
+	return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+}
+
+static inline void rng_seed(struct die_rng *rng, uint64_t seed, uint64_t stream)
+{
+	rng->state = 0;
+	rng->increment = (stream << 1) | 1;
+	rng_next(rng);
+	rng->state += seed;
+	rng_next(rng);
+}
+
+/* Return a uniformly distributed number in [1, sides] (Lemire's multiply and reject). */
+static inline int rng_roll(struct die_rng *rng, uint32_t sides)
+{
+	uint64_t product = (uint64_t) rng_next(rng) * sides;
+	uint32_t threshold;
+
+	if((uint32_t) product < sides) {
+		threshold = -sides % sides;
+		while((uint32_t) product < threshold) {
+			STAT_ADD(rng_draws, 1);	// (Only the rejected draws, the others are counted per die).
+			product = (uint64_t) rng_next(rng) * sides;
+		}
+	}
+
+	return (product >> 32) + 1;
+}
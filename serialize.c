@@ -0,0 +1,335 @@
+/* Saving and loading operations in a binary format.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Format (version 1), all integers little-endian and unaligned, so it may be read from anywhere
+ * (like a file mapped into memory):
+ *
+ * header:
+ * 	"LDIE"			magic
+ * 	u16 version		OP_FORMAT_VERSION
+ * 	u16 flags		(reserved, 0)
+ * 	u32 repetitions
+ * 	u32 size		of the operation below, in bytes
+ * operation:
+ * 	u8 parenthesis		0 or 1
+ * 	u8 prefix		'+', '-' or 0
+ * 	u32 number count	(at least 1)
+ * 	number count sections, each a u8 type (as in struct NumSection) followed by:
+ * 		type_num:	f64 (IEEE-754 bits as u64)
+ * 		type_die:	u32 repetitions, u32 sides
+ * 		type_op:	an operation (recursively)
+ * 		type_slot:	u32 slot (below DIE_MAX_SLOT_COUNT)
+ * 	number count - 1 operators (a byte each)
+ *
+ * The members exp_to_op sets from the tree (integral, evaluator) aren't stored, and are recomputed
+ * by op_deserialize.
+ *
+ * op_deserialize copies the operation out of the data into a new tree: it saves parsing, not the
+ * allocations of the tree (flat operations are the ones used in place, see flat_serialize in flat.c). */
+
+#include "libdie.h"
+#include "alloc.h"
+#include "string_ops.h"
+
+#include <string.h>
+
+#define OP_MAGIC "LDIE"
+#define HEADER_SIZE 16
+// Deeper operations are refused by op_deserialize (so bad input can't exhaust the stack).
+#define MAX_DEPTH 4096
+
+#define OPERATORS "+-*/%^<>LG="	// (See OPERATOR_LESS_EQUAL in libdie.h).
+
+// Writes to buffer, up to end (not past it), but keeps counting the size.
+struct writer {
+	unsigned char *position;
+	unsigned char *end;
+	size_t size;
+};
+
+struct reader {
+	const unsigned char *position;
+	const unsigned char *end;
+	bool failed;		// Read past end.
+};
+
+struct Operation* make_operation(bool parenthesis);
+bool is_exact_integer_operation(const struct Operation *operation);
+double (*get_shape_evaluator(const struct Operation *operation))(const struct Operation*);
+
+void write_bytes(struct writer *writer, const void *bytes, size_t length);
+void write_u8(struct writer *writer, uint8_t value);
+void write_u16(struct writer *writer, uint16_t value);
+void write_u32(struct writer *writer, uint32_t value);
+void write_u64(struct writer *writer, uint64_t value);
+void write_operation(struct writer *writer, const struct Operation *operation);
+size_t op_serialize_body(const struct Operation *operation, void *buffer, size_t size);
+
+uint8_t read_u8(struct reader *reader);
+uint16_t read_u16(struct reader *reader);
+uint32_t read_u32(struct reader *reader);
+uint64_t read_u64(struct reader *reader);
+struct Operation* read_operation(struct reader *reader, unsigned depth);
+
+
+/* -- Writing -- */
+
+void write_bytes(struct writer *writer, const void *bytes, size_t length)
+{
+	if(writer->position && (size_t) (writer->end - writer->position) >= length) {
+		memcpy(writer->position, bytes, length);
+		writer->position += length;
+	} else {
+		writer->position = NULL;	// (Too small, stop writing).
+	}
+	writer->size += length;
+}
+
+void write_u8(struct writer *writer, uint8_t value)
+{
+	write_bytes(writer, &value, 1);
+}
+
+void write_u16(struct writer *writer, uint16_t value)
+{
+	const unsigned char bytes[2] = {value, value >> 8};
+
+	write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void write_u32(struct writer *writer, uint32_t value)
+{
+	const unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+
+	write_bytes(writer, bytes, sizeof(bytes));
+}
+
+void write_u64(struct writer *writer, uint64_t value)
+{
+	write_u32(writer, value);
+	write_u32(writer, value >> 32);
+}
+
+void write_operation(struct writer *writer, const struct Operation *operation)
+{
+	NumSection_iterator section_ite = get_NumSection_list_iterator(&operation->numbers);
+	char_iterator operator_ite = get_char_list_iterator(&operation->operators);
+	struct NumSection section;
+	uint64_t num_bits;
+	char operator;
+
+	write_u8(writer, operation->parenthesis);
+	write_u8(writer, (operation->prefix == '+' || operation->prefix == '-') ? operation->prefix : 0);
+	write_u32(writer, NumSection_list_length(&operation->numbers));
+
+	while(!NumSection_list_get(&section_ite, &operation->numbers, &section)) {
+		write_u8(writer, section.type);
+		switch(section.type) {
+		case(type_num):
+			memcpy(&num_bits, &section.data.num, sizeof(num_bits));
+			write_u64(writer, num_bits);
+			break;
+		case(type_die):
+			write_u32(writer, section.data.die.repetitions);
+			write_u32(writer, section.data.die.sides);
+			break;
+		case(type_op):
+			write_operation(writer, section.data.operation);
+			break;
+		case(type_slot):
+			write_u32(writer, section.data.slot);
+			break;
+		}
+	}
+
+	// (The operators list may have one extra operator at the end, which isn't used).
+	for(size_t i = 1; i < NumSection_list_length(&operation->numbers)
+			&& !char_list_get(&operator_ite, &operation->operators, &operator); i++)
+		write_u8(writer, operator);
+}
+
+/* Same as op_serialize, only without the header: just the operation part of the format (so it doesn't
+ * depend on the repetitions, for the keys of op_distribution_cached). */
+size_t op_serialize_body(const struct Operation *operation, void *buffer, size_t size)
+{
+	struct writer writer = { .position = buffer, .end = (unsigned char*) buffer + size, .size = 0 };
+
+	if(!buffer)
+		writer.position = NULL;
+
+	write_operation(&writer, operation);
+	return writer.size;
+}
+
+size_t op_serialize(const struct Operation *operation, void *buffer, size_t size)
+{
+	struct writer writer = { .position = buffer, .end = (unsigned char*) buffer + size, .size = 0 };
+	struct writer body_writer = { .position = NULL, .size = 0 };
+
+	if(!buffer)
+		writer.position = NULL;
+
+	write_operation(&body_writer, operation);	// (Just to get the size).
+
+	write_bytes(&writer, OP_MAGIC, 4);
+	write_u16(&writer, OP_FORMAT_VERSION);
+	write_u16(&writer, 0);
+	write_u32(&writer, operation->repetitions);
+	write_u32(&writer, body_writer.size);
+	write_operation(&writer, operation);
+
+	return writer.size;
+}
+
+
+/* -- Reading -- */
+
+uint8_t read_u8(struct reader *reader)
+{
+	if(reader->end - reader->position < 1) {
+		reader->failed = true;
+		return 0;
+	}
+	return *(reader->position++);
+}
+
+uint16_t read_u16(struct reader *reader)
+{
+	const uint16_t low = read_u8(reader);
+
+	return low | (uint16_t) read_u8(reader) << 8;
+}
+
+uint32_t read_u32(struct reader *reader)
+{
+	const uint32_t low = read_u16(reader);
+
+	return low | (uint32_t) read_u16(reader) << 16;
+}
+
+uint64_t read_u64(struct reader *reader)
+{
+	const uint64_t low = read_u32(reader);
+
+	return low | (uint64_t) read_u32(reader) << 32;
+}
+
+/* Read an operation (see the format above), and return it, or NULL if it's invalid or a memory
+ * allocation failed. */
+struct Operation* read_operation(struct reader *reader, unsigned depth)
+{
+	struct Operation *operation;
+	struct NumSection section;
+	uint64_t num_bits;
+	uint32_t count;
+	uint8_t parenthesis;
+	char operator;
+
+	if(depth > MAX_DEPTH || !(operation = make_operation(false)))
+		return NULL;
+
+	parenthesis = read_u8(reader);
+	operation->parenthesis = parenthesis;
+	operation->prefix = read_u8(reader);
+	count = read_u32(reader);
+	if(reader->failed || count == 0 || parenthesis > 1
+			|| (operation->prefix && operation->prefix != '+' && operation->prefix != '-'))
+		goto fail;
+
+	for(uint32_t i = 0; i < count; i++) {
+		section.type = read_u8(reader);
+		switch(section.type) {
+		case(type_num):
+			num_bits = read_u64(reader);
+			memcpy(&section.data.num, &num_bits, sizeof(num_bits));
+			break;
+		case(type_die):
+			section.data.die.repetitions = read_u32(reader);
+			section.data.die.sides = read_u32(reader);
+			if(section.data.die.repetitions == 0 || section.data.die.sides < 1)
+				goto fail;
+			break;
+		case(type_op):
+			if(!(section.data.operation = read_operation(reader, depth + 1)))
+				goto fail;
+			break;
+		case(type_slot):
+			section.data.slot = read_u32(reader);
+			if(section.data.slot >= DIE_MAX_SLOT_COUNT)	// (Like exp_to_op).
+				goto fail;
+			break;
+		default:
+			goto fail;
+		}
+
+		if(reader->failed || NumSection_list_append(&operation->numbers, section)) {
+			clear_num_section(section);
+			goto fail;
+		}
+	}
+
+	for(uint32_t i = 1; i < count; i++) {
+		operator = read_u8(reader);
+		if(reader->failed || !equals_any(operator, OPERATORS)
+				|| char_list_append(&operation->operators, operator))
+			goto fail;
+	}
+
+	return operation;
+
+fail:
+	clear_operation_pointer(operation);
+	return NULL;
+}
+
+struct Operation* op_deserialize(const void *data, size_t size, size_t *used)
+{
+	struct reader reader = { .position = data, .end = (const unsigned char*) data + size, .failed = false };
+	struct Operation *operation;
+	uint32_t repetitions;
+	uint32_t body_size;
+
+	if(size < HEADER_SIZE || memcmp(data, OP_MAGIC, 4) != 0)
+		return NULL;
+	reader.position += 4;
+
+	if(read_u16(&reader) != OP_FORMAT_VERSION)
+		return NULL;
+	read_u16(&reader);	// (Flags).
+	repetitions = read_u32(&reader);
+	body_size = read_u32(&reader);
+
+	if(repetitions == 0 || body_size > size - HEADER_SIZE)
+		return NULL;
+	reader.end = reader.position + body_size;
+
+	if(!(operation = read_operation(&reader, 0)))
+		return NULL;
+	if(reader.position != reader.end) {
+		clear_operation_pointer(operation);
+		return NULL;
+	}
+
+	// Set what exp_to_op would.
+	operation->repetitions = repetitions;
+	operation->integral = is_exact_integer_operation(operation);
+	operation->evaluator = get_shape_evaluator(operation);
+
+	if(used)
+		*used = HEADER_SIZE + body_size;
+	return operation;
+}
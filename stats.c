@@ -0,0 +1,111 @@
+/* Instrumentation counters.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "stats.h"
+
+#include <string.h>
+
+#ifdef LIBDIE_STATS
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Each thread's counters are kept in a block, linked to all the others so die_stats_snapshot
+ * may sum them.
+ * Blocks are never freed, so the counts of threads that exited are kept. */
+struct stats_block {
+	struct die_stats stats;
+	struct stats_block *next;
+};
+
+static struct stats_block *blocks = NULL;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static _Thread_local struct stats_block *thread_block = NULL;
+
+// Used by threads which failed to allocate their own block (counts may be lost, but not corrupted).
+static struct stats_block fallback_block;
+static bool fallback_block_linked = false;
+
+struct die_stats* get_thread_stats()
+{
+	if(thread_block)
+		return &thread_block->stats;
+
+	pthread_mutex_lock(&blocks_lock);
+
+	if(!(thread_block = calloc(1, sizeof(*thread_block)))) {
+		thread_block = &fallback_block;
+		if(fallback_block_linked) {
+			pthread_mutex_unlock(&blocks_lock);
+			return &thread_block->stats;
+		}
+		fallback_block_linked = true;
+	}
+
+	thread_block->next = blocks;
+	blocks = thread_block;
+
+	pthread_mutex_unlock(&blocks_lock);
+	return &thread_block->stats;
+}
+
+uint64_t stats_timestamp()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec time;
+
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+#endif
+}
+
+bool die_stats_snapshot(struct die_stats *out)
+{
+	const size_t fields = sizeof(*out) / sizeof(uint64_t);
+
+	uint64_t *out_fields = (uint64_t*) out;
+	const uint64_t *block_fields;
+
+	memset(out, 0, sizeof(*out));
+
+	pthread_mutex_lock(&blocks_lock);
+	for(struct stats_block *block = blocks; block; block = block->next) {
+		block_fields = (const uint64_t*) &block->stats;
+		for(size_t i = 0; i < fields; i++)
+			out_fields[i] += __atomic_load_n(&block_fields[i], __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&blocks_lock);
+
+	return true;
+}
+
+#else
+
+bool die_stats_snapshot(struct die_stats *out)
+{
+	memset(out, 0, sizeof(*out));
+	return false;
+}
+
+#endif
@@ -0,0 +1,54 @@
+/* Instrumentation counters - internal header.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Macros to update the counters read by die_stats_snapshot (see libdie.h).
+ *
+ * Unless LIBDIE_STATS is defined, they do nothing (and their arguments aren't evaluated). */
+#pragma once
+
+#include "libdie.h"
+
+#ifdef LIBDIE_STATS
+
+#include <stdint.h>
+
+/* Return the calling thread's counters (registering them on the first call).
+ * Only the calling thread may write to them. */
+struct die_stats* get_thread_stats();
+
+/* Return a timestamp for the *_cycles counters: cycles on x86, nanoseconds elsewhere. */
+uint64_t stats_timestamp();
+
+// Add n to field of the thread's counters.
+// (Atomic store so die_stats_snapshot may read it from another thread, only this thread writes).
+#define STAT_ADD(field, n) do {								\
+	struct die_stats *const stats__ = get_thread_stats();				\
+	__atomic_store_n(&stats__->field, stats__->field + (n), __ATOMIC_RELAXED);	\
+} while(0)
+
+// Declare a timer and start it.
+#define STAT_TIMER_START(timer) const uint64_t timer = stats_timestamp()
+// Add the time passed since timer started to field.
+#define STAT_TIMER_STOP(timer, field) STAT_ADD(field, stats_timestamp() - (timer))
+
+#else
+
+#define STAT_ADD(field, n) do { (void) sizeof(n); } while(0)	// (sizeof so n counts as used).
+#define STAT_TIMER_START(timer) do { } while(0)
+#define STAT_TIMER_STOP(timer, field) do { } while(0)
+
+#endif
@@ -20,6 +20,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
@@ -48,19 +49,21 @@ double strtod_noprefix(char *nptr, char **endptr)
  * start: 	where the first numerical character is expected.
  * end:		points after where the last numerical character should be.
  *
- * In case of error, *invalid_char is set to true, and 1 is returned. */
+ * In case of error (including a number bigger than UINT_MAX), *invalid_char is set to true, and 1 is returned. */
 unsigned str_section_to_unsigned(const char *start, const char *end, bool *invalid_char)
 {
 	lassert(start <= end, ASSERT_LVL_FAST);
 
 	unsigned ret = 0;
+	unsigned digit;
 
 	for(; start != end; start++) {
-		if(!isdigit(*start)) {
+		digit = *start & 0x0F;	// Look at the ascii table in hex, you'll get it.
+		if(!isdigit(*start) || ret > (UINT_MAX - digit) / 10) {
 			*invalid_char = true;
 			return 1;
 		}
-		ret = ret*10 + (*start & 0x0F);	// Look at the ascii table in hex, you'll get it.
+		ret = ret*10 + digit;
 	}
 
 	*invalid_char = false;
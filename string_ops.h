@@ -38,7 +38,7 @@ char* get_next_non_pchars(char* str, const char* chars);
 double strtod_noprefix(char *nptr, char **endptr);
 
 /* Convert string to unsigned, not accepting prefix.
- * On failure (invalid char) *invalid_char is set to true and 1 is returned. */
+ * On failure (invalid char, or bigger than UINT_MAX) *invalid_char is set to true and 1 is returned. */
 unsigned str_section_to_unsigned(const char *start, const char *end, bool *invalid_char);
 
 /* Convert double to string with the trailing 0s removed.
@@ -26,6 +26,12 @@
 #include <assert.h>
 #include <math.h>
 #include <string.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdatomic.h>
 
 bool parse_num_section(struct NumSection *out, char **dice_exp,
 		struct Dierror_list *error_list);
@@ -33,6 +39,7 @@ bool parse_num_section(struct NumSection *out, char **dice_exp,
 int comp_num_sections(struct NumSection s1, struct NumSection s2);
 
 struct Operation* make_operation(bool parenthesis);
+unsigned get_operation_depth(const struct Operation *operation);
 
 /* Help functions / macros */
 #define EPS 0.0000001
@@ -80,6 +87,8 @@ int comp_num_sections(struct NumSection s1, struct NumSection s2)
 		return COMP_DICE(s1.data.die, s2.data.die);
 	case(type_op):
 		return comp_operations(s1.data.operation, s2.data.operation);
+	case(type_slot):
+		return (int) s1.data.slot - (int) s2.data.slot;
 
 	default:
 		exit(1);	// Should never happen.
@@ -111,6 +120,10 @@ char* dierror_type_as_str(enum dierror_type type)
 		return "invalid_parenthesis";
 	case(empty_expression):
 		return "empty expression";
+	case(invalid_placeholder):
+		return "invalid placeholder";
+	case(exceeds_limits):
+		return "exceeds limits";
 	default:
 		return "<unknown error type>";
 	}
@@ -250,6 +263,15 @@ struct NumSection create_num_numsection(double num)
 	return section;
 }
 
+struct NumSection create_slot_section(unsigned slot)
+{
+	struct NumSection section;
+
+	section.type = type_slot;
+	section.data.slot = slot;
+	return section;
+}
+
 void fprint_operation(FILE* fp, struct Operation *op);
 void fprint_numsection(FILE* fp, struct NumSection section)
 {
@@ -263,6 +285,9 @@ void fprint_numsection(FILE* fp, struct NumSection section)
 		break;
 	case type_op:
 		fprint_operation(fp, section.data.operation);
+		break;
+	case type_slot:
+		fprintf(fp, "$%u", section.data.slot);
 	}
 }
 
@@ -469,6 +494,32 @@ int parse_num_section_tester()
 	dice_exp = "11d1haha+5";
 	fails += test_parse_num_section(dice_exp, create_dice_section(11, 1), dice_exp+8, 1, invalid_sides);
 
+	// Placeholders
+
+	dice_exp = "$0";
+	fails += test_parse_num_section(dice_exp, create_slot_section(0), dice_exp+2, 0);
+
+	dice_exp = "$12+";
+	fails += test_parse_num_section(dice_exp, create_slot_section(12), dice_exp+3, 0);
+
+	dice_exp = "$*";
+	fails += test_parse_num_section(dice_exp, create_slot_section(0), dice_exp+1, 1, invalid_placeholder);
+
+	dice_exp = "$1d6";
+	fails += test_parse_num_section(dice_exp, create_slot_section(0), dice_exp+4, 1, invalid_placeholder);
+
+	dice_exp = "$65535";	// (DIE_MAX_SLOT_COUNT - 1).
+	fails += test_parse_num_section(dice_exp, create_slot_section(65535), dice_exp+6, 0);
+
+	dice_exp = "$65536";
+	fails += test_parse_num_section(dice_exp, create_slot_section(0), dice_exp+6, 1, invalid_placeholder);
+
+	dice_exp = "$4294967295";	// (UINT_MAX, the count would wrap to 0).
+	fails += test_parse_num_section(dice_exp, create_slot_section(0), dice_exp+11, 1, invalid_placeholder);
+
+	dice_exp = "$4294967296";	// (Would wrap to slot 0).
+	fails += test_parse_num_section(dice_exp, create_slot_section(0), dice_exp+11, 1, invalid_placeholder);
+
 	// Operation
 
 	dice_exp = "(14*3d4-5)";
@@ -959,3 +1010,1880 @@ int operate_tester()
 }
 
 
+
+/* dice_exp		The input (must be valid).
+ * ex_integral		Whether the operation returned by exp_to_op is expected to be marked integral.
+ * ex_integer		Whether is_integer_operation is expected to return true.
+ * ex_result		The expected result of operate_i64 (ignored if !ex_integer or ex_overflow).
+ * ex_overflow		Whether operate_i64 is expected to overflow. */
+bool test_operate_i64(char *dice_exp, bool ex_integral, bool ex_integer, int64_t ex_result, bool ex_overflow)
+{
+	struct Operation *operation;
+	struct Dierror *errors;
+	int64_t result;
+	bool overflow;
+	bool failed = false;
+
+	if(!(operation = exp_to_op(dice_exp, &errors))) {
+		fprint_identifier(stderr, dice_exp);
+		fputs("exp_to_op failed.\n", stderr);
+		free(errors);
+		return true;
+	}
+
+	if(operation->integral != ex_integral) {
+		fprint_identifier(stderr, dice_exp);
+		fprintf(stderr, "Expected integral to be %d but got %d.\n", ex_integral, operation->integral);
+		failed = true;
+	}
+
+	if(is_integer_operation(operation) != ex_integer) {
+		fprint_identifier(stderr, dice_exp);
+		fprintf(stderr, "Expected is_integer_operation to return %d.\n", ex_integer);
+		failed = true;
+	}
+
+	if(ex_integer) {
+		result = operate_i64(operation, NULL, NO_FLAG, &overflow);
+		if(overflow != ex_overflow) {
+			fprint_identifier(stderr, dice_exp);
+			fprintf(stderr, "Expected overflow to be %d but got %d.\n", ex_overflow, overflow);
+			failed = true;
+		} else if(!overflow && result != ex_result) {
+			fprint_identifier(stderr, dice_exp);
+			fprintf(stderr, "Expected %" PRId64 " but got %" PRId64 ".\n", ex_result, result);
+			failed = true;
+		}
+	}
+
+	clear_operation_pointer(operation);
+	return failed;
+}
+
+int operate_i64_tester()
+{
+	int fails;
+	struct Operation *operation;
+	struct Dierror *errors;
+	char calc_string[64];
+	bool overflow;
+	int64_t result;
+
+	fails = test_operate_i64("2+3*4-10%4", true, true, 12, false);
+	fails += test_operate_i64("-7%3", true, true, -1, false);
+	fails += test_operate_i64("3d1*(2-5)", true, true, -9, false);
+	fails += test_operate_i64("d20/2", false, false, 0, false);
+	fails += test_operate_i64("2^d4", false, false, 0, false);
+	fails += test_operate_i64("1.5*d6", false, false, 0, false);
+	fails += test_operate_i64("7%(5%3)", false, true, 1, false);	// May be modulo by 0 (as far as we know).
+	fails += test_operate_i64("5%(3-3)", false, true, 0, true);
+	fails += test_operate_i64("4611686018427387904*4", false, true, 0, true);
+	fails += test_operate_i64("4611686018427387904*2-1", false, true, 0, true);	// Overflows before the '-'.
+	fails += test_operate_i64("3037000499*3037000499", false, true, 9223372030926249001, false);
+
+	// Check the calculation string matches operate.
+	operation = exp_to_op("10-3d1*2+1", &errors);
+	if(!operation) {
+		fputs("(10-3d1*2+1) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	result = operate_i64(operation, calc_string, NO_FLAG, &overflow);
+	if(result != 5 || overflow || strcmp(calc_string, "10-(1+1+1)*2+1") != 0) {
+		fprintf(stderr, "(10-3d1*2+1) Expected 5 \"10-(1+1+1)*2+1\" but got %" PRId64 " \"%s\".\n",
+				result, calc_string);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+int comparison_tester()
+{
+	int fails = 0;
+	// Deterministic expressions (dice of 1 side), their results and calculation strings.
+	struct {
+		char *dice_exp;
+		double result;
+		char *calc_string;
+	} exact[] = {
+		{"3d1>=2+1", 1, "(1+1+1)>=2+1"},
+		{"2*3<6", 0, "2*3<6"},
+		{"2*3<=6", 1, "2*3<=6"},
+		{"1+1==3", 0, "1+1==3"},
+		{"-2>(-3)", 1, "-2>(-3)"},
+		{"4>3>0", 1, "4>3>0"},		// (4>3)>0
+		{"(d1<2)*5", 5, "(1<2)*5"},
+	};
+	// Probabilities of being true, from the exact distributions.
+	struct {
+		char *dice_exp;
+		double probability;
+	} probabilities[] = {
+		{"d20+5>=15", 0.55},
+		{"2d6==7", 1 / 6.0},
+		{"d6<4", 0.5},
+		{"-d6<(-3)", 0.5},
+		{"2*d6>7", 0.5},
+		{"(d6>3)+(d6>3)==2", 0.25},
+		{"d4-d4", 0.75},
+		{"d6", 1},
+		{"d20/2>5", 0.5},
+		{"4d6==14", 146 / 1296.0},
+		// (Comparisons are linear, so big dice are exact).
+		{"d5000>d5000", (1 - 1 / 5000.0) / 2},
+		{"d100000>=d100000", (1 + 1 / 100000.0) / 2},
+	};
+	struct Operation *operation;
+	struct Dierror *errors;
+	double probability;
+
+	for(size_t i = 0; i < sizeof(exact) / sizeof(*exact); i++) {
+		if(!(operation = exp_to_op(exact[i].dice_exp, &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", exact[i].dice_exp);
+			free(errors);
+			fails++;
+			continue;
+		}
+		if(test_operate(operation, exact[i].result, NO_FLAG, "%s", exact[i].calc_string)) {
+			fprintf(stderr, "(%s) operate failed.\n", exact[i].dice_exp);
+			fails++;
+		}
+		clear_operation_pointer(operation);
+	}
+
+	fails += test_operate_i64("3d1+5>=8", true, true, 1, false);
+	fails += test_operate_i64("(2d1==2)*7%4", true, true, 3, false);
+
+	fails += test_exp_to_op("d20=5", NULL, 1, invalid_operator);
+	fails += test_exp_to_op("d20=<5", NULL, 1, invalid_operator);
+
+	for(size_t i = 0; i < sizeof(probabilities) / sizeof(*probabilities); i++) {
+		if(!(operation = exp_to_op(probabilities[i].dice_exp, &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", probabilities[i].dice_exp);
+			free(errors);
+			fails++;
+			continue;
+		}
+		probability = op_probability_true(operation);
+		if(COMP_DBLS(probability, probabilities[i].probability) != 0) {
+			fprintf(stderr, "(%s) Expected probability %lf but got %lf.\n",
+					probabilities[i].dice_exp, probabilities[i].probability, probability);
+			fails++;
+		}
+		clear_operation_pointer(operation);
+	}
+
+	// Placeholders have no distribution.
+	if(!(operation = exp_to_op("d20>$0", &errors))) {
+		fputs("(d20>$0) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(!isnan(probability = op_probability_true(operation))) {
+		fprintf(stderr, "(d20>$0) Expected NaN but got %lf.\n", probability);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+/* Check dist (of dice_exp) is sorted, its probabilities sum to 1 - dist->pruned, and its mean
+ * (ignoring NaN) is ex_mean. Return the number of failed checks. */
+int check_distribution(char *dice_exp, const struct die_distribution *dist, double ex_mean)
+{
+	int fails = 0;
+	double total = 0;
+	double mean = 0;
+
+	for(size_t i = 0; i < dist->length; i++) {
+		if(i > 0 && !(dist->values[i - 1] < dist->values[i]) && !isnan(dist->values[i])) {
+			fprintf(stderr, "(%s) Values %lf and %lf aren't sorted.\n",
+					dice_exp, dist->values[i - 1], dist->values[i]);
+			fails++;
+		}
+		total += dist->probabilities[i];
+		if(!isnan(dist->values[i]))
+			mean += dist->values[i] * dist->probabilities[i];
+	}
+
+	if(fabs(total - (1 - dist->pruned)) > 1e-9) {
+		fprintf(stderr, "(%s) Probabilities sum to %lf (%lf pruned).\n", dice_exp, total, dist->pruned);
+		fails++;
+	}
+	if(fabs(mean - ex_mean) > 1e-9 * fmax(1, fabs(ex_mean))) {
+		fprintf(stderr, "(%s) Expected mean %lf but got %lf.\n", dice_exp, ex_mean, mean);
+		fails++;
+	}
+	return fails;
+}
+
+int op_distribution_tester()
+{
+	int fails = 0;
+	struct {
+		char *dice_exp;
+		struct die_dist_limits limits;
+		size_t length;		// Expected (most values if rebinned).
+		double mean;
+		bool rebinned;
+		double pruned;
+	} checked[] = {
+		// 19 different powers, summed over bases 1 to 6 and exponents 1 to 4 below.
+		{"d6^d4", {DIE_DIST_MAX_SUPPORT, 0}, 19, 0, false, 0},
+		{"(d6-d6)*(d6-d6)", {DIE_DIST_MAX_SUPPORT, 0}, 29, 0, false, 0},
+		{"d100*d100", {100, 0}, 100, 50.5 * 50.5, true, 0},
+		{"3d6", {DIE_DIST_MAX_SUPPORT, 0.01}, 14, 10.5, false, 2 / 216.0},
+		{"d6+$0", {DIE_DIST_MAX_SUPPORT, 0}, 6, 4, false, 0},
+		// From a generated table (see dice_tables.h), then rolling 3 more, and without a table.
+		{"13d6", {DIE_DIST_MAX_SUPPORT, 0}, 66, 45.5, false, 0},
+		{"10d7", {DIE_DIST_MAX_SUPPORT, 0}, 61, 40, false, 0},
+	};
+	const double values[] = {0.5, 1, 1.5, 2, 3, 4};
+	const double probabilities[] = {1 / 8.0, 2 / 8.0, 1 / 8.0, 2 / 8.0, 1 / 8.0, 1 / 8.0};
+	const double slot_values[] = {0.5};
+	struct die_distribution dist;
+	struct Operation *operation;
+	struct Dierror *errors;
+	bool failed;
+
+	for(int base = 1; base <= 6; base++)
+		for(int exponent = 1; exponent <= 4; exponent++)
+			checked[0].mean += pow(base, exponent) / 24;
+
+	for(size_t i = 0; i < sizeof(checked) / sizeof(*checked); i++) {
+		if(!(operation = exp_to_op(checked[i].dice_exp, &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", checked[i].dice_exp);
+			free(errors);
+			fails++;
+			continue;
+		}
+		if(op_distribution(operation, slot_values, &checked[i].limits, &dist)) {
+			fprintf(stderr, "(%s) op_distribution failed.\n", checked[i].dice_exp);
+			fails++;
+			clear_operation_pointer(operation);
+			continue;
+		}
+
+		if((checked[i].rebinned ? (dist.length > checked[i].length || dist.rebinned == 0 || dist.rebinned > 1)
+					: (dist.length != checked[i].length || dist.rebinned != 0))
+				|| COMP_DBLS(dist.pruned, checked[i].pruned) != 0) {
+			fprintf(stderr, "(%s) Expected %zu values (%s rebinned, %lf pruned) but got %zu (%lf, %lf).\n",
+					checked[i].dice_exp, checked[i].length, checked[i].rebinned ? "" : "not",
+					checked[i].pruned, dist.length, dist.rebinned, dist.pruned);
+			fails++;
+		}
+		// (Pruning 3d6 drops 3 and 18, which doesn't move the mean).
+		fails += check_distribution(checked[i].dice_exp, &dist,
+				checked[i].mean * (1 - checked[i].pruned));
+
+		clear_die_distribution(&dist);
+		clear_operation_pointer(operation);
+	}
+
+	// Rebinned on each side (the probabilities moved are combined, not summed past 1).
+	if(!(operation = exp_to_op("d10*d10+d10*d10>=d10*d10", &errors))) {
+		fputs("(d10*d10+d10*d10>=d10*d10) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(op_distribution(operation, NULL, &(struct die_dist_limits) { .max_support = 10 }, &dist)) {
+		fputs("(d10*d10+d10*d10>=d10*d10) op_distribution failed.\n", stderr);
+		fails++;
+	} else {
+		if(!(dist.rebinned > 0 && dist.rebinned <= 1)) {
+			fprintf(stderr, "(d10*d10+d10*d10>=d10*d10) Expected rebinned in (0, 1] but got %lf.\n",
+					dist.rebinned);
+			fails++;
+		}
+		clear_die_distribution(&dist);
+	}
+	clear_operation_pointer(operation);
+
+	// Exact values.
+	if(!(operation = exp_to_op("d4/d2", &errors))) {
+		fputs("(d4/d2) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(op_distribution(operation, NULL, NULL, &dist)) {
+		fputs("(d4/d2) op_distribution failed.\n", stderr);
+		fails++;
+	} else {
+		failed = dist.length != sizeof(values) / sizeof(*values);
+		for(size_t i = 0; !failed && i < dist.length; i++)
+			failed = COMP_DBLS(dist.values[i], values[i]) != 0
+				|| COMP_DBLS(dist.probabilities[i], probabilities[i]) != 0;
+		if(failed) {
+			fputs("(d4/d2) Unexpected distribution:", stderr);
+			for(size_t i = 0; i < dist.length; i++)
+				fprintf(stderr, " %lf: %lf", dist.values[i], dist.probabilities[i]);
+			fputc('\n', stderr);
+			fails++;
+		}
+		clear_die_distribution(&dist);
+	}
+	clear_operation_pointer(operation);
+
+	// NaN is kept last.
+	if(!(operation = exp_to_op("0/(d2-1)", &errors))) {
+		fputs("(0/(d2-1)) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(op_distribution(operation, NULL, NULL, &dist)) {
+		fputs("(0/(d2-1)) op_distribution failed.\n", stderr);
+		fails++;
+	} else {
+		if(dist.length != 2 || dist.values[0] != 0 || !isnan(dist.values[1])
+				|| COMP_DBLS(dist.probabilities[1], 0.5) != 0) {
+			fputs("(0/(d2-1)) Expected 0 and NaN, each of probability 0.5.\n", stderr);
+			fails++;
+		}
+		clear_die_distribution(&dist);
+	}
+	clear_operation_pointer(operation);
+
+	// Too many sums.
+	if(!(operation = exp_to_op("1000000d6", &errors))) {
+		fputs("(1000000d6) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(!op_distribution(operation, NULL, NULL, &dist)) {
+		fputs("(1000000d6) op_distribution should fail.\n", stderr);
+		clear_die_distribution(&dist);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+int die_dist_queries_tester()
+{
+	int fails = 0;
+	// Queries on 2d6, and their answers.
+	const struct {
+		double x;
+		double cdf;
+	} cdfs[] = { {1, 0}, {2, 1 / 36.0}, {6.5, 15 / 36.0}, {7, 21 / 36.0}, {12, 1}, {100, 1} };
+	const struct {
+		double q;
+		double quantile;
+	} quantiles[] = { {0, 2}, {0.01, 2}, {15 / 36.0 - EPS, 6}, {15 / 36.0 + EPS, 7}, {0.5, 7}, {0.99, 12}, {1, 12} };
+	const size_t sample_count = 36000;
+	struct die_distribution dist;
+	struct Operation *operation;
+	struct Dierror *errors;
+	size_t counts[13] = { 0 };
+	double result;
+
+	if(!(operation = exp_to_op("2d6", &errors))) {
+		fputs("(2d6) exp_to_op failed.\n", stderr);
+		free(errors);
+		return 1;
+	}
+	if(op_distribution(operation, NULL, NULL, &dist)) {
+		fputs("(2d6) op_distribution failed.\n", stderr);
+		clear_operation_pointer(operation);
+		return 1;
+	}
+
+	for(size_t i = 0; i < sizeof(cdfs) / sizeof(*cdfs); i++) {
+		if(COMP_DBLS((result = die_dist_cdf(&dist, cdfs[i].x)), cdfs[i].cdf) != 0) {
+			fprintf(stderr, "(2d6) Expected P(X<=%lf) = %lf but got %lf.\n", cdfs[i].x, cdfs[i].cdf, result);
+			fails++;
+		}
+	}
+	for(size_t i = 0; i < sizeof(quantiles) / sizeof(*quantiles); i++) {
+		if((result = die_dist_quantile(&dist, quantiles[i].q)) != quantiles[i].quantile) {
+			fprintf(stderr, "(2d6) Expected the %lf quantile to be %lf but got %lf.\n",
+					quantiles[i].q, quantiles[i].quantile, result);
+			fails++;
+		}
+	}
+	if(!isnan(die_dist_quantile(&dist, 1.5))) {
+		fputs("(2d6) The 1.5 quantile should be NaN.\n", stderr);
+		fails++;
+	}
+
+	for(size_t i = 0; i < sample_count; i++) {
+		result = die_dist_sample(&dist);
+		if(result != floor(result) || result < 2 || result > 12) {
+			fprintf(stderr, "(2d6) Sampled %lf.\n", result);
+			fails++;
+			break;
+		}
+		counts[(size_t) result]++;
+	}
+	// (Expecting 1000 to 6000 of each, the standard deviation is at most 71).
+	for(int i = 2; i <= 12; i++) {
+		if(fabs(counts[i] - (6 - abs(i - 7)) * 1000.0) > 400) {
+			fprintf(stderr, "(2d6) Sampled %d %zu times out of %zu.\n", i, counts[i], sample_count);
+			fails++;
+		}
+	}
+
+	clear_die_distribution(&dist);
+	clear_operation_pointer(operation);
+	return fails;
+}
+
+/* Call op_distribution_cached for dice_exp (without placeholders) and check it matches op_distribution,
+ * and was loaded from the cache (mapped) if ex_mapped. Return the number of failed checks. */
+int test_distribution_cached(char *dir, char *dice_exp, const struct die_dist_limits *limits, bool ex_mapped)
+{
+	int fails = 0;
+	struct die_distribution dist, cached;
+	struct Operation *operation;
+	struct Dierror *errors;
+
+	if(!(operation = exp_to_op(dice_exp, &errors))) {
+		fprintf(stderr, "(%s) exp_to_op failed.\n", dice_exp);
+		free(errors);
+		return 1;
+	}
+	if(op_distribution(operation, NULL, limits, &dist) || op_distribution_cached(dir, operation, NULL, limits, &cached)) {
+		fprintf(stderr, "(%s) op_distribution or op_distribution_cached failed.\n", dice_exp);
+		clear_operation_pointer(operation);
+		return 1;
+	}
+
+	if((cached.mapping != NULL) != ex_mapped) {
+		fprintf(stderr, "(%s) Expected the distribution %s the cache.\n", dice_exp,
+				ex_mapped ? "to be loaded from" : "not to be in");
+		fails++;
+	}
+	if(cached.length != dist.length || cached.rebinned != dist.rebinned || cached.pruned != dist.pruned
+			|| memcmp(cached.values, dist.values, dist.length * sizeof(*dist.values)) != 0
+			|| memcmp(cached.probabilities, dist.probabilities, dist.length * sizeof(*dist.probabilities)) != 0
+			|| memcmp(cached.cumulative, dist.cumulative, dist.length * sizeof(*dist.cumulative)) != 0) {
+		fprintf(stderr, "(%s) The cached distribution is different.\n", dice_exp);
+		fails++;
+	}
+
+	clear_die_distribution(&cached);
+	clear_die_distribution(&dist);
+	clear_operation_pointer(operation);
+	return fails;
+}
+
+/* Write garbage over, or remove (if remove_files), every file in dir. */
+void overwrite_cache_files(char *dir, bool remove_files)
+{
+	char path[256];
+	struct dirent *entry;
+	DIR *stream;
+	FILE *file;
+
+	if(!(stream = opendir(dir)))
+		return;
+	while((entry = readdir(stream))) {
+		if(entry->d_name[0] == '.')
+			continue;
+		if(snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int) sizeof(path))
+			continue;
+		if(remove_files) {
+			remove(path);
+		} else if((file = fopen(path, "r+b"))) {
+			fputs("garbage", file);
+			fclose(file);
+		}
+	}
+	closedir(stream);
+}
+
+/* Return the number of files in dir that aren't readable and writable as the umask allows
+ * (or all of them, if there are not file_count files). */
+int check_cache_files(char *dir, int file_count)
+{
+	const mode_t mask = umask(0);
+	char path[256];
+	struct dirent *entry;
+	struct stat file_stat;
+	DIR *stream;
+	int fails = 0;
+	int count = 0;
+
+	umask(mask);	// (Only to get it).
+	if(!(stream = opendir(dir)))
+		return 1;
+	while((entry = readdir(stream))) {
+		if(entry->d_name[0] == '.')
+			continue;
+		count++;
+		if(snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name) >= (int) sizeof(path)
+				|| stat(path, &file_stat) != 0 || (file_stat.st_mode & 0777) != (0666 & ~mask)) {
+			fprintf(stderr, "(%s) Expected mode %o.\n", entry->d_name, 0666 & ~mask);
+			fails++;
+		}
+	}
+	closedir(stream);
+
+	if(count != file_count) {
+		fprintf(stderr, "Expected %d cache files but there are %d.\n", file_count, count);
+		return count;
+	}
+	return fails;
+}
+
+int op_distribution_cached_tester()
+{
+	int fails = 0;
+	const struct die_dist_limits limits = { .max_support = 50, .min_probability = 0.001 };
+	char dir[] = "/tmp/libdie_cache_XXXXXX";
+
+	if(!mkdtemp(dir)) {
+		fputs("mkdtemp failed.\n", stderr);
+		return 1;
+	}
+
+	fails += test_distribution_cached(dir, "d6^d4+2d10", NULL, false);
+	fails += test_distribution_cached(dir, "d6^d4+2d10", NULL, true);
+	fails += test_distribution_cached(dir, "6xd6^d4+2d10", NULL, true);	// (Repetitions don't matter).
+	// Different limits are a different distribution.
+	fails += test_distribution_cached(dir, "d6^d4+2d10", &limits, false);
+	fails += test_distribution_cached(dir, "d6^d4+2d10", &limits, true);
+	fails += test_distribution_cached(dir, "d6^d4+2d10", NULL, true);
+	fails += check_cache_files(dir, 2);
+
+	// Bad files are replaced.
+	overwrite_cache_files(dir, false);
+	fails += test_distribution_cached(dir, "d6^d4+2d10", NULL, false);
+	fails += test_distribution_cached(dir, "d6^d4+2d10", NULL, true);
+
+	overwrite_cache_files(dir, true);
+	rmdir(dir);
+	return fails;
+}
+
+int op_normal_approx_tester()
+{
+	int fails = 0;
+	// Not linear, or constant.
+	char *const refused[] = { "d6*d6", "d20>10", "2d6^2", "d6+$0", "5*3", "4d1" };
+	const size_t sample_count = 10000;
+	struct die_normal_approx approx;
+	struct die_distribution dist;
+	struct Operation *operation;
+	struct Dierror *errors;
+	double cumulative;
+	double difference;
+	double max_difference;
+	double quantile;
+	double sample;
+	double sum;
+
+	for(size_t i = 0; i < sizeof(refused) / sizeof(*refused); i++) {
+		if(!(operation = exp_to_op(refused[i], &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", refused[i]);
+			free(errors);
+			fails++;
+			continue;
+		}
+		if(!op_normal_approx(operation, &approx)) {
+			fprintf(stderr, "(%s) op_normal_approx should fail.\n", refused[i]);
+			fails++;
+		}
+		clear_operation_pointer(operation);
+	}
+
+	// Compared with the exact distribution.
+	if(!(operation = exp_to_op("100d6", &errors))) {
+		fputs("(100d6) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(op_normal_approx(operation, &approx) || op_distribution(operation, NULL, NULL, &dist)) {
+		fputs("(100d6) op_normal_approx or op_distribution failed.\n", stderr);
+		clear_operation_pointer(operation);
+		return fails + 1;
+	}
+	if(COMP_DBLS(approx.mean, 350) != 0 || COMP_DBLS(approx.variance, 100 * 35 / 12.0) != 0
+			|| approx.lattice != 1 || approx.preferred) {
+		fprintf(stderr, "(100d6) Got mean %lf, variance %lf, lattice %lf%s.\n", approx.mean,
+				approx.variance, approx.lattice, approx.preferred ? " (preferred)" : "");
+		fails++;
+	}
+	cumulative = 0;
+	max_difference = 0;
+	for(size_t i = 0; i < dist.length; i++) {
+		cumulative += dist.probabilities[i];
+		difference = fabs(die_approx_cdf(&approx, dist.values[i]) - cumulative);
+		if(difference > max_difference)
+			max_difference = difference;
+	}
+	// (Without the Edgeworth terms, the CDF is off by up to about 3e-4 here).
+	if(max_difference > 1e-4 || approx.error_bound < max_difference) {
+		fprintf(stderr, "(100d6) The CDF is off by up to %lf (bound %lf).\n", max_difference, approx.error_bound);
+		fails++;
+	}
+	for(double q = 0.05; q < 1; q += 0.15) {
+		quantile = die_approx_quantile(&approx, q);
+		if(quantile != floor(quantile) || die_approx_cdf(&approx, quantile) < q
+				|| die_approx_cdf(&approx, quantile - 1) >= q) {
+			fprintf(stderr, "(100d6) The %lf quantile is %lf.\n", q, quantile);
+			fails++;
+		}
+	}
+	sum = 0;
+	for(size_t i = 0; i < sample_count; i++) {
+		sample = die_approx_sample(&approx);
+		if(sample != floor(sample) || sample < 100 || sample > 600) {
+			fprintf(stderr, "(100d6) Sampled %lf.\n", sample);
+			fails++;
+			break;
+		}
+		sum += sample;
+	}
+	// (The standard deviation of the mean is 0.17).
+	if(fabs(sum / sample_count - 350) > 1) {
+		fprintf(stderr, "(100d6) The mean of the samples is %lf.\n", sum / sample_count);
+		fails++;
+	}
+	clear_die_distribution(&dist);
+	clear_operation_pointer(operation);
+
+	// Scaled: the results are 2k - 5.
+	if(!(operation = exp_to_op("2*(10d6)-5", &errors))) {
+		fputs("(2*(10d6)-5) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(op_normal_approx(operation, &approx)) {
+		fputs("(2*(10d6)-5) op_normal_approx failed.\n", stderr);
+		fails++;
+	} else if(COMP_DBLS(approx.mean, 65) != 0 || COMP_DBLS(approx.variance, 4 * 10 * 35 / 12.0) != 0
+			|| approx.lattice != 2 || fmod(die_approx_quantile(&approx, 0.3) + 5, 2) != 0) {
+		fprintf(stderr, "(2*(10d6)-5) Got mean %lf, variance %lf, lattice %lf.\n",
+				approx.mean, approx.variance, approx.lattice);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	// Giant pool.
+	if(!(operation = exp_to_op("50000d20+30000d6", &errors))) {
+		fputs("(50000d20+30000d6) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(op_normal_approx(operation, &approx)) {
+		fputs("(50000d20+30000d6) op_normal_approx failed.\n", stderr);
+		fails++;
+	} else if(COMP_DBLS(approx.mean, 630000) != 0 || !approx.preferred
+			|| fabs(die_approx_quantile(&approx, 0.5) - 630000) > 1
+			|| fabs(die_approx_cdf(&approx, 630000) - 0.5) > 0.001) {
+		fprintf(stderr, "(50000d20+30000d6) Got mean %lf, median %lf, error bound %lf%s.\n",
+				approx.mean, die_approx_quantile(&approx, 0.5), approx.error_bound,
+				approx.preferred ? " (preferred)" : "");
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+/* Check op_cost_estimate of dice_exp against the expected costs. Return 1 on failure. */
+int test_op_cost(char *dice_exp, uint64_t ex_dice, uint64_t ex_calc_string_bytes, uint64_t ex_sections)
+{
+	struct Operation *operation;
+	struct Dierror *errors;
+	struct die_op_cost cost;
+
+	if(!(operation = exp_to_op(dice_exp, &errors))) {
+		fprintf(stderr, "(%s) exp_to_op failed.\n", dice_exp);
+		free(errors);
+		return 1;
+	}
+	op_cost_estimate(operation, &cost);
+	clear_operation_pointer(operation);
+
+	if(cost.dice != ex_dice || cost.calc_string_bytes != ex_calc_string_bytes || cost.sections != ex_sections
+			|| cost.estimated_ns == 0) {
+		fprintf(stderr, "(%s) Expected %" PRIu64 " dice, %" PRIu64 " bytes, %" PRIu64 " sections, but got "
+				"%" PRIu64 ", %" PRIu64 ", %" PRIu64 " (%" PRIu64 "ns).\n", dice_exp,
+				ex_dice, ex_calc_string_bytes, ex_sections,
+				cost.dice, cost.calc_string_bytes, cost.sections, cost.estimated_ns);
+		return 1;
+	}
+	return 0;
+}
+
+int op_cost_tester()
+{
+	int fails = 0;
+	struct die_op_limits limits = { .max_dice = 100 };
+
+	fails += test_op_cost("d20+5", 1, sizeof("20+5.0000"), 3);
+	fails += test_op_cost("1+2*3", 0, sizeof("1.0000+2.0000*3.0000"), 5);
+	fails += test_op_cost("3x2d6+1", 6, 3 * sizeof("6+6+1.0000"), 3);
+	fails += test_op_cost("4000000000d1000000", 4000000000, 32000000000, 2);
+	fails += test_op_cost("4000000000x4000000000d1000000", 16000000000000000000u, UINT64_MAX, 2);
+
+	// Limits of the thread.
+	die_set_thread_op_limits(&limits);
+	fails += test_op_cost("100d6", 100, 2 * 100, 2);
+	fails += test_exp_to_op("101d6", NULL, 1, exceeds_limits);
+	fails += test_exp_to_op("2x60d6", NULL, 1, exceeds_limits);
+	fails += test_exp_to_op("50d6+51d4", NULL, 1, exceeds_limits);
+	fails += test_exp_to_op("4000000000d1000000", NULL, 1, exceeds_limits);
+	fails += test_exp_to_op("101d6+", NULL, 1, missing_num);	// (Not checked if the expression is invalid).
+
+	// Limits of all threads (overridden by the thread's until it unsets them).
+	die_set_op_limits(&(struct die_op_limits) { .max_estimated_ns = 1000 });
+	fails += test_op_cost("100d6", 100, 2 * 100, 2);
+	die_set_thread_op_limits(NULL);
+	fails += test_exp_to_op("100d6", NULL, 1, exceeds_limits);
+	fails += test_op_cost("d20+5", 1, sizeof("20+5.0000"), 3);
+
+	die_set_op_limits(NULL);
+	fails += test_op_cost("100d6", 100, 2 * 100, 2);
+
+	return fails;
+}
+
+int operate_bound_tester()
+{
+	int fails = 0;
+	struct Operation *operation;
+	struct Dierror *errors;
+	char *calc_string;
+	double result;
+	const double values[] = { 2.5, -4 };
+
+	if(!(operation = exp_to_op("3d1*$1+$0", &errors))) {
+		fputs("(3d1*$1+$0) exp_to_op failed.\n", stderr);
+		free(errors);
+		return 1;
+	}
+
+	if(get_slot_count(operation) != 2) {
+		fprintf(stderr, "(3d1*$1+$0) Expected 2 slots but got %u.\n", get_slot_count(operation));
+		fails++;
+	}
+	if(operation->integral) {
+		fputs("(3d1*$1+$0) Placeholders may not be integral.\n", stderr);
+		fails++;
+	}
+
+	calc_string = alloca(get_calc_string_length(operation));
+	result = operate_bound(operation, values, calc_string, NO_FLAG);
+	if(COMP_DBLS(result, -9.5) != 0 || strcmp(calc_string, "(1+1+1)*-4+2.5") != 0) {
+		fprintf(stderr, "(3d1*$1+$0) Expected -9.5 \"(1+1+1)*-4+2.5\" but got %lf \"%s\".\n",
+				result, calc_string);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	fails += test_exp_to_op("d20+$", NULL, 1, invalid_placeholder);
+	fails += test_exp_to_op("d20+$4294967295", NULL, 1, invalid_placeholder);
+	fails += test_exp_to_op("d20+$4294967296", NULL, 1, invalid_placeholder);
+	fails += test_exp_to_op("$0d20", NULL, 1, invalid_placeholder);	// (Not dice counts or sides).
+	fails += test_exp_to_op("d$0", NULL, 1, invalid_sides);
+
+	// Named placeholders.
+	if(!(operation = exp_to_op_named("3d1*$dex+$str", (const char*[]) {"str", "dex"}, 2, &errors))) {
+		fputs("(3d1*$dex+$str) exp_to_op_named failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	calc_string = alloca(get_calc_string_length(operation));
+	result = operate_bound(operation, values, calc_string, NO_FLAG);
+	if(get_slot_count(operation) != 2 || COMP_DBLS(result, -9.5) != 0
+			|| strcmp(calc_string, "(1+1+1)*-4+2.5") != 0) {
+		fprintf(stderr, "(3d1*$dex+$str) Expected 2 slots, -9.5 \"(1+1+1)*-4+2.5\" but got %u, %lf \"%s\".\n",
+				get_slot_count(operation), result, calc_string);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	if((operation = exp_to_op_named("d20+$dexterity", (const char*[]) {"dex"}, 1, &errors))
+			|| !errors || errors[0].type != invalid_placeholder) {
+		fputs("(d20+$dexterity) Expected an invalid_placeholder error (for an unknown name).\n", stderr);
+		if(operation)
+			clear_operation_pointer(operation);
+		fails++;
+	}
+	free(errors);
+	fails += test_exp_to_op("d20+$str", NULL, 1, invalid_placeholder);	// (No names).
+
+	return fails;
+}
+
+int operate_repeat_tester()
+{
+	int fails = 0;
+	struct Operation *operation;
+	struct Dierror *errors;
+	char *calc_string;
+	double results[3];
+	size_t offsets[3];
+
+	if(!(operation = exp_to_op("3x2d1*2", &errors))) {
+		fputs("(3x2d1*2) exp_to_op failed.\n", stderr);
+		free(errors);
+		return 1;
+	}
+
+	if(operation->repetitions != 3) {
+		fprintf(stderr, "(3x2d1*2) Expected 3 repetitions but got %u.\n", operation->repetitions);
+		clear_operation_pointer(operation);
+		return 1;
+	}
+
+	calc_string = alloca(get_repeat_calc_string_length(operation));
+	operate_repeat(operation, results, calc_string, offsets, NO_FLAG);
+	for(unsigned i = 0; i < 3; i++) {
+		if(COMP_DBLS(results[i], 4.0) != 0 || strcmp(calc_string + offsets[i], "(1+1)*2") != 0) {
+			fprintf(stderr, "(3x2d1*2) Expected repetition %u to be 4 \"(1+1)*2\" but got %lf \"%s\".\n",
+					i, results[i], calc_string + offsets[i]);
+			fails++;
+		}
+	}
+	if(offsets[1] != offsets[0] + strlen("(1+1)*2") + 1) {
+		fputs("(3x2d1*2) Calculation strings are not consecutive.\n", stderr);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	fails += test_exp_to_op("0x4d6", NULL, 1, zero_reps);
+	fails += test_exp_to_op("6x", NULL, 1, empty_expression);
+	fails += test_exp_to_op("6x2x4d6", NULL, 1, invalid_reps);
+	fails += test_exp_to_op("4294967296x1", NULL, 1, invalid_reps);	// (UINT_MAX + 1 and + 3, not wrapped).
+	fails += test_exp_to_op("4294967298x1", NULL, 1, invalid_reps);
+	fails += test_exp_to_op("4294967296d6", NULL, 1, invalid_reps);
+
+	if(!(operation = exp_to_op("4294967295x1", &errors)) || operation->repetitions != 4294967295u) {
+		fputs("(4294967295x1) Expected 4294967295 repetitions.\n", stderr);
+		fails++;
+	}
+	if(operation)
+		clear_operation_pointer(operation);
+	else
+		free(errors);
+
+	if(!(operation = exp_to_op("4294967295x4294967295d1000000", &errors))
+			|| get_repeat_calc_string_length(operation) != SIZE_MAX) {
+		fputs("(4294967295x4294967295d1000000) Expected a saturated calculation string length.\n", stderr);
+		fails++;
+	}
+	if(operation)
+		clear_operation_pointer(operation);
+	else
+		free(errors);
+
+	return fails;
+}
+
+int op_serialize_tester()
+{
+	int fails = 0;
+	char *dice_exps[] = {"4d6+2", "6x3d20*2-d4", "-d20/3+1.5", "2*(d8-(d10^2))%5", "-(d4+1)*2", "d100+$1*$0", "1.25"};
+	struct Operation *operation;
+	struct Operation *loaded;
+	struct Dierror *errors;
+	unsigned char *buffer;
+	size_t size;
+	size_t used;
+	char *calc_string;
+	char *loaded_calc_string;
+	double values[] = {2, 3};
+	double result;
+	double loaded_result;
+
+	for(size_t i = 0; i < sizeof(dice_exps) / sizeof(*dice_exps); i++) {
+		if(!(operation = exp_to_op(dice_exps[i], &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", dice_exps[i]);
+			free(errors);
+			fails++;
+			continue;
+		}
+
+		// Serialize twice in a row, 1 byte off alignment.
+		size = op_serialize(operation, NULL, 0);
+		buffer = malloc(1 + 2 * size);
+		if(op_serialize(operation, buffer + 1, size) != size
+				|| op_serialize(operation, buffer + 1 + size, size) != size) {
+			fprintf(stderr, "(%s) op_serialize returned a different size.\n", dice_exps[i]);
+			fails++;
+		}
+
+		for(int copy = 0; copy < 2; copy++) {
+			if(!(loaded = op_deserialize(buffer + 1 + copy * size, (2 - copy) * size, &used))) {
+				fprintf(stderr, "(%s) op_deserialize failed.\n", dice_exps[i]);
+				fails++;
+				continue;
+			}
+
+			if(used != size || comp_operations(operation, loaded)
+					|| loaded->repetitions != operation->repetitions
+					|| loaded->integral != operation->integral
+					|| loaded->evaluator != operation->evaluator) {
+				fprintf(stderr, "(%s) The loaded operation is different.\n", dice_exps[i]);
+				fails++;
+			}
+
+			calc_string = alloca(get_calc_string_length(operation));
+			loaded_calc_string = alloca(get_calc_string_length(loaded));
+			srand(i);
+			result = operate_bound(operation, values, calc_string, NO_FLAG);
+			srand(i);
+			loaded_result = operate_bound(loaded, values, loaded_calc_string, NO_FLAG);
+			if(COMP_DBLS(result, loaded_result) != 0 || strcmp(calc_string, loaded_calc_string) != 0) {
+				fprintf(stderr, "(%s) Calculated %lf \"%s\" but the loaded operation %lf \"%s\".\n",
+						dice_exps[i], result, calc_string, loaded_result, loaded_calc_string);
+				fails++;
+			}
+
+			clear_operation_pointer(loaded);
+		}
+
+		// Invalid data.
+		if((loaded = op_deserialize(buffer + 1, size - 1, NULL))) {
+			fprintf(stderr, "(%s) op_deserialize accepted truncated data.\n", dice_exps[i]);
+			clear_operation_pointer(loaded);
+			fails++;
+		}
+		buffer[1 + 4]++;	// (Version).
+		if((loaded = op_deserialize(buffer + 1, size, NULL))) {
+			fprintf(stderr, "(%s) op_deserialize accepted another version.\n", dice_exps[i]);
+			clear_operation_pointer(loaded);
+			fails++;
+		}
+		buffer[1 + 4]--;
+		buffer[1 + 16] = 2;	// (Parenthesis).
+		if((loaded = op_deserialize(buffer + 1, size, NULL))) {
+			fprintf(stderr, "(%s) op_deserialize accepted a parenthesis byte of 2.\n", dice_exps[i]);
+			clear_operation_pointer(loaded);
+			fails++;
+		}
+		buffer[1 + 16] = operation->parenthesis;
+		if(NumSection_list_length(&operation->numbers) > 1) {
+			buffer[size] = 'x';	// (The last operator).
+			if((loaded = op_deserialize(buffer + 1, size, NULL))) {
+				fprintf(stderr, "(%s) op_deserialize accepted an invalid operator.\n", dice_exps[i]);
+				clear_operation_pointer(loaded);
+				fails++;
+			}
+		}
+
+		free(buffer);
+		clear_operation_pointer(operation);
+	}
+
+	// A slot index exp_to_op wouldn't accept (get_slot_count would wrap around).
+	if(!(operation = exp_to_op("$7", &errors))) {
+		fputs("($7) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	size = op_serialize(operation, NULL, 0);
+	buffer = malloc(size);
+	op_serialize(operation, buffer, size);
+	memset(buffer + 16 + 1 + 1 + 4 + 1, 0xFF, 4);	// (Header, parenthesis, prefix, count, type).
+	if((loaded = op_deserialize(buffer, size, NULL))) {
+		fputs("($4294967295) op_deserialize accepted an invalid slot index.\n", stderr);
+		clear_operation_pointer(loaded);
+		fails++;
+	}
+	free(buffer);
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+int flat_operation_tester()
+{
+	int fails = 0;
+	char *dice_exps[] = {"4d6+2", "3d20*2-d4", "-d20/3+1.5", "2*(d8-(d10^2))%5", "-(d4+1)*[2-d6]",
+		"d100+$1*($0-d4)", "((((1+d2)*2)-d3)/4)", "1.25"};
+	struct Operation *operation;
+	struct flat_operation *flat;
+	struct Dierror *errors;
+	double values[] = {2, 3};
+	double result;
+	double flat_result;
+	char *dice_exp;
+	struct flat_operation loaded;
+	char *buffer;
+	size_t size;
+	size_t used;
+	size_t types_offset;
+	size_t operators_offset;
+
+	for(size_t i = 0; i < sizeof(dice_exps) / sizeof(*dice_exps); i++) {
+		if(!(operation = exp_to_op(dice_exps[i], &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", dice_exps[i]);
+			free(errors);
+			fails++;
+			continue;
+		}
+		if(!(flat = op_to_flat(operation))) {
+			fprintf(stderr, "(%s) op_to_flat failed.\n", dice_exps[i]);
+			clear_operation_pointer(operation);
+			fails++;
+			continue;
+		}
+
+		if(flat_get_slot_count(flat) != get_slot_count(operation)) {
+			fprintf(stderr, "(%s) flat_get_slot_count returned %u instead of %u.\n",
+					dice_exps[i], flat_get_slot_count(flat), get_slot_count(operation));
+			fails++;
+		}
+		if(flat->depth != get_operation_depth(operation) || flat->integral != operation->integral) {
+			fprintf(stderr, "(%s) The depth is %u instead of %u, integral %d instead of %d.\n", dice_exps[i],
+					flat->depth, get_operation_depth(operation), flat->integral, operation->integral);
+			fails++;
+		}
+
+		for(unsigned seed = 0; seed < 20; seed++) {
+			srand(seed);
+			result = operate_bound(operation, values, NULL, NO_FLAG);
+			srand(seed);
+			flat_result = flat_operate(flat, values);
+			if(COMP_DBLS(result, flat_result) != 0) {
+				fprintf(stderr, "(%s) flat_operate returned %lf instead of %lf.\n",
+						dice_exps[i], flat_result, result);
+				fails++;
+				break;
+			}
+		}
+
+		// Saved, and calculated where it was loaded.
+		size = flat_serialize(flat, NULL, 0);
+		if(!(buffer = malloc(size)) || flat_serialize(flat, buffer, size) != size || size % 8 != 0
+				|| flat_load(buffer, size, &loaded, &used) || used != size
+				|| (char*) loaded.values < buffer || (char*) loaded.operators >= buffer + size) {
+			fprintf(stderr, "(%s) The flat operation wasn't loaded in place.\n", dice_exps[i]);
+			fails++;
+		} else {
+			for(unsigned seed = 0; seed < 20; seed++) {
+				srand(seed);
+				result = operate_bound(operation, values, NULL, NO_FLAG);
+				srand(seed);
+				flat_result = flat_operate(&loaded, values);
+				if(COMP_DBLS(result, flat_result) != 0) {
+					fprintf(stderr, "(%s) flat_operate returned %lf instead of %lf once loaded.\n",
+							dice_exps[i], flat_result, result);
+					fails++;
+					break;
+				}
+			}
+
+			// (Offsets in the header, and of the section types and operators).
+			types_offset = 32 + flat->section_count * (8 + 4 + 4);
+			operators_offset = types_offset + flat->section_count * 2;
+			if(!flat_load(buffer, size - 1, &loaded, NULL)) {
+				fprintf(stderr, "(%s) flat_load accepted truncated data.\n", dice_exps[i]);
+				fails++;
+			}
+			buffer[types_offset] = type_op;	// (Pops a value before any was pushed).
+			if(!flat_load(buffer, size, &loaded, NULL)) {
+				fprintf(stderr, "(%s) flat_load accepted a parenthesis without sections.\n", dice_exps[i]);
+				fails++;
+			}
+			buffer[types_offset] = flat->section_types[0];
+			buffer[operators_offset] = '+';	// (Combines with no value).
+			if(!flat_load(buffer, size, &loaded, NULL)) {
+				fprintf(stderr, "(%s) flat_load accepted an operator before the first section.\n",
+						dice_exps[i]);
+				fails++;
+			}
+			buffer[operators_offset] = '\0';
+			buffer[24] = 1;	// (Integral).
+			if(get_slot_count(operation) != 0 && !flat_load(buffer, size, &loaded, NULL)) {
+				fprintf(stderr, "(%s) flat_load accepted placeholders in an integral operation.\n",
+						dice_exps[i]);
+				fails++;
+			}
+		}
+		free(buffer);
+
+		clear_flat_operation(flat);
+		clear_operation_pointer(operation);
+	}
+
+	// The sections in the order they're calculated (the parenthesis before its type_op section).
+	if(!(operation = exp_to_op("-(d8-1)*2", &errors))) {
+		fputs("(-(d8-1)*2) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(!(flat = op_to_flat(operation))) {
+		fputs("(-(d8-1)*2) op_to_flat failed.\n", stderr);
+		fails++;
+	} else {
+		// ("-" applies to the product, which is an operation of its own.)
+		if(flat->section_count != 5 || flat->section_types[0] != type_die || flat->section_types[1] != type_num
+				|| flat->section_types[2] != type_op || flat->section_types[3] != type_num
+				|| flat->section_types[4] != type_op || memcmp(flat->operators, "\0-\0*\0", 5) != 0) {
+			fputs("(-(d8-1)*2) The sections aren't in the order they're calculated.\n", stderr);
+			fails++;
+		}
+		clear_flat_operation(flat);
+	}
+	clear_operation_pointer(operation);
+
+	// Deeper than the stack of flat_operate (so it allocates one).
+	dice_exp = malloc(40 + 2 + 3 * 40 + 1);
+	memset(dice_exp, '(', 40);
+	strcpy(dice_exp + 40, "d6");
+	for(int i = 0; i < 40; i++)
+		strcat(dice_exp, "*2)");
+	if(!(operation = exp_to_op(dice_exp, &errors))) {
+		fputs("(40 parenthesis) exp_to_op failed.\n", stderr);
+		free(errors);
+		free(dice_exp);
+		return fails + 1;
+	}
+	if(!(flat = op_to_flat(operation))) {
+		fputs("(40 parenthesis) op_to_flat failed.\n", stderr);
+		fails++;
+	} else {
+		srand(1);
+		result = operate(operation, NULL, NO_FLAG);
+		srand(1);
+		flat_result = flat_operate(flat, NULL);
+		if(flat->depth != 41 || COMP_DBLS(flat_result, result) != 0) {
+			fprintf(stderr, "(40 parenthesis) depth %u, flat_operate returned %lf instead of %lf.\n",
+					flat->depth, flat_result, result);
+			fails++;
+		}
+		clear_flat_operation(flat);
+	}
+	clear_operation_pointer(operation);
+	free(dice_exp);
+
+	// The biggest slot index (its count must not wrap around).
+	if(!(operation = exp_to_op("d4+$65535", &errors))) {
+		fputs("(d4+$65535) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	if(!(flat = op_to_flat(operation))) {
+		fputs("(d4+$65535) op_to_flat failed.\n", stderr);
+		fails++;
+	} else {
+		if(flat_get_slot_count(flat) != DIE_MAX_SLOT_COUNT) {
+			fprintf(stderr, "(d4+$65535) flat_get_slot_count returned %u instead of %u.\n",
+					flat_get_slot_count(flat), DIE_MAX_SLOT_COUNT);
+			fails++;
+		}
+		clear_flat_operation(flat);
+	}
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+int operate_batch_tester()
+{
+	int fails = 0;
+	// Deterministic expressions (dice of 1 side), and their results.
+	struct {
+		char *dice_exp;
+		double result;
+	} exact[] = {
+		{"2d1*3+1", 7},
+		{"-(2d1+1)*2", -6},
+		{"d1+$0*($1-d1)", 1 + 2 * (3 - 1)},
+		{"((d1+1)^3)%5/2", 1.5},
+		{"1.25", 1.25},
+		{"2d1*3<6", 0},
+		{"d1+$0<=$1==1", 1},
+	};
+	// (Not a multiple of the block size).
+	const size_t count = 2500;
+	struct Operation *operation;
+	struct Dierror *errors;
+	double values[] = {2, 3};
+	double *results;
+	double sum;
+
+	if(!(results = malloc(count * sizeof(*results)))) {
+		fputs("malloc failed.\n", stderr);
+		return 1;
+	}
+
+	for(size_t i = 0; i < sizeof(exact) / sizeof(*exact); i++) {
+		if(!(operation = exp_to_op(exact[i].dice_exp, &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", exact[i].dice_exp);
+			free(errors);
+			fails++;
+			continue;
+		}
+
+		if(operate_batch(operation, results, count, values)) {
+			fprintf(stderr, "(%s) operate_batch failed.\n", exact[i].dice_exp);
+			fails++;
+		} else {
+			for(size_t trial = 0; trial < count; trial++) {
+				if(COMP_DBLS(results[trial], exact[i].result) != 0) {
+					fprintf(stderr, "(%s) operate_batch returned %lf instead of %lf (trial %zu).\n",
+							exact[i].dice_exp, results[trial], exact[i].result, trial);
+					fails++;
+					break;
+				}
+			}
+		}
+
+		clear_operation_pointer(operation);
+	}
+
+	// Rolls are in range, and the mean is about right.
+	if(!(operation = exp_to_op("d6", &errors))) {
+		fputs("(d6) exp_to_op failed.\n", stderr);
+		free(errors);
+		free(results);
+		return fails + 1;
+	}
+	srand(1);
+	if(operate_batch(operation, results, count, NULL)) {
+		fputs("(d6) operate_batch failed.\n", stderr);
+		fails++;
+	} else {
+		sum = 0;
+		for(size_t trial = 0; trial < count; trial++) {
+			if(results[trial] < 1 || results[trial] > 6) {
+				fprintf(stderr, "(d6) operate_batch returned %lf.\n", results[trial]);
+				fails++;
+				break;
+			}
+			sum += results[trial];
+		}
+		if(sum / count < 3.3 || sum / count > 3.7) {
+			fprintf(stderr, "(d6) operate_batch's mean is %lf.\n", sum / count);
+			fails++;
+		}
+	}
+	clear_operation_pointer(operation);
+
+	free(results);
+	return fails;
+}
+
+/* Check histogram counts trials results, and that each bin has about expected of them
+ * (within 5%, expected may be NULL to skip it). */
+int check_histogram(const char *dice_exp, const struct die_histogram *histogram, uint64_t trials,
+		const double *expected)
+{
+	int fails = 0;
+	uint64_t total = histogram->below + histogram->above;
+
+	for(size_t bin = 0; bin < histogram->bin_count; bin++) {
+		total += histogram->bins[bin];
+		if(expected && fabs(histogram->bins[bin] / (double) trials - expected[bin]) > 0.05 * expected[bin]) {
+			fprintf(stderr, "(%s) bin %zu has %" PRIu64 " results, expected about %lf.\n",
+					dice_exp, bin, histogram->bins[bin], expected[bin] * trials);
+			fails++;
+		}
+	}
+	if(total != trials) {
+		fprintf(stderr, "(%s) The histogram counts %" PRIu64 " results instead of %" PRIu64 ".\n",
+				dice_exp, total, trials);
+		fails++;
+	}
+
+	return fails;
+}
+
+int operate_histogram_tester()
+{
+	int fails = 0;
+	// (Enough trials to be split between threads).
+	const uint64_t trials = 1 << 20;
+	const double d6_expected[] = {1/6., 1/6., 1/6., 1/6., 1/6., 1/6.};
+	const double two_d6_expected[] = {1/36., 2/36., 3/36., 4/36., 5/36., 6/36., 5/36., 4/36., 3/36.,
+		2/36., 1/36.};
+	// d4/2 in bins of width 1 from 1: [0.5] below, [1, 1.5] in bins[0], [2] above.
+	const double halves_expected[] = {0.5};
+	struct Operation *operation;
+	struct Dierror *errors;
+	struct die_histogram histogram;
+
+	// Exact bins.
+	struct {
+		char *dice_exp;
+		double first;
+		size_t bin_count;
+		const double *expected;
+	} exact[] = {
+		{"d6", 1, 6, d6_expected},
+		{"2d6", 2, 11, two_d6_expected},
+		{"-(d6+1)", -7, 6, d6_expected},
+		{"d1*4", 4, 1, NULL},
+	};
+
+	for(size_t i = 0; i < sizeof(exact) / sizeof(*exact); i++) {
+		if(!(operation = exp_to_op(exact[i].dice_exp, &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", exact[i].dice_exp);
+			free(errors);
+			fails++;
+			continue;
+		}
+
+		histogram.bin_count = 0;
+		if(operate_histogram(operation, trials, &histogram)) {
+			fprintf(stderr, "(%s) operate_histogram failed.\n", exact[i].dice_exp);
+			fails++;
+			clear_operation_pointer(operation);
+			continue;
+		}
+		if(COMP_DBLS(histogram.first, exact[i].first) != 0 || COMP_DBLS(histogram.width, 1) != 0
+				|| histogram.bin_count != exact[i].bin_count) {
+			fprintf(stderr, "(%s) Exact bins start at %lf (width %lf, %zu bins) instead of %lf (%zu bins).\n",
+					exact[i].dice_exp, histogram.first, histogram.width, histogram.bin_count,
+					exact[i].first, exact[i].bin_count);
+			fails++;
+		} else {
+			fails += check_histogram(exact[i].dice_exp, &histogram, trials, exact[i].expected);
+			if(histogram.below != 0 || histogram.above != 0) {
+				fprintf(stderr, "(%s) Results out of the exact bins.\n", exact[i].dice_exp);
+				fails++;
+			}
+		}
+
+		clear_die_histogram(&histogram);
+		clear_operation_pointer(operation);
+	}
+
+	// Given bins.
+	if(!(operation = exp_to_op("d4/2", &errors))) {
+		fputs("(d4/2) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+
+	histogram.bin_count = 0;
+	if(!operate_histogram(operation, trials, &histogram)) {
+		fputs("(d4/2) operate_histogram used exact bins for a non-integer operation.\n", stderr);
+		clear_die_histogram(&histogram);
+		fails++;
+	}
+
+	histogram.first = 1;
+	histogram.width = 1;
+	histogram.bin_count = 1;
+	if(operate_histogram(operation, 1000, &histogram)) {
+		fputs("(d4/2) operate_histogram failed.\n", stderr);
+		fails++;
+	} else {
+		fails += check_histogram("d4/2", &histogram, 1000, NULL);
+		clear_die_histogram(&histogram);
+	}
+	if(operate_histogram(operation, trials, &histogram)) {
+		fputs("(d4/2) operate_histogram failed.\n", stderr);
+		fails++;
+	} else {
+		fails += check_histogram("d4/2", &histogram, trials, halves_expected);
+		if(fabs(histogram.below / (double) trials - 0.25) > 0.0125
+				|| fabs(histogram.above / (double) trials - 0.25) > 0.0125) {
+			fprintf(stderr, "(d4/2) %" PRIu64 " results below and %" PRIu64 " above, expected about %lf.\n",
+					histogram.below, histogram.above, trials * 0.25);
+			fails++;
+		}
+		clear_die_histogram(&histogram);
+	}
+
+	clear_operation_pointer(operation);
+	return fails;
+}
+
+int die_stats_acc_tester()
+{
+	int fails = 0;
+	// Values 0 to count - 1, in a scrambled order (7919 is prime, so it's a permutation).
+	const size_t count = 100000;
+	struct die_stats_acc acc, half_acc, other_half_acc;
+	struct Operation *operation;
+	struct Dierror *errors;
+	double *values;
+	double quantile;
+
+	if(!(values = malloc(count * sizeof(*values)))) {
+		fputs("malloc failed.\n", stderr);
+		return 1;
+	}
+	for(size_t i = 0; i < count; i++)
+		values[i] = (i * 7919) % count;
+
+	// Few values: exact.
+	die_stats_acc_init(&acc);
+	for(int i = 1; i <= 5; i++)
+		die_stats_acc_add(&acc, i);
+	die_stats_acc_add(&acc, NAN);
+	if(acc.count != 5 || acc.nan_count != 1 || COMP_DBLS(acc.mean, 3) != 0
+			|| COMP_DBLS(die_stats_acc_variance(&acc), 2) != 0
+			|| COMP_DBLS(acc.min, 1) != 0 || COMP_DBLS(acc.max, 5) != 0) {
+		fprintf(stderr, "(1 to 5) count %" PRIu64 " (%" PRIu64 " NaN), mean %lf, variance %lf, min %lf, max %lf.\n",
+				acc.count, acc.nan_count, acc.mean, die_stats_acc_variance(&acc), acc.min, acc.max);
+		fails++;
+	}
+	if(COMP_DBLS((quantile = die_stats_acc_quantile(&acc, 0.5)), 3) != 0) {
+		fprintf(stderr, "(1 to 5) The median is %lf instead of 3.\n", quantile);
+		fails++;
+	}
+	clear_die_stats_acc(&acc);
+
+	// Cleared: the statistics remain, but there are no values for the quantiles between the min and max.
+	if(acc.count != 5 || !isnan((quantile = die_stats_acc_quantile(&acc, 0.5)))
+			|| COMP_DBLS(die_stats_acc_quantile(&acc, 0), 1) != 0) {
+		fprintf(stderr, "(1 to 5, cleared) count %" PRIu64 ", median %lf (should be NaN).\n", acc.count, quantile);
+		fails++;
+	}
+
+	// Many values, added one at a time, as an array, and merged from two halves.
+	die_stats_acc_init(&acc);
+	die_stats_acc_init(&half_acc);
+	die_stats_acc_init(&other_half_acc);
+	for(size_t i = 0; i < count; i++)
+		fails += die_stats_acc_add(&acc, values[i]);
+	fails += die_stats_acc_add_array(&half_acc, values, count / 2);
+	fails += die_stats_acc_add_array(&other_half_acc, values + count / 2, count - count / 2);
+	fails += die_stats_acc_merge(&half_acc, &other_half_acc);
+
+	for(struct die_stats_acc *checked = &acc; checked; checked = (checked == &acc) ? &half_acc : NULL) {
+		if(checked->count != count || COMP_DBLS(checked->mean, (count - 1) / 2.0) != 0
+				|| fabs(die_stats_acc_variance(checked) / (((double) count * count - 1) / 12) - 1) > 1e-9
+				|| COMP_DBLS(checked->min, 0) != 0 || COMP_DBLS(checked->max, count - 1) != 0) {
+			fprintf(stderr, "(0 to %zu%s) count %" PRIu64 ", mean %lf, variance %lf, min %lf, max %lf.\n",
+					count - 1, (checked == &acc) ? "" : ", merged", checked->count, checked->mean,
+					die_stats_acc_variance(checked), checked->min, checked->max);
+			fails++;
+		}
+		for(double q = 0; q <= 1; q += 0.125) {
+			quantile = die_stats_acc_quantile(checked, q);
+			if(fabs(quantile - q * (count - 1)) > 0.02 * count) {
+				fprintf(stderr, "(0 to %zu%s) The %lf quantile is %lf.\n",
+						count - 1, (checked == &acc) ? "" : ", merged", q, quantile);
+				fails++;
+			}
+		}
+	}
+
+	clear_die_stats_acc(&acc);
+	clear_die_stats_acc(&half_acc);
+	clear_die_stats_acc(&other_half_acc);
+	free(values);
+
+	// Fed by operate_accumulate.
+	if(!(operation = exp_to_op("2d6", &errors))) {
+		fputs("(2d6) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	die_stats_acc_init(&acc);
+	if(operate_accumulate(operation, 1 << 20, &acc)) {
+		fputs("(2d6) operate_accumulate failed.\n", stderr);
+		fails++;
+	} else if(acc.count != 1 << 20 || fabs(acc.mean - 7) > 0.05
+			|| fabs(die_stats_acc_variance(&acc) - 35 / 6.0) > 0.1
+			|| COMP_DBLS(acc.min, 2) != 0 || COMP_DBLS(acc.max, 12) != 0
+			|| COMP_DBLS(die_stats_acc_quantile(&acc, 0.5), 7) != 0) {
+		fprintf(stderr, "(2d6) count %" PRIu64 ", mean %lf, variance %lf, min %lf, max %lf, median %lf.\n",
+				acc.count, acc.mean, die_stats_acc_variance(&acc), acc.min, acc.max,
+				die_stats_acc_quantile(&acc, 0.5));
+		fails++;
+	}
+	clear_die_stats_acc(&acc);
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+int operate_token_tester()
+{
+	int fails = 0;
+	char *dice_exps[] = {"4d6+2", "3d20*2-d4", "d20/3+1.5", "2*(d8+d10)%5", "d100"};
+	struct Operation *operation;
+	struct Dierror *errors;
+	struct die_token token;
+	struct die_token next;
+	char *calc_string;
+	char *replayed_calc_string;
+	double result;
+	double replayed;
+	int rand_before;
+
+	for(size_t i = 0; i < sizeof(dice_exps) / sizeof(*dice_exps); i++) {
+		if(!(operation = exp_to_op(dice_exps[i], &errors))) {
+			fprintf(stderr, "(%s) exp_to_op failed.\n", dice_exps[i]);
+			free(errors);
+			fails++;
+			continue;
+		}
+		calc_string = alloca(get_calc_string_length(operation));
+		replayed_calc_string = alloca(get_calc_string_length(operation));
+
+		die_set_token_seed(i);
+		result = operate_token(operation, &token);
+		operate_token(operation, &next);
+		if(token.seed != i || next.seed != i || next.stream != token.stream + 1) {
+			fprintf(stderr, "(%s) Unexpected tokens (%" PRIu64 ", %" PRIu64 ") and (%" PRIu64 ", %" PRIu64 ").\n",
+					dice_exps[i], token.seed, token.stream, next.seed, next.stream);
+			fails++;
+		}
+
+		replayed = die_replay_calc_string(operation, &token, calc_string, NO_FLAG);
+		if(COMP_DBLS(result, replayed) != 0) {
+			fprintf(stderr, "(%s) operate_token returned %lf but the replay %lf (\"%s\").\n",
+					dice_exps[i], result, replayed, calc_string);
+			fails++;
+		}
+
+		die_replay_calc_string(operation, &token, replayed_calc_string, NO_FLAG);
+		if(strcmp(calc_string, replayed_calc_string) != 0) {
+			fprintf(stderr, "(%s) Replays differ: \"%s\" and \"%s\".\n",
+					dice_exps[i], calc_string, replayed_calc_string);
+			fails++;
+		}
+
+		// The same seed rolls the same.
+		die_set_token_seed(i);
+		replayed = operate_token(operation, &next);
+		if(COMP_DBLS(replayed, result) != 0) {
+			fprintf(stderr, "(%s) Resetting the seed didn't repeat the result.\n", dice_exps[i]);
+			fails++;
+		}
+
+		clear_operation_pointer(operation);
+	}
+
+	// rand() isn't used (or disturbed).
+	if((operation = exp_to_op("100d6", &errors))) {
+		srand(3);
+		rand_before = rand();
+		srand(3);
+		result = operate_token(operation, &token);
+		if(rand() != rand_before) {
+			fputs("(100d6) operate_token used rand().\n", stderr);
+			fails++;
+		}
+		if(result < 100 || result > 600) {
+			fprintf(stderr, "(100d6) operate_token returned %lf.\n", result);
+			fails++;
+		}
+		clear_operation_pointer(operation);
+	} else {
+		free(errors);
+		fails++;
+	}
+
+	return fails;
+}
+
+/* Check whether exp_to_op attaches a specialized evaluator to dice_exp, and that
+ * it gives the same result as the generic calculation for the same seed. */
+bool test_shape_evaluator(char *dice_exp, bool ex_evaluator)
+{
+	struct Operation *operation;
+	struct Dierror *errors;
+	double (*evaluator)(const struct Operation*);
+	double result, generic_result;
+	const time_t seed = time(NULL);
+	bool failed = false;
+
+	if(!(operation = exp_to_op(dice_exp, &errors))) {
+		fprint_identifier(stderr, dice_exp);
+		fputs("exp_to_op failed.\n", stderr);
+		free(errors);
+		return true;
+	}
+
+	evaluator = operation->evaluator;
+	if((evaluator != NULL) != ex_evaluator) {
+		fprint_identifier(stderr, dice_exp);
+		fprintf(stderr, "Expected %s evaluator.\n", ex_evaluator ? "an" : "no");
+		failed = true;
+	}
+
+	srand(seed);
+	result = operate(operation, NULL, NO_FLAG);
+	operation->evaluator = NULL;
+	srand(seed);
+	generic_result = operate(operation, NULL, NO_FLAG);
+	operation->evaluator = evaluator;
+
+	if(COMP_DBLS(result, generic_result) != 0) {
+		fprint_identifier(stderr, dice_exp);
+		fprintf(stderr, "Evaluator returned %lf but generic calculation returned %lf.\n",
+				result, generic_result);
+		failed = true;
+	}
+
+	clear_operation_pointer(operation);
+	return failed;
+}
+
+int shape_evaluator_tester()
+{
+	return test_shape_evaluator("d20", true)
+		+ test_shape_evaluator("3d6", true)
+		+ test_shape_evaluator("2d8+4.5", true)
+		+ test_shape_evaluator("d20-1", true)
+		+ test_shape_evaluator("2d6+d4+3", true)
+		+ test_shape_evaluator("8d10-3d4-2", true)
+		+ test_shape_evaluator("7", false)
+		+ test_shape_evaluator("-d20", false)
+		+ test_shape_evaluator("(d20)", false)
+		+ test_shape_evaluator("2d6*3", false)
+		+ test_shape_evaluator("d6+d6+d6", false)
+		+ test_shape_evaluator("d6+d6+d6+2", false);
+}
+
+int die_stats_tester()
+{
+	int fails = 0;
+	struct Operation *operation;
+	struct Dierror *errors;
+	struct die_stats before, after;
+	struct die_token token;
+	char calc_string[16];
+	bool enabled;
+
+	enabled = die_stats_snapshot(&before);
+
+	if(!(operation = exp_to_op("3d6+1", &errors))) {
+		fputs("(3d6+1) exp_to_op failed.\n", stderr);
+		free(errors);
+		return 1;
+	}
+	operate(operation, calc_string, NO_FLAG);
+	clear_operation_pointer(operation);
+	if(exp_to_op("2+", &errors) == NULL)
+		free(errors);
+
+	if(die_stats_snapshot(&after) != enabled) {
+		fputs("die_stats_snapshot returned differently between calls.\n", stderr);
+		return 1;
+	}
+
+	if(!enabled) {
+		if(after.dice_rolled != 0 || after.exp_to_op_calls != 0) {
+			fputs("Stats are disabled, yet the snapshot isn't zeroed.\n", stderr);
+			fails++;
+		}
+		return fails;
+	}
+
+	if(after.dice_rolled - before.dice_rolled != 3 || after.rng_draws - before.rng_draws != 3) {
+		fprintf(stderr, "Expected 3 dice rolled and drawn, but got %" PRIu64 " and %" PRIu64 ".\n",
+				after.dice_rolled - before.dice_rolled, after.rng_draws - before.rng_draws);
+		fails++;
+	}
+	if(after.calc_string_bytes - before.calc_string_bytes != strlen(calc_string)) {
+		fprintf(stderr, "Expected %zu calculation string bytes but got %" PRIu64 ".\n",
+				strlen(calc_string), after.calc_string_bytes - before.calc_string_bytes);
+		fails++;
+	}
+	if(after.exp_to_op_calls - before.exp_to_op_calls != 2 || after.operate_calls - before.operate_calls != 1) {
+		fputs("Expected 2 exp_to_op calls and 1 operate call to be counted.\n", stderr);
+		fails++;
+	}
+	if(after.parse_errors[missing_num] - before.parse_errors[missing_num] != 1) {
+		fputs("Expected a missing_num error to be counted.\n", stderr);
+		fails++;
+	}
+	if(after.allocations == before.allocations) {
+		fputs("Expected allocations to be counted.\n", stderr);
+		fails++;
+	}
+
+	// Rolled with a generator, which rejects about 30% of its draws for 1500000000 sides.
+	if(!(operation = exp_to_op("100d1500000000", &errors))) {
+		fputs("(100d1500000000) exp_to_op failed.\n", stderr);
+		free(errors);
+		return fails + 1;
+	}
+	die_stats_snapshot(&before);
+	operate_token(operation, &token);
+	die_stats_snapshot(&after);
+	if(after.dice_rolled - before.dice_rolled != 100 || after.rng_draws - before.rng_draws <= 100) {
+		fprintf(stderr, "(100d1500000000) Expected 100 dice rolled and more drawn, but got %" PRIu64
+				" and %" PRIu64 ".\n", after.dice_rolled - before.dice_rolled,
+				after.rng_draws - before.rng_draws);
+		fails++;
+	}
+	clear_operation_pointer(operation);
+
+	return fails;
+}
+
+// Count live allocations made through the test allocator.
+static long live_allocations;
+static long total_allocations;
+
+void* test_malloc(size_t size, void *context)
+{
+	void *ret;
+
+	if((ret = malloc(size))) {
+		live_allocations++;
+		total_allocations++;
+		*(bool*) context = true;
+	}
+	return ret;
+}
+
+void* test_realloc(void *ptr, size_t size, void *context)
+{
+	void *ret;
+
+	if((ret = realloc(ptr, size))) {
+		if(!ptr)
+			live_allocations++;
+		total_allocations++;
+		*(bool*) context = true;
+	}
+	return ret;
+}
+
+void test_free(void *ptr, void *context)
+{
+	(void) context;
+	if(ptr)
+		live_allocations--;
+	free(ptr);
+}
+
+int die_allocator_tester()
+{
+	int fails = 0;
+	struct Operation *operation;
+	struct Dierror *errors;
+	bool used = false;
+	const struct die_allocator allocator = {
+		.malloc = test_malloc,
+		.realloc = test_realloc,
+		.free = test_free,
+		.context = &used
+	};
+
+	live_allocations = total_allocations = 0;
+	die_set_thread_allocator(&allocator);
+
+	if((operation = exp_to_op("2d7+5/d6+4(d10)+1+2+3+4+5+6+7+8", &errors)))
+		clear_operation_pointer(operation);
+	else
+		die_free(errors);
+
+	if(exp_to_op("2+)", &errors) == NULL && errors)
+		die_free(errors);
+
+	die_set_thread_allocator(NULL);
+
+	if(!used || total_allocations == 0) {
+		fputs("The allocator set wasn't used.\n", stderr);
+		fails++;
+	}
+	if(live_allocations != 0) {
+		fprintf(stderr, "%ld allocations weren't freed through the allocator.\n", live_allocations);
+		fails++;
+	}
+
+	// Back to the default.
+	used = false;
+	if((operation = exp_to_op("d20", &errors)))
+		clear_operation_pointer(operation);
+	if(used) {
+		fputs("The allocator is still used after being unset.\n", stderr);
+		fails++;
+	}
+
+	return fails;
+}
+
+static void add_result_callback(double result, void *userdata)
+{
+	atomic_fetch_add((atomic_long*) userdata, (long) result);
+}
+
+int die_async_tester()
+{
+	int fails = 0;
+	struct Dierror *errors;
+	struct Operation *small;
+	struct Operation *big;
+	struct die_completion completions[4];
+	struct pollfd poll_fd;
+	atomic_long sum = 0;
+	long expected_sum;
+	size_t reaped;
+	int markers[2];
+	char calc_string[16];
+
+	if(!(small = exp_to_op("2d1+3", &errors)) || !(big = exp_to_op("5000d1-1", &errors))) {
+		fputs("Failed to parse the async test expressions.\n", stderr);
+		return 1;
+	}
+
+	if(die_async_start(2)) {
+		fputs("die_async_start failed.\n", stderr);
+		return 1;
+	}
+
+	// Callbacks (small operations are calculated right away, big ones by the pool).
+	expected_sum = 0;
+	for(int i = 0; i < 100; i++) {
+		if(die_submit((i % 2) ? big : small, NULL, NO_FLAG, add_result_callback, &sum)) {
+			fputs("die_submit failed.\n", stderr);
+			fails++;
+			continue;
+		}
+		expected_sum += (i % 2) ? 4999 : 5;
+	}
+
+	// Completions through die_reap.
+	if(die_submit(big, NULL, NO_FLAG, NULL, &markers[0])
+			|| die_submit(small, calc_string, NO_FLAG, NULL, &markers[1])) {
+		fputs("die_submit failed.\n", stderr);
+		fails++;
+	}
+
+	poll_fd.fd = die_completion_fd();
+	poll_fd.events = POLLIN;
+	for(reaped = 0; reaped < 2 && poll(&poll_fd, 1, 5000) == 1;) {
+		// (Reap one at a time, to check the fd stays readable.)
+		if(die_reap(&completions[reaped], 1) == 1)
+			reaped++;
+	}
+
+	if(reaped != 2) {
+		fprintf(stderr, "Only %zu completions were reaped.\n", reaped);
+		fails++;
+	}
+	for(size_t i = 0; i < reaped; i++) {
+		double expected = (completions[i].userdata == &markers[0]) ? 4999 : 5;
+
+		if(completions[i].result != expected) {
+			fprintf(stderr, "Reaped %lf instead of %lf.\n", completions[i].result, expected);
+			fails++;
+		}
+	}
+	if(reaped == 2 && completions[0].userdata == completions[1].userdata) {
+		fputs("die_reap returned the same completion twice.\n", stderr);
+		fails++;
+	}
+	if(reaped == 2 && strcmp(calc_string, "1+1+3") != 0) {
+		fprintf(stderr, "The submitted calc string is \"%s\" instead of \"1+1+3\".\n", calc_string);
+		fails++;
+	}
+
+	die_async_stop();
+
+	if(atomic_load(&sum) != expected_sum) {
+		fprintf(stderr, "The callbacks got %ld instead of %ld.\n", atomic_load(&sum), expected_sum);
+		fails++;
+	}
+	if(die_completion_fd() != -1) {
+		fputs("die_completion_fd is still open after die_async_stop.\n", stderr);
+		fails++;
+	}
+
+	clear_operation_pointer(small);
+	clear_operation_pointer(big);
+	return fails;
+}
@@ -21,4 +21,23 @@ int exp_to_op_tester();
 int get_calc_string_length_tester();
 int int_req_digits_tester();
 int operate_tester();
+int operate_i64_tester();
+int comparison_tester();
+int op_distribution_tester();
+int die_dist_queries_tester();
+int op_distribution_cached_tester();
+int op_normal_approx_tester();
+int op_cost_tester();
+int operate_bound_tester();
+int operate_repeat_tester();
+int operate_token_tester();
+int op_serialize_tester();
+int flat_operation_tester();
+int operate_batch_tester();
+int operate_histogram_tester();
+int die_stats_acc_tester();
+int shape_evaluator_tester();
+int die_stats_tester();
+int die_allocator_tester();
+int die_async_tester();
 
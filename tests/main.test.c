@@ -101,6 +101,25 @@ int main()
 			int_req_digits_tester, "int_req_digits",
 			get_calc_string_length_tester, "get_calc_string_length",
 			operate_tester, "operate",
+			operate_i64_tester, "operate_i64",
+			comparison_tester, "comparisons",
+			op_distribution_tester, "op_distribution",
+			die_dist_queries_tester, "die_dist queries",
+			op_distribution_cached_tester, "op_distribution_cached",
+			op_normal_approx_tester, "op_normal_approx",
+			op_cost_tester, "op_cost_estimate",
+			operate_bound_tester, "operate_bound",
+			operate_repeat_tester, "operate_repeat",
+			operate_token_tester, "operate_token",
+			op_serialize_tester, "op_serialize",
+			flat_operation_tester, "flat_operation",
+			operate_batch_tester, "operate_batch",
+			operate_histogram_tester, "operate_histogram",
+			die_stats_acc_tester, "die_stats_acc",
+			shape_evaluator_tester, "shape evaluators",
+			die_stats_tester, "die_stats",
+			die_allocator_tester, "die_allocator",
+			die_async_tester, "die_async",
 			NULL);
 	announce_fails_or_die(fails);
 	return fails;
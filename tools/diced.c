@@ -0,0 +1,757 @@
+/* diced - local dice-evaluation daemon over a Unix domain socket.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Protocol: each line a client sends is a request, and gets a response line (in the same order):
+ *
+ * 	<dice-expression>\n	->	<result>[ <result>...]\n
+ * 	?<dice-expression>\n	->	<result>:<calculation string>[ ...]\n
+ * 	(on error)		->	! <error>[, <error>...]\n
+ *
+ * (See append_evaluation in tools_common.h.)
+ * Requests may be pipelined: a client may send any number of lines before reading the responses.
+ *
+ * Connections are spread between the worker threads (each with its own epoll instance), which
+ * evaluate all the complete lines they read at once and write the responses together.
+ * Parsed expressions are kept in a cache shared by all workers, and ones that would take longer than
+ * MAX_ESTIMATED_NS to calculate are rejected when parsed (see die_set_op_limits).
+ * A connection isn't read (and its lines aren't evaluated) while more than MAX_PENDING_OUTPUT bytes of
+ * responses wait to be written, so a client that doesn't read can't grow its output without bound.
+ *
+ * Usage: diced [-s socket path] [-t worker threads] [-c cache entries]
+ * 	  diced -T	(self test: serve on a temporary socket and check a few requests against it.) */
+
+#define _GNU_SOURCE
+
+#include "tools_common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SOCKET_PATH "diced.sock"
+#define DEFAULT_CACHE_ENTRIES 4096
+#define MAX_LINE_LENGTH (1 << 16)	// Longer lines close the connection.
+#define READ_SIZE (1 << 16)
+#define MAX_EVENTS 64
+#define MAX_ESTIMATED_NS 100000000	// Most estimated time of a request (see op_cost_estimate).
+#define MAX_PENDING_OUTPUT (1 << 20)	// Bytes of responses past which reading pauses.
+
+struct connection {
+	int fd;
+	bool closing;			// Client is done sending, close once out is written.
+	struct text_buffer in;
+	struct text_buffer out;
+	size_t out_written;		// Bytes of out already written.
+	struct connection *previous;	// In the list of the worker's connections.
+	struct connection *next;
+};
+
+struct worker {
+	pthread_t thread;
+	int epoll_fd;
+	struct server *server;
+	struct text_buffer scratch;
+	// Open connections (added by server_run, so the list is locked), closed by server_close.
+	struct connection *connections;
+	pthread_mutex_t connections_lock;
+};
+
+struct server {
+	int listen_fd;
+	int stop_pipe[2];		// Written to stop the server (readable end wakes everyone).
+	struct op_cache *cache;
+	struct worker *workers;
+	unsigned worker_count;
+	const char *socket_path;
+};
+
+int make_listen_socket(const char *path);
+bool server_start(struct server *server, const char *socket_path, unsigned worker_count, size_t cache_entries);
+void server_run(struct server *server);
+void server_stop(struct server *server);
+void server_close(struct server *server);
+void* worker_run(void *worker_ptr);
+bool add_connection(struct worker *worker, int fd);
+void free_connection(struct connection *connection);
+void close_connection(struct worker *worker, struct connection *connection);
+bool is_output_full(const struct connection *connection);
+bool read_connection(struct worker *worker, struct connection *connection);
+bool write_connection(struct worker *worker, struct connection *connection);
+bool evaluate_lines(struct worker *worker, struct connection *connection);
+int self_test(void);
+
+static int stop_fd = -1;
+
+static void handle_stop_signal(int signal_number)
+{
+	ssize_t ignored = write(stop_fd, "", 1);	// (Nothing to do on failure in a signal handler.)
+
+	(void) signal_number;
+	(void) ignored;
+}
+
+int main(int argc, char **argv)
+{
+	const char *socket_path = DEFAULT_SOCKET_PATH;
+	long worker_count = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t cache_entries = DEFAULT_CACHE_ENTRIES;
+	struct server server;
+	struct sigaction action = { .sa_handler = handle_stop_signal };
+	const struct die_op_limits limits = { .max_estimated_ns = MAX_ESTIMATED_NS };
+	int option;
+
+	die_set_op_limits(&limits);
+
+	while((option = getopt(argc, argv, "s:t:c:T")) != -1) {
+		switch(option) {
+		case('s'):
+			socket_path = optarg;
+			break;
+		case('t'):
+			worker_count = strtol(optarg, NULL, 10);
+			break;
+		case('c'):
+			cache_entries = strtoul(optarg, NULL, 10);
+			break;
+		case('T'):
+			return self_test();
+		default:
+			fprintf(stderr, "Usage: %s [-s socket path] [-t worker threads] [-c cache entries]\n"
+					"       %s -T\n", argv[0], argv[0]);
+			return 2;
+		}
+	}
+	if(worker_count < 1)
+		worker_count = 1;
+
+	if(server_start(&server, socket_path, worker_count, cache_entries))
+		return 1;
+
+	stop_fd = server.stop_pipe[1];
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	server_run(&server);
+	server_close(&server);
+	return 0;
+}
+
+int make_listen_socket(const char *path)
+{
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	int fd;
+
+	if(strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "diced: socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(address.sun_path, path);
+
+	if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		perror("diced: socket");
+		return -1;
+	}
+
+	unlink(path);
+	if(bind(fd, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(fd, SOMAXCONN) < 0) {
+		perror("diced: bind");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Start listening on socket_path and start the workers.
+ * Returns true (and prints why) on failure. */
+bool server_start(struct server *server, const char *socket_path, unsigned worker_count, size_t cache_entries)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	unsigned started;
+
+	server->socket_path = socket_path;
+	server->worker_count = worker_count;
+	server->cache = NULL;
+	server->workers = NULL;
+
+	if(pipe2(server->stop_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+		perror("diced: pipe");
+		return true;
+	}
+	if((server->listen_fd = make_listen_socket(socket_path)) < 0)
+		goto close_pipe;
+
+	if(!(server->cache = op_cache_make(cache_entries, true))
+			|| !(server->workers = calloc(worker_count, sizeof(*server->workers)))) {
+		fputs("diced: memory allocation failed\n", stderr);
+		goto close_cache;
+	}
+
+	for(started = 0; started < worker_count; started++) {
+		struct worker *worker = &server->workers[started];
+
+		worker->server = server;
+		pthread_mutex_init(&worker->connections_lock, NULL);
+		if((worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0
+				|| epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, server->stop_pipe[0], &event) < 0
+				|| pthread_create(&worker->thread, NULL, worker_run, worker) != 0) {
+			perror("diced: worker");
+			if(worker->epoll_fd >= 0)
+				close(worker->epoll_fd);
+			goto stop_workers;
+		}
+	}
+
+	return false;
+
+stop_workers:
+	server->worker_count = started;
+	server_stop(server);
+	for(unsigned i = 0; i < started; i++) {
+		pthread_join(server->workers[i].thread, NULL);
+		close(server->workers[i].epoll_fd);
+	}
+close_cache:
+	free(server->workers);
+	if(server->cache)
+		op_cache_free(server->cache);
+	close(server->listen_fd);
+	unlink(socket_path);
+close_pipe:
+	close(server->stop_pipe[0]);
+	close(server->stop_pipe[1]);
+	return true;
+}
+
+/* Accept connections (giving them to the workers in turn) until the server is stopped. */
+void server_run(struct server *server)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = NULL };
+	unsigned next_worker = 0;
+	int epoll_fd;
+	int fd;
+
+	if((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("diced: epoll");
+		return;
+	}
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server->stop_pipe[0], &event);
+	event.data.ptr = server;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event);
+
+	for(;;) {
+		if(epoll_wait(epoll_fd, &event, 1, -1) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("diced: epoll_wait");
+			break;
+		}
+		if(event.data.ptr == NULL)
+			break;	// Stopped.
+
+		while((fd = accept4(server->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+			if(add_connection(&server->workers[next_worker], fd))
+				close(fd);
+			next_worker = (next_worker + 1) % server->worker_count;
+		}
+	}
+
+	close(epoll_fd);
+}
+
+void server_stop(struct server *server)
+{
+	if(write(server->stop_pipe[1], "", 1) < 0)
+		perror("diced: stop");
+}
+
+/* Stop the workers and free everything (connections still open are closed without writing the rest
+ * of their responses). */
+void server_close(struct server *server)
+{
+	struct connection *next;
+
+	server_stop(server);
+	for(unsigned i = 0; i < server->worker_count; i++) {
+		pthread_join(server->workers[i].thread, NULL);
+		close(server->workers[i].epoll_fd);
+
+		// (The workers are done, so the lists aren't locked).
+		for(struct connection *connection = server->workers[i].connections; connection; connection = next) {
+			next = connection->next;
+			free_connection(connection);
+		}
+		pthread_mutex_destroy(&server->workers[i].connections_lock);
+	}
+
+	free(server->workers);
+	op_cache_free(server->cache);
+	close(server->listen_fd);
+	unlink(server->socket_path);
+	close(server->stop_pipe[0]);
+	close(server->stop_pipe[1]);
+}
+
+void* worker_run(void *worker_ptr)
+{
+	struct worker *worker = worker_ptr;
+	struct epoll_event events[MAX_EVENTS];
+	struct connection *connection;
+	int event_count;
+	bool stopped = false;
+
+	while(!stopped) {
+		if((event_count = epoll_wait(worker->epoll_fd, events, MAX_EVENTS, -1)) < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("diced: epoll_wait");
+			break;
+		}
+
+		for(int i = 0; i < event_count; i++) {
+			if(!(connection = events[i].data.ptr)) {
+				stopped = true;
+				continue;
+			}
+
+			if(((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && read_connection(worker, connection))
+					|| write_connection(worker, connection))
+				close_connection(worker, connection);
+		}
+	}
+
+	text_buffer_close(&worker->scratch);
+	return NULL;
+}
+
+/* Make a connection of fd and give it to worker. Returns true on failure (fd is then left open). */
+bool add_connection(struct worker *worker, int fd)
+{
+	struct epoll_event event = { .events = EPOLLIN };
+	struct connection *connection;
+
+	if(!(connection = calloc(1, sizeof(*connection))))
+		return true;
+	connection->fd = fd;
+	event.data.ptr = connection;
+
+	// (Linked first, since the worker may close it as soon as it's added to epoll).
+	pthread_mutex_lock(&worker->connections_lock);
+	if((connection->next = worker->connections))
+		connection->next->previous = connection;
+	worker->connections = connection;
+	pthread_mutex_unlock(&worker->connections_lock);
+
+	if(epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		pthread_mutex_lock(&worker->connections_lock);
+		if((worker->connections = connection->next))
+			connection->next->previous = NULL;
+		pthread_mutex_unlock(&worker->connections_lock);
+		free(connection);
+		return true;
+	}
+	return false;
+}
+
+void free_connection(struct connection *connection)
+{
+	close(connection->fd);
+	text_buffer_close(&connection->in);
+	text_buffer_close(&connection->out);
+	free(connection);
+}
+
+void close_connection(struct worker *worker, struct connection *connection)
+{
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+
+	pthread_mutex_lock(&worker->connections_lock);
+	if(connection->previous)
+		connection->previous->next = connection->next;
+	else
+		worker->connections = connection->next;
+	if(connection->next)
+		connection->next->previous = connection->previous;
+	pthread_mutex_unlock(&worker->connections_lock);
+
+	free_connection(connection);
+}
+
+/* Return true if more than MAX_PENDING_OUTPUT bytes of responses wait to be written. */
+bool is_output_full(const struct connection *connection)
+{
+	return connection->out.length - connection->out_written > MAX_PENDING_OUTPUT;
+}
+
+/* Read what's available on connection and evaluate all the complete lines.
+ * Returns true if connection should be closed now. */
+bool read_connection(struct worker *worker, struct connection *connection)
+{
+	ssize_t bytes_read;
+
+	if(connection->closing || is_output_full(connection))
+		return false;
+
+	if(text_buffer_reserve(&connection->in, READ_SIZE))
+		return true;
+
+	bytes_read = read(connection->fd, connection->in.data + connection->in.length, READ_SIZE);
+	if(bytes_read < 0)
+		return errno != EAGAIN && errno != EINTR;
+
+	if(bytes_read == 0) {
+		// A last line may be missing its '\n' (but the input may also hold complete lines, left while
+		// the output was full).
+		connection->closing = true;
+		if(connection->in.length != 0 && connection->in.data[connection->in.length - 1] != '\n'
+				&& text_buffer_append(&connection->in, "\n", 1))
+			return true;
+	}
+
+	connection->in.length += bytes_read;
+	return evaluate_lines(worker, connection);
+}
+
+/* Write as much of the pending responses as possible (evaluating the lines left while the output was
+ * full), and watch for writability if some are left.
+ * Returns true if connection should be closed now. */
+bool write_connection(struct worker *worker, struct connection *connection)
+{
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = connection };
+	struct text_buffer *out = &connection->out;
+	struct text_buffer *in = &connection->in;
+	ssize_t bytes_written;
+
+	for(;;) {
+		while(connection->out_written < out->length) {
+			bytes_written = write(connection->fd, out->data + connection->out_written,
+					out->length - connection->out_written);
+			if(bytes_written < 0) {
+				if(errno == EINTR)
+					continue;
+				if(errno != EAGAIN)
+					return true;
+
+				// (Not reading while the output is full).
+				event.events = (connection->closing || is_output_full(connection))
+					? EPOLLOUT : EPOLLIN | EPOLLOUT;
+				epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+				return false;
+			}
+			connection->out_written += bytes_written;
+		}
+		out->length = connection->out_written = 0;
+
+		// Evaluate the lines left while the output was full.
+		if(in->length == 0 || !memchr(in->data, '\n', in->length))
+			break;
+		if(evaluate_lines(worker, connection))
+			return true;
+	}
+
+	if(connection->closing)
+		return true;
+
+	epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+	return false;
+}
+
+/* Evaluate the complete lines in connection's input into its output, and keep the rest: the incomplete
+ * last line, and the lines left once the output is full (see write_connection).
+ * Returns true if connection should be closed now. */
+bool evaluate_lines(struct worker *worker, struct connection *connection)
+{
+	struct text_buffer *in = &connection->in;
+	char *line = in->data;
+	char *line_end;
+	bool with_calc_string;
+
+	while(!is_output_full(connection) && (line_end = memchr(line, '\n', in->data + in->length - line))) {
+		*line_end = '\0';
+		if(line_end != line && line_end[-1] == '\r')
+			line_end[-1] = '\0';
+
+		if((with_calc_string = (*line == '?')))
+			line++;
+
+		if(append_evaluation(&connection->out, worker->server->cache, line,
+					with_calc_string, &worker->scratch))
+			return true;
+
+		line = line_end + 1;
+	}
+
+	in->length -= line - in->data;
+	if(in->length > MAX_LINE_LENGTH && !memchr(line, '\n', in->length))
+		return true;
+	memmove(in->data, line, in->length);
+
+	return false;
+}
+
+
+/* -- Self test -- */
+
+// Expected responses to requests (deterministic ones only).
+static const char *const self_test_cases[][2] = {
+	{"1+2", "3"},
+	{"?3*4", "12:3*4"},
+	{"2^10-24", "1000"},
+	{"3x5", "5 5 5"},
+	{"?2x(1+1)", "2:(1+1) 2:(1+1)"},
+	{"5/2", "2.5"},
+	{"1d1+1d1", "2"},
+	{"1+", "! missing number"},
+	{"", "! empty expression"},
+	{"d20+$0", "! unbound placeholder"},
+	{"d20+$4294967295", "! invalid placeholder"},
+	{"4000000000d1000000", "! exceeds limits"},
+};
+
+#define SELF_TEST_CASE_COUNT (sizeof(self_test_cases) / sizeof(*self_test_cases))
+// Requests sent by the flood client before it reads (their responses are bigger than MAX_PENDING_OUTPUT).
+#define SELF_TEST_FLOOD_REQUEST "200x1\n"
+#define SELF_TEST_FLOOD_LINES 10000
+#define SELF_TEST_CLIENTS 4
+
+struct self_test_client {
+	pthread_t thread;
+	const char *socket_path;
+	bool failed;
+};
+
+/* Send all the requests (twice, split at an awkward point to check partial lines), then read and check
+ * all the responses. */
+static void* self_test_client_run(void *client_ptr)
+{
+	struct self_test_client *client = client_ptr;
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	struct text_buffer requests = {0};
+	struct text_buffer responses = {0};
+	char *response;
+	char *response_end;
+	ssize_t bytes;
+	int fd;
+
+	client->failed = true;
+	strcpy(address.sun_path, client->socket_path);
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+			|| connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+		perror("diced: self test connect");
+		goto close;
+	}
+
+	for(int round = 0; round < 2; round++) {
+		for(size_t i = 0; i < SELF_TEST_CASE_COUNT; i++) {
+			if(text_buffer_append(&requests, self_test_cases[i][0], strlen(self_test_cases[i][0]))
+					|| text_buffer_append(&requests, "\n", 1))
+				goto close;
+		}
+	}
+	// The last line is sent without '\n' (ended by shutting down the connection).
+	requests.length--;
+
+	if(write(fd, requests.data, 5) != 5) {
+		perror("diced: self test write");
+		goto close;
+	}
+	nanosleep(&(struct timespec) { .tv_nsec = 10000000 }, NULL);
+	if(write(fd, requests.data + 5, requests.length - 5) != (ssize_t) requests.length - 5
+			|| shutdown(fd, SHUT_WR) < 0) {
+		perror("diced: self test write");
+		goto close;
+	}
+
+	do {
+		if(text_buffer_reserve(&responses, READ_SIZE))
+			goto close;
+		if((bytes = read(fd, responses.data + responses.length, READ_SIZE)) < 0) {
+			perror("diced: self test read");
+			goto close;
+		}
+		responses.length += bytes;
+	} while(bytes != 0);
+
+	response = responses.data;
+	for(size_t i = 0; i < 2 * SELF_TEST_CASE_COUNT; i++) {
+		const char *expected = self_test_cases[i % SELF_TEST_CASE_COUNT][1];
+
+		if(!response || !(response_end = memchr(response, '\n', responses.data + responses.length - response))) {
+			fprintf(stderr, "diced: self test: missing response to \"%s\"\n",
+					self_test_cases[i % SELF_TEST_CASE_COUNT][0]);
+			goto close;
+		}
+		*response_end = '\0';
+		if(strcmp(response, expected) != 0) {
+			fprintf(stderr, "diced: self test: \"%s\" gave \"%s\" instead of \"%s\"\n",
+					self_test_cases[i % SELF_TEST_CASE_COUNT][0], response, expected);
+			goto close;
+		}
+		response = response_end + 1;
+	}
+
+	client->failed = (response != responses.data + responses.length);
+	if(client->failed)
+		fputs("diced: self test: extra responses\n", stderr);
+
+close:
+	if(fd >= 0)
+		close(fd);
+	text_buffer_close(&requests);
+	text_buffer_close(&responses);
+	return NULL;
+}
+
+/* Write all the flood requests at once and half-close right away, so the server gets the end of the input
+ * while it still holds complete lines (left while its output was full). */
+static void* self_test_flood_write(void *fd_ptr)
+{
+	const int fd = *(int*) fd_ptr;
+	static char requests[SELF_TEST_FLOOD_LINES * (sizeof(SELF_TEST_FLOOD_REQUEST) - 1)];
+	size_t written = 0;
+	ssize_t bytes;
+
+	for(int i = 0; i < SELF_TEST_FLOOD_LINES; i++)
+		memcpy(requests + i * (sizeof(SELF_TEST_FLOOD_REQUEST) - 1), SELF_TEST_FLOOD_REQUEST,
+				sizeof(SELF_TEST_FLOOD_REQUEST) - 1);
+	while(written < sizeof(requests) && (bytes = write(fd, requests + written, sizeof(requests) - written)) > 0)
+		written += bytes;
+	shutdown(fd, SHUT_WR);
+	return NULL;
+}
+
+/* Send many requests without reading (so the server's output fills up and it stops reading), then read
+ * and check all the responses. */
+static void* self_test_flood_run(void *client_ptr)
+{
+	struct self_test_client *client = client_ptr;
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	struct text_buffer responses = {0};
+	char expected[2 * 200];
+	pthread_t writer;
+	size_t line_count = 0;
+	ssize_t bytes;
+	int fd;
+
+	client->failed = true;
+	for(int i = 0; i < 200; i++)
+		memcpy(expected + 2 * i, "1 ", 2);
+	expected[sizeof(expected) - 1] = '\n';
+
+	strcpy(address.sun_path, client->socket_path);
+	if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+			|| connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+		perror("diced: self test connect");
+		goto close;
+	}
+
+	// (Written from another thread, since the server stops reading until responses are read).
+	if(pthread_create(&writer, NULL, self_test_flood_write, &fd) != 0)
+		goto close;
+	nanosleep(&(struct timespec) { .tv_nsec = 100000000 }, NULL);
+
+	do {
+		if(text_buffer_reserve(&responses, READ_SIZE))
+			break;
+		if((bytes = read(fd, responses.data + responses.length, READ_SIZE)) < 0) {
+			perror("diced: self test read");
+			break;
+		}
+		responses.length += bytes;
+	} while(bytes != 0);
+	pthread_join(writer, NULL);
+
+	for(size_t i = 0; i + sizeof(expected) <= responses.length; i += sizeof(expected)) {
+		if(memcmp(responses.data + i, expected, sizeof(expected)) != 0)
+			break;
+		line_count++;
+	}
+	client->failed = (line_count != SELF_TEST_FLOOD_LINES
+			|| responses.length != SELF_TEST_FLOOD_LINES * sizeof(expected));
+	if(client->failed)
+		fprintf(stderr, "diced: self test: %zu of %d flooded requests answered\n",
+				line_count, SELF_TEST_FLOOD_LINES);
+
+close:
+	if(fd >= 0)
+		close(fd);
+	text_buffer_close(&responses);
+	return NULL;
+}
+
+static void* self_test_server_run(void *server)
+{
+	server_run(server);
+	return NULL;
+}
+
+int self_test(void)
+{
+	char directory[] = "/tmp/diced.XXXXXX";
+	char socket_path[sizeof(directory) + sizeof("/diced.sock")];
+	struct self_test_client clients[SELF_TEST_CLIENTS];
+	struct self_test_client flood_client;
+	struct server server;
+	pthread_t server_thread;
+	bool failed = false;
+
+	signal(SIGPIPE, SIG_IGN);
+	if(!mkdtemp(directory)) {
+		perror("diced: self test mkdtemp");
+		return 1;
+	}
+	sprintf(socket_path, "%s/diced.sock", directory);
+
+	// Small cache so both cached and uncached operations are used.
+	if(server_start(&server, socket_path, 2, 4)) {
+		rmdir(directory);
+		return 1;
+	}
+	pthread_create(&server_thread, NULL, self_test_server_run, &server);
+
+	for(int i = 0; i < SELF_TEST_CLIENTS; i++) {
+		clients[i].socket_path = socket_path;
+		pthread_create(&clients[i].thread, NULL, self_test_client_run, &clients[i]);
+	}
+	flood_client.socket_path = socket_path;
+	pthread_create(&flood_client.thread, NULL, self_test_flood_run, &flood_client);
+	for(int i = 0; i < SELF_TEST_CLIENTS; i++) {
+		pthread_join(clients[i].thread, NULL);
+		failed = failed || clients[i].failed;
+	}
+	pthread_join(flood_client.thread, NULL);
+	failed = failed || flood_client.failed;
+
+	server_stop(&server);
+	pthread_join(server_thread, NULL);
+	server_close(&server);
+	rmdir(directory);
+
+	puts((failed) ? "diced self test failed." : "diced self test passed.");
+	return failed;
+}
@@ -0,0 +1,326 @@
+/* dieroll - evaluate a stream of dice-expressions, one per line.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Each input line gets an output line, in the same order (see append_evaluation in tools_common.h).
+ *
+ * The input (a file, mapped into memory if possible, or stdin) is handled in blocks of whole lines.
+ * Each block is split between the threads, which parse the lines in place ('\n' replaced by '\0'),
+ * reusing the operations of lines they've seen before, and evaluate them into their own output
+ * buffers, which are then written in order.
+ *
+ * Usage: dieroll [-c] [-t threads] [file]
+ * 	-c	Output the calculation string of each result too.
+ * 	-t	Number of threads (the number of processors by default). */
+
+#define _GNU_SOURCE
+
+#include "tools_common.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BLOCK_SIZE (8 << 20)		// Input handled at once (before writing the output).
+#define MIN_THREAD_INPUT (64 << 10)	// Less input than this per thread isn't worth splitting.
+#define CACHE_ENTRIES 4096		// Operations each thread keeps.
+
+struct job {
+	pthread_t thread;
+	char *start;			// Lines to evaluate (each ending with '\n').
+	char *end;
+	bool with_calc_string;
+	bool failed;			// Memory allocation error.
+	bool joinable;			// Run by its own thread.
+
+	struct op_cache *cache;
+	struct text_buffer out;
+	struct text_buffer scratch;
+};
+
+void* run_job(void *job_ptr);
+bool process_block(char *block, size_t length, struct job *jobs, unsigned job_count);
+bool process_mapped(int fd, size_t size, struct job *jobs, unsigned job_count);
+bool process_stream(int fd, struct job *jobs, unsigned job_count);
+bool write_all(int fd, const char *data, size_t length);
+
+int main(int argc, char **argv)
+{
+	long job_count = sysconf(_SC_NPROCESSORS_ONLN);
+	bool with_calc_string = false;
+	struct job *jobs;
+	struct stat status;
+	int option;
+	int fd = STDIN_FILENO;
+	bool failed;
+
+	while((option = getopt(argc, argv, "ct:")) != -1) {
+		switch(option) {
+		case('c'):
+			with_calc_string = true;
+			break;
+		case('t'):
+			job_count = strtol(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] [-t threads] [file]\n", argv[0]);
+			return 2;
+		}
+	}
+	if(job_count < 1)
+		job_count = 1;
+
+	if(optind < argc && strcmp(argv[optind], "-") != 0 && (fd = open(argv[optind], O_RDONLY)) < 0) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if(!(jobs = calloc(job_count, sizeof(*jobs))))
+		goto memory_error;
+	for(long i = 0; i < job_count; i++) {
+		jobs[i].with_calc_string = with_calc_string;
+		if(!(jobs[i].cache = op_cache_make(CACHE_ENTRIES, false)))
+			goto memory_error;
+	}
+
+	if(fstat(fd, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0)
+		failed = process_mapped(fd, status.st_size, jobs, job_count);
+	else
+		failed = process_stream(fd, jobs, job_count);
+
+	for(long i = 0; i < job_count; i++) {
+		op_cache_free(jobs[i].cache);
+		text_buffer_close(&jobs[i].out);
+		text_buffer_close(&jobs[i].scratch);
+	}
+	free(jobs);
+	close(fd);
+
+	return failed;
+
+memory_error:
+	fputs("dieroll: memory allocation failed\n", stderr);
+	return 1;
+}
+
+void* run_job(void *job_ptr)
+{
+	struct job *job = job_ptr;
+	char *line = job->start;
+	char *line_end;
+
+	while(line != job->end) {
+		line_end = memchr(line, '\n', job->end - line);
+		*line_end = '\0';
+		if(line_end != line && line_end[-1] == '\r')
+			line_end[-1] = '\0';
+
+		if(append_evaluation(&job->out, job->cache, line, job->with_calc_string, &job->scratch)) {
+			job->failed = true;
+			break;
+		}
+
+		line = line_end + 1;
+	}
+
+	return NULL;
+}
+
+/* Evaluate the lines of block (which ends with '\n') split between the jobs, and write the output.
+ * Returns true (and prints why) on failure. */
+bool process_block(char *block, size_t length, struct job *jobs, unsigned job_count)
+{
+	char *const end = block + length;
+	char *start = block;
+	unsigned used;
+	bool failed = false;
+
+	if(length / MIN_THREAD_INPUT < job_count)
+		job_count = (length / MIN_THREAD_INPUT) ? length / MIN_THREAD_INPUT : 1;
+
+	// Split at the line ends after each (equal) share.
+	for(used = 0; used < job_count && start != end; used++) {
+		jobs[used].start = start;
+		if(used == job_count - 1) {
+			start = end;
+		} else {
+			start = block + length / job_count * (used + 1);
+			if(start < jobs[used].start)
+				start = jobs[used].start;
+			start = (char*) memchr(start, '\n', end - start) + 1;
+		}
+		jobs[used].end = start;
+		jobs[used].out.length = 0;
+	}
+
+	// The first job is run by this thread.
+	for(unsigned i = 1; i < used; i++) {
+		if(!(jobs[i].joinable = (pthread_create(&jobs[i].thread, NULL, run_job, &jobs[i]) == 0)))
+			run_job(&jobs[i]);
+	}
+	run_job(&jobs[0]);
+
+	for(unsigned i = 0; i < used; i++) {
+		if(i != 0 && jobs[i].joinable)
+			pthread_join(jobs[i].thread, NULL);
+
+		if(jobs[i].failed) {
+			fputs("dieroll: memory allocation failed\n", stderr);
+			failed = true;
+		}
+		if(!failed && write_all(STDOUT_FILENO, jobs[i].out.data, jobs[i].out.length)) {
+			perror("dieroll: write");
+			failed = true;
+		}
+	}
+
+	return failed;
+}
+
+/* Process the file fd of size bytes through a private mapping (so lines can be terminated in place).
+ * Returns true on failure. */
+bool process_mapped(int fd, size_t size, struct job *jobs, unsigned job_count)
+{
+	char *map;
+	char *block;
+	char *block_end;
+	char *last_line;
+	size_t last_length;
+	bool failed = false;
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED)
+		return process_stream(fd, jobs, job_count);
+	madvise(map, size, MADV_SEQUENTIAL);
+
+	for(block = map; !failed && block != map + size; block = block_end) {
+		block_end = (map + size - block > BLOCK_SIZE) ? block + BLOCK_SIZE : map + size;
+
+		// Blocks end after the last complete line in them (or the next one if there's none).
+		while(block_end != block && block_end[-1] != '\n')
+			block_end--;
+		if(block_end == block) {
+			if(!(block_end = memchr(block, '\n', map + size - block)))
+				break;
+			block_end++;
+		}
+
+		failed = process_block(block, block_end - block, jobs, job_count);
+	}
+
+	// A last line without '\n' has no room for it in the mapping.
+	if(!failed && block != map + size) {
+		last_length = map + size - block;
+		if(!(last_line = malloc(last_length + 1))) {
+			fputs("dieroll: memory allocation failed\n", stderr);
+			failed = true;
+		} else {
+			memcpy(last_line, block, last_length);
+			last_line[last_length] = '\n';
+			failed = process_block(last_line, last_length + 1, jobs, 1);
+			free(last_line);
+		}
+	}
+
+	munmap(map, size);
+	return failed;
+}
+
+/* Process fd by reading it in blocks.
+ * Returns true on failure. */
+bool process_stream(int fd, struct job *jobs, unsigned job_count)
+{
+	size_t size = BLOCK_SIZE;
+	size_t length = 0;		// Bytes in buffer.
+	size_t searched = 0;		// Bytes of buffer known not to contain '\n'.
+	char *buffer;
+	char *new_buffer;
+	char *lines_end;
+	ssize_t bytes_read;
+	bool eof = false;
+	bool failed = false;
+
+	if(!(buffer = malloc(size)))
+		goto memory_error;
+
+	while(!failed && !eof) {
+		while(length < size && (bytes_read = read(fd, buffer + length, size - length)) != 0) {
+			if(bytes_read < 0) {
+				if(errno == EINTR)
+					continue;
+				perror("dieroll: read");
+				free(buffer);
+				return true;
+			}
+			length += bytes_read;
+		}
+		eof = (length < size);
+
+		if(eof && length != 0 && buffer[length - 1] != '\n')
+			buffer[length++] = '\n';	// (There's room since the buffer isn't full.)
+
+		// Find the end of the last complete line.
+		for(lines_end = buffer + length; lines_end != buffer + searched && lines_end[-1] != '\n'; lines_end--)
+			;
+
+		if(lines_end == buffer + searched) {
+			// No complete line (a very long one), make room for more.
+			searched = length;
+			if(!(new_buffer = realloc(buffer, size * 2)))
+				goto memory_error;
+			buffer = new_buffer;
+			size *= 2;
+			continue;
+		}
+
+		failed = process_block(buffer, lines_end - buffer, jobs, job_count);
+
+		length -= lines_end - buffer;
+		memmove(buffer, lines_end, length);
+		searched = 0;
+	}
+
+	free(buffer);
+	return failed;
+
+memory_error:
+	free(buffer);
+	fputs("dieroll: memory allocation failed\n", stderr);
+	return true;
+}
+
+bool write_all(int fd, const char *data, size_t length)
+{
+	ssize_t written;
+
+	while(length != 0) {
+		if((written = write(fd, data, length)) < 0) {
+			if(errno == EINTR)
+				continue;
+			return true;
+		}
+		data += written;
+		length -= written;
+	}
+	return false;
+}
@@ -0,0 +1,123 @@
+/* gen_dice_tables - generate the probability tables of standard dice (see dice_tables.h).
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Run by the build (a CMake custom command), writing a C file with a table for each of STANDARD_SIDES
+ * and 1 to DICE_TABLE_MAX_DICE dice, and get_dice_table.
+ *
+ * Each table is calculated by the sliding window sums of get_die_distribution, in the same order, and
+ * written as hexadecimal floating point, so the tables are exactly what it would calculate.
+ *
+ * Usage: gen_dice_tables output-file */
+
+#include "../dice_tables.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+void write_tables(FILE *output, int sides);
+void write_lookup(FILE *output);
+
+/* Write the tables of 1 to DICE_TABLE_MAX_DICE dice of sides sides, and an array of them. */
+void write_tables(FILE *output, int sides)
+{
+	const size_t max_length = (size_t) DICE_TABLE_MAX_DICE * (sides - 1) + 1;
+	double *probabilities, *previous;
+	double window;
+	size_t length = 1;
+
+	probabilities = malloc(max_length * sizeof(*probabilities));
+	previous = malloc(max_length * sizeof(*previous));
+	if(!probabilities || !previous) {
+		fputs("gen_dice_tables: out of memory.\n", stderr);
+		exit(1);
+	}
+
+	// (Indexed from the sum of the dice rolled so far; starting at 0 with none rolled).
+	probabilities[0] = 1;
+	for(unsigned dice = 1; dice <= DICE_TABLE_MAX_DICE; dice++) {
+		for(size_t i = 0; i < length; i++)
+			previous[i] = probabilities[i];
+
+		window = 0;
+		for(size_t i = 0; i < length + sides - 1; i++) {
+			if(i < length)
+				window += previous[i];
+			if(i >= (size_t) sides)
+				window -= previous[i - sides];
+			probabilities[i] = window / sides;
+		}
+		length += sides - 1;
+
+		fprintf(output, "static const double table_%dd%d[%zu] = {", dice, sides, length);
+		for(size_t i = 0; i < length; i++)
+			fprintf(output, "%s%a,", (i % 4 == 0) ? "\n\t" : " ", probabilities[i]);
+		fputs("\n};\n", output);
+	}
+
+	fprintf(output, "static const double *const tables_d%d[DICE_TABLE_MAX_DICE] = {", sides);
+	for(unsigned dice = 1; dice <= DICE_TABLE_MAX_DICE; dice++)
+		fprintf(output, "%stable_%dd%d,", (dice % 4 == 1) ? "\n\t" : " ", dice, sides);
+	fputs("\n};\n\n", output);
+
+	free(probabilities);
+	free(previous);
+}
+
+void write_lookup(FILE *output)
+{
+	fputs("const double* get_dice_table(unsigned dice, int sides)\n"
+			"{\n"
+			"\tif(dice == 0 || dice > DICE_TABLE_MAX_DICE)\n"
+			"\t\treturn NULL;\n"
+			"\n"
+			"\tswitch (sides) {\n", output);
+#define WRITE_CASE(sides) fprintf(output, "\tcase(%d):\n\t\treturn tables_d%d[dice - 1];\n", sides, sides);
+	STANDARD_SIDES(WRITE_CASE)
+#undef WRITE_CASE
+	fputs("\tdefault:\n"
+			"\t\treturn NULL;\n"
+			"\t}\n"
+			"}\n", output);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *output;
+
+	if(argc != 2) {
+		fputs("Usage: gen_dice_tables output-file\n", stderr);
+		return 1;
+	}
+	if(!(output = fopen(argv[1], "w"))) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	fputs("/* Generated by tools/gen_dice_tables.c, don't edit. */\n\n"
+			"#include \"dice_tables.h\"\n\n"
+			"#include <stddef.h>\n\n", output);
+#define WRITE_TABLES(sides) write_tables(output, sides);
+	STANDARD_SIDES(WRITE_TABLES)
+#undef WRITE_TABLES
+	write_lookup(output);
+
+	if(fclose(output) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,296 @@
+/* Code shared by the command line tools.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "tools_common.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* -- Text buffer -- */
+
+bool text_buffer_reserve(struct text_buffer *buffer, size_t needed)
+{
+	size_t new_size;
+	char *new_data;
+
+	if(buffer->size - buffer->length >= needed)
+		return false;
+
+	new_size = (buffer->size) ? buffer->size : 256;
+	while(new_size - buffer->length < needed)
+		new_size *= 2;
+
+	if(!(new_data = realloc(buffer->data, new_size)))
+		return true;
+
+	buffer->data = new_data;
+	buffer->size = new_size;
+	return false;
+}
+
+bool text_buffer_append(struct text_buffer *buffer, const char *str, size_t length)
+{
+	if(text_buffer_reserve(buffer, length))
+		return true;
+
+	memcpy(buffer->data + buffer->length, str, length);
+	buffer->length += length;
+	return false;
+}
+
+void text_buffer_close(struct text_buffer *buffer)
+{
+	free(buffer->data);
+	buffer->data = NULL;
+	buffer->length = buffer->size = 0;
+}
+
+
+/* -- Operation cache -- */
+
+/* Open addressing hash table (linear probing), with room for twice max_entries
+ * so probing stays short. */
+struct op_cache_entry {
+	char *dice_exp;			// NULL if the entry is empty.
+	uint64_t hash;
+	struct Operation *operation;
+};
+
+struct op_cache {
+	struct op_cache_entry *entries;
+	size_t capacity;		// (A power of 2).
+	size_t length;
+	size_t max_entries;
+
+	bool shared;
+	pthread_rwlock_t lock;
+};
+
+// FNV-1a
+static uint64_t hash_string(const char *str)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for(; *str; str++)
+		hash = (hash ^ (unsigned char) *str) * 0x100000001b3;
+	return hash;
+}
+
+struct op_cache* op_cache_make(size_t max_entries, bool shared)
+{
+	struct op_cache *cache;
+
+	if(!(cache = malloc(sizeof(*cache))))
+		return NULL;
+
+	for(cache->capacity = 16; cache->capacity < 2 * max_entries; cache->capacity *= 2)
+		;
+	if(!(cache->entries = calloc(cache->capacity, sizeof(*cache->entries)))) {
+		free(cache);
+		return NULL;
+	}
+
+	cache->length = 0;
+	cache->max_entries = max_entries;
+	if((cache->shared = shared))
+		pthread_rwlock_init(&cache->lock, NULL);
+
+	return cache;
+}
+
+void op_cache_free(struct op_cache *cache)
+{
+	for(size_t i = 0; i < cache->capacity; i++) {
+		if(cache->entries[i].dice_exp) {
+			free(cache->entries[i].dice_exp);
+			clear_operation_pointer(cache->entries[i].operation);
+		}
+	}
+
+	if(cache->shared)
+		pthread_rwlock_destroy(&cache->lock);
+	free(cache->entries);
+	free(cache);
+}
+
+/* Return the entry of dice_exp, or the empty entry it should be inserted into. */
+static struct op_cache_entry* op_cache_find(struct op_cache *cache, const char *dice_exp, uint64_t hash)
+{
+	struct op_cache_entry *entry;
+
+	for(size_t i = hash & (cache->capacity - 1);; i = (i + 1) & (cache->capacity - 1)) {
+		entry = &cache->entries[i];
+		if(!entry->dice_exp || (entry->hash == hash && strcmp(entry->dice_exp, dice_exp) == 0))
+			return entry;
+	}
+}
+
+const struct Operation* op_cache_get(struct op_cache *cache, char *dice_exp,
+		struct Dierror **errors, bool *owned)
+{
+	const uint64_t hash = hash_string(dice_exp);
+
+	struct op_cache_entry *entry;
+	struct Operation *operation;
+	char *key;
+
+	*errors = NULL;
+	*owned = false;
+
+	if(cache->shared)
+		pthread_rwlock_rdlock(&cache->lock);
+	entry = op_cache_find(cache, dice_exp, hash);
+	operation = entry->operation;
+	if(cache->shared)
+		pthread_rwlock_unlock(&cache->lock);
+
+	if(operation)
+		return operation;
+
+	// Not cached, parse it (outside the lock) and try to add it.
+	if(!(operation = exp_to_op(dice_exp, errors)))
+		return NULL;
+
+	if(cache->shared)
+		pthread_rwlock_wrlock(&cache->lock);
+
+	entry = op_cache_find(cache, dice_exp, hash);
+	if(entry->operation) {
+		// Another thread added it meanwhile.
+		clear_operation_pointer(operation);
+		operation = entry->operation;
+	} else if(cache->length < cache->max_entries && (key = strdup(dice_exp))) {
+		entry->dice_exp = key;
+		entry->hash = hash;
+		entry->operation = operation;
+		cache->length++;
+	} else {
+		*owned = true;
+	}
+
+	if(cache->shared)
+		pthread_rwlock_unlock(&cache->lock);
+
+	return operation;
+}
+
+
+/* -- Evaluation -- */
+
+const char* dierror_type_name(enum dierror_type type)
+{
+	switch(type) {
+	case(invalid_operator):
+		return "invalid operator";
+	case(invalid_num):
+		return "invalid number";
+	case(missing_num):
+		return "missing number";
+	case(invalid_reps):
+		return "invalid repetitions";
+	case(zero_reps):
+		return "zero repetitions";
+	case(invalid_sides):
+		return "invalid sides";
+	case(non_existant_sides):
+		return "missing sides";
+	case(zero_sides):
+		return "zero sides";
+	case(unclosed_parenthesis):
+		return "unclosed parenthesis";
+	case(invalid_parenthesis):
+		return "invalid parenthesis";
+	case(empty_expression):
+		return "empty expression";
+	case(invalid_placeholder):
+		return "invalid placeholder";
+	case(exceeds_limits):
+		return "exceeds limits";
+	default:
+		return "unknown error";
+	}
+}
+
+// Append a formatted string (shorter than 64 bytes) to out.
+#define APPEND_FORMAT(out, ...) (text_buffer_reserve((out), 64)			\
+		|| ((out)->length += snprintf((out)->data + (out)->length, 64, __VA_ARGS__), false))
+
+// Append a literal string to out.
+#define APPEND_LITERAL(out, str) text_buffer_append((out), (str), sizeof(str) - 1)
+
+static bool append_errors(struct text_buffer *out, struct Dierror *errors)
+{
+	const char *name;
+	bool failed;
+
+	if(!errors)
+		return true;	// (Memory error in exp_to_op).
+
+	failed = APPEND_LITERAL(out, "! ");
+	for(struct Dierror *error = errors; !failed && error->type != end_of_list; error++) {
+		name = dierror_type_name(error->type);
+		failed = (error != errors && APPEND_LITERAL(out, ", "))
+			|| text_buffer_append(out, name, strlen(name));
+	}
+
+	die_free(errors);
+	return failed || APPEND_LITERAL(out, "\n");
+}
+
+bool append_evaluation(struct text_buffer *out, struct op_cache *cache, char *dice_exp,
+		bool with_calc_string, struct text_buffer *scratch)
+{
+	const struct Operation *operation;
+	struct Dierror *errors;
+	bool owned;
+	bool failed = false;
+
+	double result;
+	size_t length;
+
+	if(!(operation = op_cache_get(cache, dice_exp, &errors, &owned)))
+		return append_errors(out, errors);
+
+	if(get_slot_count(operation) != 0) {
+		failed = APPEND_LITERAL(out, "! unbound placeholder\n");
+		goto clear;
+	}
+
+	length = (with_calc_string) ? get_calc_string_length(operation) : 0;
+	if(length > MAX_CALC_STRING_LENGTH / operation->repetitions) {
+		failed = APPEND_LITERAL(out, "! calculation string too long\n");
+		goto clear;
+	}
+	if(with_calc_string && (failed = text_buffer_reserve(scratch, length)))
+		goto clear;
+
+	for(unsigned i = 0; !failed && i < operation->repetitions; i++) {
+		result = operate(operation, (with_calc_string) ? scratch->data : NULL, NO_FLAG);
+		failed = (i != 0 && APPEND_LITERAL(out, " ")) || APPEND_FORMAT(out, "%.17g", result)
+			|| (with_calc_string && (APPEND_LITERAL(out, ":")
+					|| text_buffer_append(out, scratch->data, strlen(scratch->data))));
+	}
+
+	failed = failed || APPEND_LITERAL(out, "\n");
+
+clear:
+	if(owned)
+		clear_operation_pointer((struct Operation*) operation);
+	return failed;
+}
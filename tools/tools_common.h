@@ -0,0 +1,85 @@
+/* Code shared by the command line tools - header.
+ * Copyright (C) 2023  hcjimmy
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#pragma once
+
+#include "../libdie.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* -- Text buffer -- */
+
+// Growable buffer of text (not '\0' terminated).
+struct text_buffer {
+	char *data;
+	size_t length;
+	size_t size;
+};
+
+/* Make sure at least `needed` more bytes fit in buffer.
+ * Returns true if a memory allocation error occured. */
+bool text_buffer_reserve(struct text_buffer *buffer, size_t needed);
+
+/* Append length bytes of str to buffer.
+ * Returns true if a memory allocation error occured. */
+bool text_buffer_append(struct text_buffer *buffer, const char *str, size_t length);
+
+void text_buffer_close(struct text_buffer *buffer);
+
+
+/* -- Operation cache -- */
+
+/* Cache of operations parsed from expressions, so repeated expressions are only parsed once.
+ * The cache only grows (up to max_entries), so the operations it returns stay valid until it's freed. */
+struct op_cache;
+
+/* Return a new cache holding up to max_entries operations, or NULL on memory error.
+ * If shared, the cache may be used by multiple threads at once. */
+struct op_cache* op_cache_make(size_t max_entries, bool shared);
+
+/* Free cache and all the operations in it. */
+void op_cache_free(struct op_cache *cache);
+
+/* Return the operation for dice_exp (with the same semantics as exp_to_op).
+ *
+ * If the operation is cached (or was just added), *owned is set to false and it must not be freed.
+ * Otherwise (the cache is full) *owned is set to true and the caller must free it with
+ * clear_operation_pointer. */
+const struct Operation* op_cache_get(struct op_cache *cache, char *dice_exp,
+		struct Dierror **errors, bool *owned);
+
+
+/* -- Evaluation -- */
+
+/* Return a short name for type (like "missing number"). */
+const char* dierror_type_name(enum dierror_type type);
+
+// Calculation strings (of all repetitions) longer than this are refused by append_evaluation.
+#define MAX_CALC_STRING_LENGTH (1 << 20)
+
+/* Evaluate dice_exp and append a line with the result to out:
+ *
+ * 	<result>[:<calculation string>][ <result>[:<calculation string>]...]\n
+ * or
+ * 	! <error>[, <error>...]\n
+ *
+ * A result per repetition (like "6x4d6"), each followed by its calculation string if with_calc_string.
+ * scratch is a buffer for the calculation string, reused between calls (initially zeroed).
+ *
+ * Returns true if a memory allocation error occured. */
+bool append_evaluation(struct text_buffer *out, struct op_cache *cache, char *dice_exp,
+		bool with_calc_string, struct text_buffer *scratch);